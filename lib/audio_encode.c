@@ -16,6 +16,8 @@
 
  #include "iaxclient.h"
  #include "audio_encode.h"
+#include "audio_gain.h"
+#include "audio_vad.h"
 
 // External reference to global debug flag
 extern int iaxc_debug_enabled;
@@ -113,28 +115,56 @@ static int audio_min_sample = 0;
 // Audio level normalization parameters
 static float target_level = 0.7f;         // Target level as fraction of max (about -3dB)
 static float level_smoothing = 0.95f;     // Smoothing factor for level detection
-static float current_level_peak = 0.0f;   // Current detected peak level
 static float gain_smoothing = 0.98f;      // Smoothing factor for gain changes
-static float current_gain = 1.0f;         // Current normalization gain
 
-// Forward declarations for audio normalization functions
-static short soft_clip(float sample);
-static void normalize_audio_buffer(short *buffer, int samples);
+/* The DSP state of one call's audio, hung off its struct iaxc_call next
+ * to the encoder and decoder, so that calls never share preprocessor,
+ * normalization or meter state and can be processed independently. */
+struct iaxc_audio_pipeline
+{
+	SpeexPreprocessState *st_small;  /* for ~85 sample frames */
+	SpeexPreprocessState *st_large;  /* for 160 sample frames */
 
-float iaxci_silence_threshold = AUDIO_ENCODE_SILENCE_DB;
+	/* settings last applied, see filters_serial and preset_serial */
+	int filters_serial;
+	int preset_serial;
 
-static float input_level = 0.0f;
-static float output_level = 0.0f;
+	/* transmit level normalization */
+	float level_peak;
+	float gain;
 
-static SpeexPreprocessState *st = NULL;
-static int speex_state_size = 0;
-static int speex_state_rate = 0;
+	/* analog AGC adjusts the mixer every 64 voiced frames */
+	int aagc_frames;
 
-int iaxci_filters = IAXC_FILTER_AGC|IAXC_FILTER_DENOISE|IAXC_FILTER_AAGC|IAXC_FILTER_CN;
+	/* decides which frames the preprocessor can skip */
+	struct vad_state vad;
+
+	float input_level;
+	float output_level;
+
+	/* use to measure time since last audio was processed */
+	struct timeval last_input;
+	struct timeval last_output;
+
+	/* on the list of all pipelines, for the level meter */
+	struct iaxc_audio_pipeline *next;
+};
+
+static struct iaxc_audio_pipeline *pipelines = NULL;
+static struct timeval last_levels;
+
+/* bumped whenever the filters or the preset change; each pipeline
+ * catches up the next time it processes audio */
+static volatile int filters_serial = 0;
+static volatile int preset_serial = 0;
+
+// Forward declarations for audio normalization functions
+static int normalize_audio_buffer(struct iaxc_audio_pipeline *pipe,
+		short *buffer, int samples);
 
-/* use to measure time since last audio was processed */
-static struct timeval timeLastInput ;
-static struct timeval timeLastOutput ;
+float iaxci_silence_threshold = AUDIO_ENCODE_SILENCE_DB;
+
+int iaxci_filters = IAXC_FILTER_AGC|IAXC_FILTER_DENOISE|IAXC_FILTER_AAGC|IAXC_FILTER_CN;
 
 static struct iaxc_speex_settings speex_settings =
 {
@@ -145,8 +175,6 @@ static struct iaxc_speex_settings speex_settings =
 	0,    /* abr */
 	3     /* complexity */
 };
-static SpeexPreprocessState* st_small = NULL;  // For ~85 sample buffers
-static SpeexPreprocessState* st_large = NULL;  // For 160 sample buffers
 
 /* Forward declarations for PTT filter functions */
 EXPORT void iaxc_ptt_filters_disable(void);
@@ -163,60 +191,50 @@ static float vol_to_db(float vol)
 		return log10f(vol) * 20.0f;
 }
 
-static int do_level_callback()
+/* The levels are kept per pipeline, but the application has one meter:
+ * every 100ms at most, whichever pipeline calls, it is given the loudest
+ * input and output any pipeline processed in the last second.  Only the
+ * microphone is processed as input, through the selected call's pipeline
+ * or the conference's local one, so input is the microphone's level. */
+static int do_level_callback(void)
 {
-	static struct timeval last = {0,0};
+	struct iaxc_audio_pipeline *pipe;
 	struct timeval now;
-	float input_db;
-	float output_db;
+	float input = 0.0f;
+	float output = 0.0f;
 
 	now = iax_tvnow();
 
-	if ( last.tv_sec != 0 && iaxci_usecdiff(&now, &last) < 100000 )
+	if ( last_levels.tv_sec != 0 &&
+	     iaxci_usecdiff(&now, &last_levels) < 100000 )
 		return 0;
 
-	last = now;
+	last_levels = now;
 
-	/* if input has not been processed in the last second, set to silent */
-	input_db = iaxci_usecdiff(&now, &timeLastInput) < 1000000 ?
-			vol_to_db(input_level) : AUDIO_ENCODE_SILENCE_DB;
-
-	/* if output has not been processed in the last second, set to silent */
-	output_db = iaxci_usecdiff(&now, &timeLastOutput) < 1000000 ?
-		vol_to_db(output_level) : AUDIO_ENCODE_SILENCE_DB;
+	/* what has not been processed in the last second counts as silent */
+	for ( pipe = pipelines; pipe; pipe = pipe->next )
+	{
+		if ( iaxci_usecdiff(&now, &pipe->last_input) < 1000000 &&
+		     pipe->input_level > input )
+			input = pipe->input_level;
+		if ( iaxci_usecdiff(&now, &pipe->last_output) < 1000000 &&
+		     pipe->output_level > output )
+			output = pipe->output_level;
+	}
 
-	iaxci_do_levels_callback(input_db, output_db);
+	iaxci_do_levels_callback(vol_to_db(input), vol_to_db(output));
 
 	return 0;
 }
 
 static void set_speex_filters()
 {
-	int i;
-    if (st_small)
-        set_speex_filters_for_state(st_small);
-    if (st_large)
-        set_speex_filters_for_state(st_large);
-    return;
-	if ( !st )
-		return;
+	filters_serial++;
+}
 
-	i = 1; /* always make VAD decision */
-	speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_VAD, &i);
-	i = (iaxci_filters & IAXC_FILTER_AGC) ? 1 : 0;
-	speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_AGC, &i);
-	i = (iaxci_filters & IAXC_FILTER_DENOISE) ? 1 : 0;
-	speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_DENOISE, &i);
-
-	/*
-	* We can tweak these parameters to play with VAD sensitivity.
-	* For now, we use the default values since it seems they are a good starting point.
-	* However, if need be, this is the code that needs to change
-	*/
-	i = 35;
-	speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_PROB_START, &i);
-	i = 20;
-	speex_preprocess_ctl(st, SPEEX_PREPROCESS_SET_PROB_CONTINUE, &i);
+static void update_level(float *level, int peak)
+{
+	*level += ((float)peak / 32767.0f - *level) / 5.0f;
 }
 
 static void calculate_level(short *audio, int len, float *level)
@@ -231,7 +249,7 @@ static void calculate_level(short *audio, int len, float *level)
 			sample : big_sample;
 	}
 
-	*level += ((float)big_sample / 32767.0f - *level) / 5.0f;
+	update_level(level, big_sample);
 }
 
 // Modified to accept a specific preprocessor state with adaptive settings
@@ -287,10 +305,11 @@ static void set_speex_filters_for_state(SpeexPreprocessState* state)
     AUDIO_LOG("Speex preprocessor configured with optimized voice settings");
 }
 
-static int input_postprocess(void *audio, int len, int rate)
+/* peak is the largest magnitude in audio, found while normalizing it, and
+ * onset says the frame starts like speech whatever its level */
+static int input_postprocess(struct iaxc_audio_pipeline *pipe, void *audio,
+		int len, int rate, int peak, int onset)
 {
-	static int frame_count = 0;
-    frame_count++;
     // Choose appropriate preprocessor state based on buffer size
     SpeexPreprocessState** active_st;
 
@@ -300,7 +319,6 @@ static int input_postprocess(void *audio, int len, int rate)
 
 
 
-	static float lowest_volume = 1.0f;
 	float volume;
 	int silent = 0;
 #ifdef SAVE_LOCAL_AUDIO
@@ -344,36 +362,42 @@ static int input_postprocess(void *audio, int len, int rate)
     // Use different preprocessor instances based on frame size category
     if (len < 100) {
         // Small frame (~85 samples)
-        active_st = &st_small;
+        active_st = &pipe->st_small;
         if (!*active_st) {
             *active_st = speex_preprocess_state_init(len, rate);
-            speex_state_size = len;  // Keep track for debugging only
-            speex_state_rate = rate;
             set_speex_filters_for_state(*active_st);
             AUDIO_LOG("Created small-frame preprocessor state: len=%d, rate=%d", len, rate);
         }
     }
     else {
         // Standard frame (160 samples)
-        active_st = &st_large;
+        active_st = &pipe->st_large;
         if (!*active_st) {
             *active_st = speex_preprocess_state_init(len, rate);
-            speex_state_size = len;  // Keep track for debugging only
-            speex_state_rate = rate;
             set_speex_filters_for_state(*active_st);
             AUDIO_LOG("Created large-frame preprocessor state: len=%d, rate=%d", len, rate);
         }
     }
 
-	calculate_level((short *)audio, len, &input_level);
+	update_level(&pipe->input_level, peak);
 #ifdef VERBOSE
-    AUDIO_LOG("input_post_process: Calculated input level %4.4f", input_level);
+    AUDIO_LOG("input_post_process: Calculated input level %4.4f", pipe->input_level);
 #endif
 	/* only preprocess if we're interested in VAD, AGC, or DENOISE */
     if ((iaxci_filters & (IAXC_FILTER_DENOISE | IAXC_FILTER_AGC)) ||
         iaxci_silence_threshold > 0.0f) {
-        
-        silent = !speex_preprocess(*active_st, (spx_int16_t*)audio, NULL);
+        const int awake = vad_awake(&pipe->vad, (short *)audio, len, rate) || onset;
+
+        /* A frame the cheap detector hears nothing in, and which will be
+         * dropped as silence whatever the preprocessor makes of it, does
+         * not need the preprocessor; on an idle link that is most.  The
+         * detector still wakes every VAD_REFRESH_MS, so the denoiser and
+         * AGC go on adapting to the silence meanwhile. */
+        if (!awake && (iaxci_silence_threshold > 0.0f ||
+                       vol_to_db(pipe->input_level) < iaxci_silence_threshold))
+            silent = 1;
+        else
+            silent = !speex_preprocess(*active_st, (spx_int16_t*)audio, NULL);
 #ifdef VERBOSE
         //Confirmed to be working 
         AUDIO_LOG("input_post_process: Calling speex_preprocess got silent=(%d)", silent);
@@ -388,11 +412,9 @@ static int input_postprocess(void *audio, int len, int rate)
 	     (iaxci_filters & IAXC_FILTER_AAGC)
 	   )
 	{
-		static int i = 0;
-
-		i++;
+		pipe->aagc_frames++;
 
-		if ( (i & 0x3f) == 0 )
+		if ( (pipe->aagc_frames & 0x3f) == 0 )
 		{
 			float loudness;
 #ifdef SPEEX_PREPROCESS_GET_AGC_LOUDNESS
@@ -427,14 +449,11 @@ static int input_postprocess(void *audio, int len, int rate)
 	/* This is ugly. Basically just don't get volume level if speex thought
 	 * we were silent. Just set it to 0 in that case */
 	if ( iaxci_silence_threshold > 0.0f && silent )
-		input_level = 0.0f;
+		pipe->input_level = 0.0f;
 
 	do_level_callback();
 
-	volume = vol_to_db(input_level);
-
-	if ( volume < lowest_volume )
-		lowest_volume = volume;
+	volume = vol_to_db(pipe->input_level);
 
     if (iaxci_silence_threshold > 0.0f) {
 #ifdef VERBOSE
@@ -450,15 +469,74 @@ static int input_postprocess(void *audio, int len, int rate)
     }
 }
 
-static int output_postprocess(void *audio, int len)
+static int output_postprocess(struct iaxc_audio_pipeline *pipe, void *audio,
+		int len)
 {
-	calculate_level((short *)audio, len, &output_level);
+	calculate_level((short *)audio, len, &pipe->output_level);
 
 	do_level_callback();
 
 	return 0;
 }
 
+/* the pipeline at *pipep, created on first use and brought up to date
+ * with any filter or preset changes since it last ran */
+static struct iaxc_audio_pipeline *pipeline_get(struct iaxc_audio_pipeline **pipep)
+{
+	struct iaxc_audio_pipeline *pipe = *pipep;
+
+	if ( !pipe )
+	{
+		pipe = (struct iaxc_audio_pipeline *)calloc(1, sizeof(*pipe));
+		if ( !pipe )
+			return NULL;
+		pipe->gain = 1.0f;
+		pipe->filters_serial = filters_serial;
+		pipe->preset_serial = preset_serial;
+		pipe->next = pipelines;
+		pipelines = pipe;
+		*pipep = pipe;
+	}
+
+	if ( pipe->filters_serial != filters_serial )
+	{
+		pipe->filters_serial = filters_serial;
+		set_speex_filters_for_state(pipe->st_small);
+		set_speex_filters_for_state(pipe->st_large);
+	}
+
+	if ( pipe->preset_serial != preset_serial )
+	{
+		pipe->preset_serial = preset_serial;
+		// Reset gain tracking for level normalization
+		pipe->gain = 1.0f;
+		pipe->level_peak = 0.1f;  // Start with a reasonable level
+	}
+
+	return pipe;
+}
+
+void audio_pipeline_destroy(struct iaxc_audio_pipeline *pipe)
+{
+	struct iaxc_audio_pipeline **pp;
+
+	if ( !pipe )
+		return;
+	for ( pp = &pipelines; *pp; pp = &(*pp)->next )
+	{
+		if ( *pp == pipe )
+		{
+			*pp = pipe->next;
+			break;
+		}
+	}
+	if ( pipe->st_small )
+		speex_preprocess_state_destroy(pipe->st_small);
+	if ( pipe->st_large )
+		speex_preprocess_state_destroy(pipe->st_large);
+	free(pipe);
+}
+
 static struct iaxc_audio_codec *create_codec(int format)
 {
 	switch (format & IAXC_AUDIO_FORMAT_MASK)
@@ -581,12 +659,10 @@ EXPORT void iaxc_set_audio_preset(int preset_id)
             break;
     }
     
-    // Apply the new settings to the preprocessor states
+    // Apply the new settings to the preprocessor states, and reset gain
+    // tracking for level normalization, as each call next runs
     set_speex_filters();
-    
-    // Reset gain tracking for level normalization
-    current_gain = 1.0f;
-    current_level_peak = 0.1f;  // Start with a reasonable level
+    preset_serial++;
 }
 
 static int ptt_active=-1;
@@ -594,16 +670,15 @@ EXPORT void set_ptt(int val)
 {
     ptt_active = val;
 }
-int audio_send_encoded_audio(struct iaxc_call *call, int callNo, void *data,
-        int format, int sample_count)
+
+/* transmit processing of input, in place; returns whether it is silence */
+static int input_process(struct iaxc_audio_pipeline *pipe, void *data,
+        int sample_count)
 {
-    unsigned char outbuf[1024];
-    int outsize = 1024;
     int insize = sample_count;
-    static int was_silent_before = 0;
-    
+
     /* update last input timestamp */
-    timeLastInput = iax_tvnow();
+    pipe->last_input = iax_tvnow();
     
     // Only record audio to WAV file - don't process it for silence detection
     if (audio_capture_file) {
@@ -628,7 +703,7 @@ int audio_send_encoded_audio(struct iaxc_call *call, int callNo, void *data,
     short *audio_samples = (short *)data;
     
     // Apply normalization to adjust levels for optimal clarity
-    normalize_audio_buffer(audio_samples, insize);
+    int peak = normalize_audio_buffer(pipe, audio_samples, insize);
     
     // Enhanced silence detection logic with voice onset detection
     int silent = 0;
@@ -657,16 +732,29 @@ int audio_send_encoded_audio(struct iaxc_call *call, int callNo, void *data,
             prev_sample = audio_samples[i];
         }
         
-        // Standard silence detection with preprocessing
-        silent = input_postprocess(data, insize, 8000);
+        // Standard silence detection with preprocessing, which voice
+        // onset also wakes
+        const int onset = (max_sample > 2000) || (transient_count >= 3);
+        silent = input_postprocess(pipe, data, insize, 8000, peak, onset);
         
         // Override for definite voice onset detected
-        if (silent && ((max_sample > 2000) || (transient_count >= 3))) {
+        if (silent && onset) {
             //AUDIO_LOG("audio_send_encoded_audio:Voice onset detected, overriding VAD decision");
             silent = 0;  // Override silence detection on voice onset
         }
     }
 
+    return silent;
+}
+
+/* encodes and sends input already processed, or a silence marker */
+static int encode_and_send(struct iaxc_call *call, int callNo, void *data,
+        int format, int sample_count, int silent)
+{
+    unsigned char outbuf[1024];
+    int outsize = 1024;
+    int insize = sample_count;
+
     // Continue with regular IAX silence handling
     if(silent)
     {
@@ -751,6 +839,37 @@ int audio_send_encoded_audio(struct iaxc_call *call, int callNo, void *data,
     return 0;
 }
 
+int audio_send_encoded_audio(struct iaxc_call *call, int callNo, void *data,
+        int format, int sample_count)
+{
+    struct iaxc_audio_pipeline *pipe = pipeline_get(&call->pipeline);
+
+    if (!pipe)
+    {
+        fprintf(stderr, "ERROR: audio pipeline could not be created\n");
+        return 0;
+    }
+
+    return encode_and_send(call, callNo, data, format, sample_count,
+            input_process(pipe, data, sample_count));
+}
+
+int audio_process_local(struct iaxc_audio_pipeline **pipep, short *data,
+        int samples)
+{
+    struct iaxc_audio_pipeline *pipe = pipeline_get(pipep);
+
+    if (!pipe)
+        return -1;
+    return input_process(pipe, data, samples);
+}
+
+int audio_send_mixed_audio(struct iaxc_call *call, int callNo, short *data,
+        int format, int samples)
+{
+    return encode_and_send(call, callNo, data, format, samples, 0);
+}
+
 /* decode encoded audio; return the number of bytes decoded
  * negative indicates error */
 int audio_decode_audio(struct iaxc_call * call, void * out, void * data, int len,
@@ -758,8 +877,15 @@ int audio_decode_audio(struct iaxc_call * call, void * out, void * data, int len
 {
 	int insize = len;
 	int outsize = *samples;
+	struct iaxc_audio_pipeline *pipe = pipeline_get(&call->pipeline);
 
-	timeLastOutput = iax_tvnow();
+	if ( !pipe )
+	{
+		fprintf(stderr, "ERROR: audio pipeline could not be created\n");
+		return -1;
+	}
+
+	pipe->last_output = iax_tvnow();
 
 	if ( format == 0 )
 	{
@@ -795,7 +921,7 @@ int audio_decode_audio(struct iaxc_call * call, void * out, void * data, int len
 		return -1;
 	}
 
-	output_postprocess(out, *samples - outsize);
+	output_postprocess(pipe, out, *samples - outsize);
 
 	*samples = outsize;
 	return len - insize;
@@ -1107,56 +1233,32 @@ EXPORT void iaxc_ptt_filters_restore(void) {
     AUDIO_LOG("iaxc_ptt_filters_restore:PTT: Restored audio filters to previous settings");
 }
 
-// Apply soft-clipping to prevent harsh digital clipping
-static short soft_clip(float sample) {
-    // Soft clipper with smooth transition
-    if (sample > 32000.0f) {
-        // Soft knee compression above 32000
-        float excess = sample - 32000.0f;
-        sample = 32000.0f + (1.0f - expf(-0.1f * excess / 768.0f)) * 768.0f;
-    } else if (sample < -32000.0f) {
-        // Soft knee compression below -32000
-        float excess = -sample - 32000.0f;
-        sample = -32000.0f - (1.0f - expf(-0.1f * excess / 768.0f)) * 768.0f;
-    }
-    
-    // Hard limit at int16 boundaries to be safe
-    if (sample > 32767.0f) sample = 32767.0f;
-    if (sample < -32768.0f) sample = -32768.0f;
-    
-    return (short)sample;
-}
+// Apply normalization to a buffer of audio samples, returning its peak
+// afterwards.  Gain, soft clipping and both peaks are one pass over the
+// buffer, so the gain applied is the one the frames before settled on.
+static int normalize_audio_buffer(struct iaxc_audio_pipeline *pipe,
+		short *buffer, int samples) {
+    int in_peak, out_peak;
+
+    gain_limit(buffer, samples, pipe->gain, &in_peak, &out_peak);
+    float max_level = (float)in_peak / 32768.0f;
 
-// Apply normalization to a buffer of audio samples
-static void normalize_audio_buffer(short *buffer, int samples) {
-    float max_level = 0.0f;
-    
-    // Find peak level in this buffer
-    for (int i = 0; i < samples; i++) {
-        float abs_sample = fabsf((float)buffer[i] / 32768.0f);
-        if (abs_sample > max_level) max_level = abs_sample;
-    }
-    
     // Update smoothed level detector
-    current_level_peak = level_smoothing * current_level_peak + 
-                        (1.0f - level_smoothing) * max_level;
+    pipe->level_peak = level_smoothing * pipe->level_peak +
+                       (1.0f - level_smoothing) * max_level;
     
     // Calculate target gain if signal is present
-    if (current_level_peak > 0.01f) { // Only adjust gain when signal is present
-        float target_gain = target_level / current_level_peak;
+    if (pipe->level_peak > 0.01f) { // Only adjust gain when signal is present
+        float target_gain = target_level / pipe->level_peak;
         
         // Limit maximum gain to prevent noise amplification
         if (target_gain > 4.0f) target_gain = 4.0f;
         
         // Smooth gain changes to prevent artifacts
-        current_gain = gain_smoothing * current_gain + 
-                      (1.0f - gain_smoothing) * target_gain;
+        pipe->gain = gain_smoothing * pipe->gain +
+                     (1.0f - gain_smoothing) * target_gain;
     }
     
-    // Apply gain and soft clipping to each sample
-    for (int i = 0; i < samples; i++) {
-        float processed = (float)buffer[i] * current_gain;
-        buffer[i] = soft_clip(processed);
-    }
+    return out_peak;
 }
 
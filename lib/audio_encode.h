@@ -17,6 +17,7 @@
 
 struct iaxc_call;
 struct iax_event;
+struct iaxc_audio_pipeline;
 
 int audio_send_encoded_audio(struct iaxc_call * most_recent_answer, int callNo,
         void * data, int iEncodeType, int samples);
@@ -24,6 +25,21 @@ int audio_send_encoded_audio(struct iaxc_call * most_recent_answer, int callNo,
 int audio_decode_audio(struct iaxc_call * p, void * out, void * data, int len,
         int iEncodeType, int * samples);
 
+/* For conference mode, where the local input is processed once before
+ * it is mixed rather than per call.  The first runs the transmit
+ * processing audio_send_encoded_audio() does, in place, through the
+ * pipeline at *pipe, creating it as needed; it returns 1 if the input is
+ * silence, 0 if not, -1 if there is no pipeline.  The second encodes and
+ * sends a call its mix as it is, with no processing at all. */
+int audio_process_local(struct iaxc_audio_pipeline **pipe, short *data,
+        int samples);
+int audio_send_mixed_audio(struct iaxc_call *call, int callNo, short *data,
+        int iEncodeType, int samples);
+
+/* Frees an audio pipeline, which the functions above create as needed;
+ * NULL is ignored. */
+void audio_pipeline_destroy(struct iaxc_audio_pipeline *pipe);
+
 /* Audio capture functions for debugging */
 EXPORT void iaxc_debug_audio_capture_start(void);
 EXPORT void iaxc_debug_audio_capture_stop(void);
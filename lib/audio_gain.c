@@ -0,0 +1,183 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Gain with a soft-knee limiter.
+ *
+ * Past the knee a sample's magnitude follows
+ *
+ *	knee + (1 - exp(-0.1 * excess / range)) * range
+ *
+ * with exp() done as a power of two, its integer part put straight into
+ * the exponent bits and its fraction from a cubic, well inside a sample
+ * of expf() and cheap enough for SSE2 eight samples at a time.  Blocks
+ * with nothing past the knee skip even that.  The peaks are kept as the
+ * samples go by, so nothing else needs to look at them again.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GAIN_SSE2
+#endif
+
+#include "audio_gain.h"
+
+#ifdef GAIN_SSE2
+#define EXP2_POLY_SSE2(f) \
+	_mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps((f), \
+		_mm_add_ps(_mm_set1_ps(0.69583356f), _mm_mul_ps((f), \
+			_mm_add_ps(_mm_set1_ps(0.22606716f), \
+				_mm_mul_ps((f), _mm_set1_ps(0.078024523f)))))))
+#endif
+
+/* exp(-0.1 * excess / range) is 2 to the excess times this */
+#define KNEE_RATE	(-0.1f / GAIN_KNEE_RANGE * 1.442695f)
+/* past this power of two the curve is flat */
+#define KNEE_MIN_POW	-100.0f
+
+/* 2 to the f, for f from 0 to 1 */
+#define EXP2_POLY(f) \
+	(1.0f + (f) * (0.69583356f + (f) * (0.22606716f + (f) * 0.078024523f)))
+
+/* a scaled sample limited, and truncated as a cast would */
+static short limit(float v)
+{
+	float mag = v < 0.0f ? -v : v;
+	float t, ti, f;
+
+	if ( mag > GAIN_KNEE )
+	{
+		t = (mag - GAIN_KNEE) * KNEE_RATE;
+		if ( t < KNEE_MIN_POW )
+			t = KNEE_MIN_POW;
+		ti = floorf(t);
+		f = t - ti;
+		mag = GAIN_KNEE + GAIN_KNEE_RANGE *
+			(1.0f - ldexpf(EXP2_POLY(f), (int)ti));
+		v = v < 0.0f ? -mag : mag;
+	}
+
+	if ( v > 32767.0f )
+		v = 32767.0f;
+	else if ( v < -32768.0f )
+		v = -32768.0f;
+	return (short)v;
+}
+
+#ifdef GAIN_SSE2
+/* limit(), on four samples */
+static __m128 limit4(__m128 v)
+{
+	const __m128 knee = _mm_set1_ps(GAIN_KNEE);
+	const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 mag, t, ti, f, floored, e;
+	__m128i n;
+
+	mag = _mm_andnot_ps(sign, v);
+	t = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(mag, knee), _mm_set1_ps(KNEE_RATE)),
+			_mm_set1_ps(KNEE_MIN_POW));
+
+	/* truncation rounds negatives up, floor them */
+	n = _mm_cvttps_epi32(t);
+	ti = _mm_cvtepi32_ps(n);
+	floored = _mm_cmpgt_ps(ti, t);
+	n = _mm_add_epi32(n, _mm_castps_si128(floored));
+	ti = _mm_sub_ps(ti, _mm_and_ps(floored, _mm_set1_ps(1.0f)));
+	f = _mm_sub_ps(t, ti);
+
+	e = _mm_mul_ps(EXP2_POLY_SSE2(f), _mm_castsi128_ps(
+			_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+	e = _mm_add_ps(knee, _mm_mul_ps(_mm_set1_ps(GAIN_KNEE_RANGE),
+				_mm_sub_ps(_mm_set1_ps(1.0f), e)));
+
+	/* only what is past the knee */
+	t = _mm_cmpgt_ps(mag, knee);
+	mag = _mm_or_ps(_mm_and_ps(t, e), _mm_andnot_ps(t, mag));
+	return _mm_or_ps(mag, _mm_and_ps(sign, v));
+}
+#endif
+
+void gain_limit(short *buf, int n, float gain, int *in_peak, int *out_peak)
+{
+	int in_max = 0, in_min = 0, out_max = 0, out_min = 0;
+	int i = 0;
+	short y;
+
+#ifdef GAIN_SSE2
+	{
+		const __m128 g = _mm_set1_ps(gain);
+		const __m128 knee = _mm_set1_ps(GAIN_KNEE);
+		const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128i imax = _mm_setzero_si128(), imin = _mm_setzero_si128();
+		__m128i omax = _mm_setzero_si128(), omin = _mm_setzero_si128();
+		__m128i x, out;
+		__m128 lo, hi;
+		short lanes[4][8];
+		int j;
+
+		for ( ; i + 8 <= n; i += 8 )
+		{
+			x = _mm_loadu_si128((const __m128i *)(buf + i));
+			imax = _mm_max_epi16(imax, x);
+			imin = _mm_min_epi16(imin, x);
+
+			/* sign extend by unpacking each sample above itself */
+			lo = _mm_mul_ps(_mm_cvtepi32_ps(
+					_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), g);
+			hi = _mm_mul_ps(_mm_cvtepi32_ps(
+					_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), g);
+
+			if ( _mm_movemask_ps(_mm_or_ps(
+				_mm_cmpgt_ps(_mm_and_ps(lo, magnitude), knee),
+				_mm_cmpgt_ps(_mm_and_ps(hi, magnitude), knee))) )
+			{
+				lo = limit4(lo);
+				hi = limit4(hi);
+			}
+
+			/* packing saturates as limit() clamps */
+			out = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+			omax = _mm_max_epi16(omax, out);
+			omin = _mm_min_epi16(omin, out);
+			_mm_storeu_si128((__m128i *)(buf + i), out);
+		}
+
+		_mm_storeu_si128((__m128i *)lanes[0], imax);
+		_mm_storeu_si128((__m128i *)lanes[1], imin);
+		_mm_storeu_si128((__m128i *)lanes[2], omax);
+		_mm_storeu_si128((__m128i *)lanes[3], omin);
+		for ( j = 0; j < 8; j++ )
+		{
+			if ( lanes[0][j] > in_max )
+				in_max = lanes[0][j];
+			if ( lanes[1][j] < in_min )
+				in_min = lanes[1][j];
+			if ( lanes[2][j] > out_max )
+				out_max = lanes[2][j];
+			if ( lanes[3][j] < out_min )
+				out_min = lanes[3][j];
+		}
+	}
+#endif
+
+	for ( ; i < n; i++ )
+	{
+		if ( buf[i] > in_max )
+			in_max = buf[i];
+		if ( buf[i] < in_min )
+			in_min = buf[i];
+		y = limit(buf[i] * gain);
+		if ( y > out_max )
+			out_max = y;
+		if ( y < out_min )
+			out_min = y;
+		buf[i] = y;
+	}
+
+	*in_peak = in_max > -in_min ? in_max : -in_min;
+	*out_peak = out_max > -out_min ? out_max : -out_min;
+}
@@ -0,0 +1,22 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Gain with a soft-knee limiter: samples scaled past the knee are eased
+ * towards full scale rather than clipped.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _AUDIO_GAIN_H
+#define _AUDIO_GAIN_H
+
+/* magnitude where limiting starts, and how far past it full scale is */
+#define GAIN_KNEE	32000.0f
+#define GAIN_KNEE_RANGE	768.0f
+
+/* Scales n samples in place by gain, limiting them, in one pass.  The
+ * largest magnitudes before and after go to in_peak and out_peak. */
+void gain_limit(short *buf, int n, float gain, int *in_peak, int *out_peak);
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Conference mixing.
+ *
+ * A run sums local input and each playing slot into 32 bit totals, and
+ * a participant's mix is its total less its own samples, saturated back
+ * to 16 bits.  Summing in 16 bits with saturating adds would be cheaper
+ * still, but a clipped sum can't have a participant taken back out of
+ * it; with the wider total only the final pack saturates.  Both loops
+ * use SSE2, and AVX2 where the CPU has it.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIXER_SSE2
+#endif
+/* AVX2 loops are built whatever the compiler targets and only used
+ * where the CPU has AVX2, as in codec_g711.c */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define MIXER_AVX2
+#define MIXER_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && _MSC_VER >= 1700 && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define MIXER_AVX2
+#define MIXER_AVX2_TARGET
+#endif
+
+#include "audio_mixer.h"
+
+/* a paused slot plays again once it has this much more than a run */
+#define MIXER_PREFILL	160
+
+struct mixer_slot
+{
+	short *queue;		/* ring of MIXER_QUEUE samples */
+	int head;		/* oldest sample */
+	int len;
+	int playing;
+
+	short *cur;		/* what it gave the last run */
+	int cur_size;
+	int mixed;		/* whether it gave anything */
+};
+
+struct mixer_state
+{
+	struct mixer_slot *slot;
+	int slots;
+
+	int n;			/* samples in the last run */
+	int size;		/* room in the buffers below */
+	int *total;
+	short *local;		/* the last run's local input */
+	int have_local;
+	short *silence;
+	short *out;
+};
+
+#ifdef MIXER_AVX2
+static int mixer_avx2 = -1;
+
+static int mixer_have_avx2(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	/* the CPU has AVX and OSXSAVE, and the OS saves the ymm registers */
+	__cpuid(info, 1);
+	if ( (info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6 )
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & 0x20) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+struct mixer_state *mixer_create(int slots)
+{
+	struct mixer_state *mix;
+
+#ifdef MIXER_AVX2
+	/* racing callers all store the same */
+	if ( mixer_avx2 < 0 )
+		mixer_avx2 = mixer_have_avx2();
+#endif
+
+	mix = (struct mixer_state *)calloc(1, sizeof(*mix));
+	if ( !mix )
+		return NULL;
+
+	mix->slot = (struct mixer_slot *)calloc(slots, sizeof(*mix->slot));
+	if ( !mix->slot )
+	{
+		free(mix);
+		return NULL;
+	}
+	mix->slots = slots;
+	return mix;
+}
+
+void mixer_destroy(struct mixer_state *mix)
+{
+	int i;
+
+	if ( !mix )
+		return;
+	for ( i = 0; i < mix->slots; i++ )
+	{
+		free(mix->slot[i].queue);
+		free(mix->slot[i].cur);
+	}
+	free(mix->slot);
+	free(mix->total);
+	free(mix->local);
+	free(mix->silence);
+	free(mix->out);
+	free(mix);
+}
+
+int mixer_put(struct mixer_state *mix, int slot, const short *in, int n)
+{
+	struct mixer_slot *s;
+	int tail, m;
+
+	if ( slot < 0 || slot >= mix->slots || n <= 0 )
+		return 0;
+	s = &mix->slot[slot];
+
+	if ( !s->queue &&
+	     !(s->queue = (short *)malloc(MIXER_QUEUE * sizeof(short))) )
+		return -1;
+
+	if ( n > MIXER_QUEUE )
+	{
+		in += n - MIXER_QUEUE;
+		n = MIXER_QUEUE;
+	}
+
+	/* too far behind: drop the oldest */
+	if ( s->len + n > MIXER_QUEUE )
+	{
+		m = s->len + n - MIXER_QUEUE;
+		s->head = (s->head + m) % MIXER_QUEUE;
+		s->len -= m;
+	}
+
+	tail = (s->head + s->len) % MIXER_QUEUE;
+	m = MIXER_QUEUE - tail < n ? MIXER_QUEUE - tail : n;
+	memcpy(s->queue + tail, in, m * sizeof(short));
+	memcpy(s->queue, in + m, (n - m) * sizeof(short));
+	s->len += n;
+	return 0;
+}
+
+void mixer_clear(struct mixer_state *mix, int slot)
+{
+	if ( slot < 0 || slot >= mix->slots )
+		return;
+	mix->slot[slot].head = 0;
+	mix->slot[slot].len = 0;
+	mix->slot[slot].playing = 0;
+	mix->slot[slot].mixed = 0;
+}
+
+#ifdef MIXER_AVX2
+/* mix_add() on whole blocks of 16, returning how many it did */
+static MIXER_AVX2_TARGET int mix_add_avx2(int *total, const short *in, int n)
+{
+	int i;
+
+	for ( i = 0; i + 16 <= n; i += 16 )
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i *t = (__m256i *)(total + i);
+
+		_mm256_storeu_si256(t, _mm256_add_epi32(_mm256_loadu_si256(t),
+			_mm256_cvtepi16_epi32(_mm256_castsi256_si128(s))));
+		_mm256_storeu_si256(t + 1, _mm256_add_epi32(_mm256_loadu_si256(t + 1),
+			_mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1))));
+	}
+	return i;
+}
+
+/* mix_sub() on whole blocks of 16, returning how many it did */
+static MIXER_AVX2_TARGET int mix_sub_avx2(short *out, const int *total,
+		const short *self, int n)
+{
+	int i;
+
+	for ( i = 0; i + 16 <= n; i += 16 )
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)(self + i));
+		const __m256i *t = (const __m256i *)(total + i);
+		__m256i lo, hi;
+
+		lo = _mm256_sub_epi32(_mm256_loadu_si256(t),
+			_mm256_cvtepi16_epi32(_mm256_castsi256_si128(s)));
+		hi = _mm256_sub_epi32(_mm256_loadu_si256(t + 1),
+			_mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1)));
+		/* packs works within 128 bit lanes; put them back in order */
+		_mm256_storeu_si256((__m256i *)(out + i),
+			_mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+	}
+	return i;
+}
+#endif
+
+/* total += in, widened */
+static void mix_add(int *total, const short *in, int n)
+{
+	int i = 0;
+
+#ifdef MIXER_AVX2
+	if ( mixer_avx2 > 0 )
+		i = mix_add_avx2(total, in, n);
+#endif
+#ifdef MIXER_SSE2
+	for ( ; i + 8 <= n; i += 8 )
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i *t = (__m128i *)(total + i);
+
+		/* sign extend by unpacking each sample above itself */
+		_mm_storeu_si128(t, _mm_add_epi32(_mm_loadu_si128(t),
+			_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16)));
+		_mm_storeu_si128(t + 1, _mm_add_epi32(_mm_loadu_si128(t + 1),
+			_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16)));
+	}
+#endif
+	for ( ; i < n; i++ )
+		total[i] += in[i];
+}
+
+/* out = total - self, saturated */
+static void mix_sub(short *out, const int *total, const short *self, int n)
+{
+	int i = 0, v;
+
+#ifdef MIXER_AVX2
+	if ( mixer_avx2 > 0 )
+		i = mix_sub_avx2(out, total, self, n);
+#endif
+#ifdef MIXER_SSE2
+	for ( ; i + 8 <= n; i += 8 )
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(self + i));
+		const __m128i *t = (const __m128i *)(total + i);
+		__m128i lo, hi;
+
+		lo = _mm_sub_epi32(_mm_loadu_si128(t),
+			_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+		hi = _mm_sub_epi32(_mm_loadu_si128(t + 1),
+			_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for ( ; i < n; i++ )
+	{
+		v = total[i] - self[i];
+		out[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : (short)v;
+	}
+}
+
+static int mix_grow(struct mixer_state *mix, int n)
+{
+	int *total;
+	short *local, *silence, *out;
+
+	if ( n <= mix->size )
+		return 0;
+
+	total = (int *)realloc(mix->total, n * sizeof(int));
+	if ( total )
+		mix->total = total;
+	local = (short *)realloc(mix->local, n * sizeof(short));
+	if ( local )
+		mix->local = local;
+	silence = (short *)calloc(n, sizeof(short));
+	if ( silence )
+	{
+		free(mix->silence);
+		mix->silence = silence;
+	}
+	out = (short *)realloc(mix->out, n * sizeof(short));
+	if ( out )
+		mix->out = out;
+
+	if ( !total || !local || !silence || !out )
+		return -1;
+	mix->size = n;
+	return 0;
+}
+
+/* takes up to n of the slot's queue into its cur, padded with silence */
+static int slot_take(struct mixer_slot *s, int n)
+{
+	short *cur;
+	int m, first;
+
+	if ( n > s->cur_size )
+	{
+		if ( !(cur = (short *)realloc(s->cur, n * sizeof(short))) )
+			return -1;
+		s->cur = cur;
+		s->cur_size = n;
+	}
+
+	m = s->len < n ? s->len : n;
+	first = MIXER_QUEUE - s->head < m ? MIXER_QUEUE - s->head : m;
+	memcpy(s->cur, s->queue + s->head, first * sizeof(short));
+	memcpy(s->cur + first, s->queue, (m - first) * sizeof(short));
+	memset(s->cur + m, 0, (n - m) * sizeof(short));
+	s->head = (s->head + m) % MIXER_QUEUE;
+	s->len -= m;
+	return 0;
+}
+
+int mixer_run(struct mixer_state *mix, const short *local, int n)
+{
+	struct mixer_slot *s;
+	int i;
+
+	mix->n = 0;
+	if ( n <= 0 )
+		return 0;
+	if ( mix_grow(mix, n) )
+		return -1;
+
+	memset(mix->total, 0, n * sizeof(int));
+	mix->have_local = local != NULL;
+	if ( local )
+	{
+		memcpy(mix->local, local, n * sizeof(short));
+		mix_add(mix->total, local, n);
+	}
+
+	for ( i = 0; i < mix->slots; i++ )
+	{
+		s = &mix->slot[i];
+		s->mixed = 0;
+
+		if ( !s->playing && s->len >= n + MIXER_PREFILL )
+			s->playing = 1;
+		if ( !s->playing )
+			continue;
+
+		if ( slot_take(s, n) )
+			return -1;
+		if ( !s->len )
+			s->playing = 0;
+		s->mixed = 1;
+		mix_add(mix->total, s->cur, n);
+	}
+
+	mix->n = n;
+	return 0;
+}
+
+short *mixer_out(struct mixer_state *mix, int slot)
+{
+	const short *self = mix->silence;
+
+	if ( slot < 0 )
+	{
+		if ( mix->have_local )
+			self = mix->local;
+	} else if ( slot < mix->slots && mix->slot[slot].mixed )
+	{
+		self = mix->slot[slot].cur;
+	}
+
+	mix_sub(mix->out, mix->total, self, mix->n);
+	return mix->out;
+}
@@ -0,0 +1,45 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Conference mixing: every participant hears everyone but itself.  Each
+ * run sums local input and what every participant has queued once, and
+ * each participant's mix is that total less its own audio, so a run
+ * costs in proportion to the participants rather than their square.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _AUDIO_MIXER_H
+#define _AUDIO_MIXER_H
+
+/* Participants are numbered from 0 to slots - 1; calls use their
+ * callNo.  Audio is 16 bit mono at whatever rate the caller uses
+ * throughout. */
+struct mixer_state;
+
+/* samples queued per slot at most, 200ms at 8kHz */
+#define MIXER_QUEUE	1600
+
+struct mixer_state *mixer_create(int slots);
+void mixer_destroy(struct mixer_state *mix);
+
+/* Queues n samples received from slot, for later runs to mix in.  A
+ * slot plays once a frame or so is queued and pauses when it runs dry;
+ * what would queue past MIXER_QUEUE is dropped, oldest first.  Returns
+ * -1 if out of memory. */
+int mixer_put(struct mixer_state *mix, int slot, const short *in, int n);
+
+/* Forgets what slot has queued, for a participant leaving */
+void mixer_clear(struct mixer_state *mix, int slot);
+
+/* Mixes n samples of local input, NULL for none, with n from each
+ * playing slot.  Returns -1 if out of memory. */
+int mixer_run(struct mixer_state *mix, const short *local, int n);
+
+/* The last run's mix without slot's own audio, or without the local
+ * input for slot -1, for playing out locally.  The n samples are the
+ * caller's to change until the next mixer_out() or mixer_run(). */
+short *mixer_out(struct mixer_state *mix, int slot);
+
+#endif
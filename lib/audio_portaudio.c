@@ -216,6 +216,12 @@ static PaUtilRingBuffer inRing, outRing;
 
 static int outRingLenAvg;
 
+/* pull playout (pa_output_pull): outRing is kept at one callback period,
+ * output_period samples at sample_rate, topped up by the processing thread after
+ * each callback */
+static int pull_playout;
+static volatile int output_period;
+
 static int oneStream;
 static int auxStream;
 static int virtualMonoIn;
@@ -650,7 +656,7 @@ static int pa_callback(
                     consecutive_underruns, (long long)total_frames_processed);
 
             // If we're having serious underruns, add some buffer to help stabilize
-            if (consecutive_underruns >= 50 && outputBuffer) {
+            if (consecutive_underruns >= 50 && outputBuffer && !pull_playout) {
                 // Try to compensate by adding silence to output buffer as a fallback
                 static SAMPLE silence[2048] = {0};
                 PaUtil_WriteRingBuffer(&outRing, silence, sizeof(silence)/sizeof(SAMPLE));
@@ -835,6 +841,11 @@ static int pa_callback(
             }
         }    }
 
+    // Wake the processing thread to encode what was just captured, and
+    // with pull playout to refill what was just played
+    output_period = (int)(hostFrames / sample_ratio);
+    iaxci_audio_ready();
+
     debug_counter++;
 
     // Perform periodic health checks during callback
@@ -1868,7 +1879,7 @@ static int pa_check_stream_health(struct iaxc_audio_driver *d)
                 (float)PaUtil_GetRingBufferFullCount(&inRing) / INRBSZ * 100);
         return 0; // Fixed with purge
     }
-      if (outRingBufferFill < 80 && output_underruns > 5) {  // Optimized for low latency
+      if (outRingBufferFill < 80 && output_underruns > 5 && !pull_playout) {  // Optimized for low latency
         PORT_LOG("pa_check_stream_health: Output ring buffer critically low (%d samples, %d underruns)",
                 outRingBufferFill, output_underruns);
 
@@ -2111,6 +2122,23 @@ static int pa_output(struct iaxc_audio_driver *d, void *samples, int nSamples)
     return written;
 }
 
+static int pa_output_backlog(struct iaxc_audio_driver *d, int *target)
+{
+	if (pull_playout && output_period > 0)
+		*target = output_period;
+	else
+		*target = RBOUTTARGET * (sample_rate / 1000);
+	return PaUtil_GetRingBufferReadAvailable(&outRing);
+}
+
+/* Underruns are expected now, when the jitterbuffer has nothing due, so
+ * they are no longer padded out with silence */
+static int pa_output_pull(struct iaxc_audio_driver *d, int enable)
+{
+	pull_playout = enable;
+	return 0;
+}
+
 // Low-latency adaptive buffer stabilizer function
 static void pa_boost_buffer(void)
 {
@@ -2336,6 +2364,8 @@ static int _pa_initialize (struct iaxc_audio_driver *d, int sr)
 	PaError  err;
 
 	sample_rate = sr;
+	/* pa_callback() signals iaxci_audio_ready() */
+	iaxci_audio_ready_notify = 1;
 #ifdef VERBOSE
     PORT_LOG("_pa_initialize:Initializing PortAudio with sample rate %d", sr);
 #endif
@@ -2388,6 +2418,8 @@ static int _pa_initialize (struct iaxc_audio_driver *d, int sr)
 	d->stop_sound = pa_stop_sound;
 	d->mic_boost_get = pa_mic_boost_get;
 	d->mic_boost_set = pa_mic_boost_set;
+	d->output_backlog = pa_output_backlog;
+	d->output_pull = pa_output_pull;
 	/* setup private data stuff */
 	selectedInput  = Pa_GetDefaultInputDevice();
 	selectedOutput = Pa_GetDefaultOutputDevice();
@@ -0,0 +1,194 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Time-scale modification of received speech by WSOLA.
+ *
+ * Output is built from segments of input, one step at a time.  Each step
+ * cross-fades the natural continuation of the previous segment (the tail)
+ * into a segment of input taken near where the requested speed says the
+ * next should start; the exact start is searched for so the two are most
+ * alike, which keeps pitch periods intact.  At normal speed the best
+ * match is the tail itself and the output equals the input.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_tsm.h"
+
+/* segment, and cross-fade, length; and how far either side of its
+ * nominal position a segment may start, a pitch period or more */
+#define TSM_SEGMENT_MS	10
+#define TSM_SEARCH_MS	5
+/* input held, at most */
+#define TSM_BUFFER_MS	500
+
+struct tsm_state
+{
+	int seglen;
+	int search;
+
+	short *buf;		/* input not yet used up */
+	int len;
+	int size;
+
+	short *tail;		/* continuation of the last segment */
+	int have_tail;
+
+	long pos;		/* nominal start of the next segment in buf, 1/1000 samples */
+	long stretched;		/* 1/1000 samples */
+};
+
+struct tsm_state *tsm_create(int sample_rate)
+{
+	struct tsm_state *tsm;
+
+	tsm = (struct tsm_state *)calloc(1, sizeof(*tsm));
+	if ( !tsm )
+		return NULL;
+
+	tsm->seglen = sample_rate * TSM_SEGMENT_MS / 1000;
+	tsm->search = sample_rate * TSM_SEARCH_MS / 1000;
+	tsm->size = sample_rate * TSM_BUFFER_MS / 1000;
+	tsm->buf = (short *)malloc(tsm->size * sizeof(short));
+	tsm->tail = (short *)malloc(tsm->seglen * sizeof(short));
+	if ( !tsm->buf || !tsm->tail || tsm->seglen < 1 )
+	{
+		tsm_destroy(tsm);
+		return NULL;
+	}
+	return tsm;
+}
+
+void tsm_destroy(struct tsm_state *tsm)
+{
+	if ( !tsm )
+		return;
+	free(tsm->buf);
+	free(tsm->tail);
+	free(tsm);
+}
+
+/* start of the segment most like the tail, within the search window
+ * around pos; nearer starts win ties, so at normal speed it's pos */
+static int tsm_search(struct tsm_state *tsm, int pos)
+{
+	const short *tail = tsm->tail;
+	double best_score = 0, score, corr, energy;
+	int best = pos, k, i, d;
+
+	for ( d = 0; d <= 2 * tsm->search; d++ )
+	{
+		/* 0, -1, +1, -2, +2 ... */
+		k = pos + (d & 1 ? -(d + 1) / 2 : d / 2);
+		if ( k < 0 )
+			continue;
+
+		corr = 0;
+		energy = 1;
+		for ( i = 0; i < tsm->seglen; i++ )
+		{
+			corr += (double)tail[i] * tsm->buf[k + i];
+			energy += (double)tsm->buf[k + i] * tsm->buf[k + i];
+		}
+		if ( corr <= 0 )
+			continue;
+
+		/* normalized correlation, squared */
+		score = corr * corr / energy;
+		if ( score > best_score )
+		{
+			best_score = score;
+			best = k;
+		}
+	}
+	return best;
+}
+
+/* one step: seglen samples out, if the input and room are there */
+static int tsm_step(struct tsm_state *tsm, short *out, int speed)
+{
+	int seglen = tsm->seglen;
+	int pos = (int)(tsm->pos / 1000);
+	int k, i;
+
+	if ( pos + tsm->search + 2 * seglen > tsm->len )
+		return 0;
+
+	k = tsm_search(tsm, pos);
+	for ( i = 0; i < seglen; i++ )
+		out[i] = (short)((tsm->tail[i] * (seglen - i) +
+				tsm->buf[k + i] * i) / seglen);
+	memcpy(tsm->tail, tsm->buf + k + seglen, seglen * sizeof(short));
+
+	tsm->pos += (long)seglen * speed;
+	tsm->stretched += (long)seglen * (speed - TSM_SPEED_NORMAL);
+	return seglen;
+}
+
+/* drop input no later segment can start in */
+static void tsm_compact(struct tsm_state *tsm)
+{
+	int drop = (int)(tsm->pos / 1000) - tsm->search;
+
+	if ( drop <= 0 )
+		return;
+	if ( drop > tsm->len )
+		drop = tsm->len;
+	memmove(tsm->buf, tsm->buf + drop, (tsm->len - drop) * sizeof(short));
+	tsm->len -= drop;
+	tsm->pos -= (long)drop * 1000;
+}
+
+int tsm_process(struct tsm_state *tsm, const short *in, int nin,
+		short *out, int maxout, int speed)
+{
+	int nout = 0, n, stepped;
+
+	if ( speed < TSM_SPEED_MIN )
+		speed = TSM_SPEED_MIN;
+	else if ( speed > TSM_SPEED_MAX )
+		speed = TSM_SPEED_MAX;
+
+	for ( ;; )
+	{
+		n = tsm->size - tsm->len;
+		if ( n > nin )
+			n = nin;
+		memcpy(tsm->buf + tsm->len, in, n * sizeof(short));
+		tsm->len += n;
+		in += n;
+		nin -= n;
+
+		if ( !tsm->have_tail )
+		{
+			if ( tsm->len < tsm->seglen )
+				break;
+			/* the first segment fades in from itself */
+			memcpy(tsm->tail, tsm->buf, tsm->seglen * sizeof(short));
+			tsm->have_tail = 1;
+			tsm->pos = 0;
+		}
+
+		stepped = 0;
+		while ( maxout - nout >= tsm->seglen &&
+				(n = tsm_step(tsm, out + nout, speed)) )
+		{
+			nout += n;
+			stepped = 1;
+		}
+		tsm_compact(tsm);
+
+		if ( !nin || !stepped )
+			break;
+	}
+	return nout;
+}
+
+long tsm_stretched(struct tsm_state *tsm)
+{
+	return tsm->stretched / 1000;
+}
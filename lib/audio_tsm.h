@@ -0,0 +1,38 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Time-scale modification of received speech by WSOLA (waveform
+ * similarity overlap-add): plays audio a few percent faster or slower
+ * without changing its pitch, so buffers can drift towards their target
+ * without dropped or inserted frames.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _AUDIO_TSM_H
+#define _AUDIO_TSM_H
+
+/* Speeds are per mille of real time: 1050 plays 5% faster, giving
+ * fewer samples out than in, 950 plays 5% slower. */
+#define TSM_SPEED_NORMAL	1000
+#define TSM_SPEED_MIN		500
+#define TSM_SPEED_MAX		2000
+
+struct tsm_state;
+
+struct tsm_state *tsm_create(int sample_rate);
+void tsm_destroy(struct tsm_state *tsm);
+
+/* Time-scales nin samples to out, returning how many were written.
+ * Input is held back until a whole segment and the search window past
+ * it have arrived, about 20 ms, and is played out by later calls.  out
+ * should have room for twice nin plus that; what doesn't fit is kept. */
+int tsm_process(struct tsm_state *tsm, const short *in, int nin,
+		short *out, int maxout, int speed);
+
+/* Net samples removed (positive) or added (negative) by time-scaling
+ * since tsm_create(), not counting those held back */
+long tsm_stretched(struct tsm_state *tsm);
+
+#endif
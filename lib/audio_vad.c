@@ -0,0 +1,97 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * Energy and zero-crossing voice activity detection.
+ *
+ * A frame sounds like speech when its energy is well above the noise
+ * floor, or somewhat above it with few zero crossings, as voiced speech
+ * has and hiss does not.  It errs towards waking: all it saves is the
+ * preprocessor's time, which still makes the real decision on every
+ * frame it is woken for.  Through long silences it wakes now and then
+ * anyway, so the preprocessor's noise and gain estimates do not go
+ * stale while it is not being called.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include "audio_vad.h"
+
+/* energy over the floor that is probably speech, 6dB */
+#define VAD_SPEECH_RATIO	4.0f
+/* or 3dB over it, with crossings this rare per sample */
+#define VAD_VOICED_RATIO	2.0f
+#define VAD_VOICED_ZCR		0.2f
+
+/* the floor follows quiet frames down quickly and up slowly, and creeps
+ * up during speech so a step in the noise cannot keep it awake forever */
+#define VAD_FALL		0.5f
+#define VAD_RISE		0.05f
+#define VAD_CREEP		0.002f
+/* a little above digital silence, an rms of 4 */
+#define VAD_MIN_FLOOR		16.0f
+
+static void track_floor(struct vad_state *vad, float energy, float rate)
+{
+	vad->floor += (energy - vad->floor) * rate;
+	if ( vad->floor < VAD_MIN_FLOOR )
+		vad->floor = VAD_MIN_FLOOR;
+}
+
+/* ms at rate, in samples */
+#define VAD_SAMPLES(ms, rate)	((ms) * (rate) / 1000)
+
+int vad_awake(struct vad_state *vad, const short *buf, int n, int rate)
+{
+	long long sum;
+	int crossings = 0;
+	float energy, zcr;
+	int i;
+
+	if ( n <= 1 )
+		return 1;
+
+	sum = (long long)buf[0] * buf[0];
+	for ( i = 1; i < n; i++ )
+	{
+		sum += (long long)buf[i] * buf[i];
+		crossings += (buf[i] ^ buf[i - 1]) < 0;
+	}
+	energy = (float)sum / n;
+	zcr = (float)crossings / (n - 1);
+
+	if ( vad->trained < VAD_SAMPLES(VAD_TRAIN_MS, rate) )
+	{
+		track_floor(vad, energy, vad->trained ?
+				(energy < vad->floor ? VAD_FALL : VAD_RISE) : 1.0f);
+		vad->trained += n;
+		return 1;
+	}
+
+	if ( energy > vad->floor * VAD_SPEECH_RATIO ||
+	     (energy > vad->floor * VAD_VOICED_RATIO && zcr < VAD_VOICED_ZCR) )
+	{
+		track_floor(vad, energy, VAD_CREEP);
+		vad->hangover = VAD_SAMPLES(VAD_HANGOVER_MS, rate);
+		vad->asleep = 0;
+		return 1;
+	}
+
+	/* the tail of speech is no guide to the floor */
+	if ( vad->hangover > 0 )
+	{
+		vad->hangover -= n;
+		vad->asleep = 0;
+		return 1;
+	}
+
+	track_floor(vad, energy, energy < vad->floor ? VAD_FALL : VAD_RISE);
+
+	vad->asleep += n;
+	if ( vad->asleep >= VAD_SAMPLES(VAD_REFRESH_MS, rate) )
+	{
+		vad->asleep = 0;
+		return 1;
+	}
+	return 0;
+}
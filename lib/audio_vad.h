@@ -0,0 +1,39 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * A cheap voice activity detector, from frame energy against a tracked
+ * noise floor and the zero-crossing rate, that decides whether a frame
+ * is worth the speex preprocessor at all.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _AUDIO_VAD_H
+#define _AUDIO_VAD_H
+
+/* ms always awake while the floor is learnt */
+#define VAD_TRAIN_MS		500
+/* ms kept awake after the last frame that sounded like speech */
+#define VAD_HANGOVER_MS		300
+/* most ms asleep before a frame wakes anyway, so the preprocessor's
+ * noise and gain estimates keep following the silence */
+#define VAD_REFRESH_MS		100
+
+/* all zeros is a valid, untrained detector; it counts in samples, so
+ * frames of any length and rate keep the same times */
+struct vad_state
+{
+	float floor;	/* noise energy per sample */
+	int trained;	/* samples seen, up to VAD_TRAIN_MS worth */
+	int hangover;	/* samples left awake */
+	int asleep;	/* samples since the last awake frame */
+};
+
+/* Whether a frame of n samples at rate may be speech, follows speech
+ * closely enough that the full preprocessor should still see it, or is
+ * due for it to keep its estimates current.  Call it for every frame, as
+ * it learns the noise floor from those that are not speech. */
+int vad_awake(struct vad_state *vad, const short *buf, int n, int rate);
+
+#endif
@@ -12,93 +12,17 @@
  */
 
 #include "codec_alaw.h"
+#include "codec_g711.h"
 #include "iaxclient_lib.h"
 
-#if defined(_MSC_VER)
-#define INLINE __inline
-#else
-#define INLINE inline
-#endif
-
 struct state {
     plc_state_t plc;
 };
 
-static INLINE short int alawdecode (unsigned char alaw)
-{
-	int value;
-	int segment;
-
-	/* Mask value */
-	alaw ^= 0x55;
-
-	/* Extract and scale value */
-	value = (alaw & 0x0f) << 4;
-
-	/* Extract segment number */
-	segment = (alaw & 0x70) >> 4;
-
-	/* Compute value */
-	switch (segment) {
-		case 0:
-			break;
-		case 1:
-			value += 0x100;
-			break;
-		default:
-			value += 0x100;
-			value <<= segment - 1;
-	}
-
-	/* Extract sign */
-	return (alaw & 0x80) ? value : -value;
-}
-
-static INLINE unsigned char alawencode (short int linear)
-{
-	int mask = 0x55;
-	int segment;
-	unsigned char alaw;
-
-	static int segments[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
-
-	if (linear >= 0)
-	{
-	  /* Sign (7th) bit = 1 */
-	  mask |= 0x80;
-	}
-	else
-	{
-	  /* Sign (7th) bit = 0 */
-	  linear = -linear;
-	}
-
-	/* Find the segment */
-	for (segment = 0;segment < 8;segment++)
-	 	if (linear <= segments[segment])
-			break;
-
-	/* Combine the sign, segment, and quantization bits. */
-
-	if (segment < 8)
-	{
-		if (segment < 2)
-			alaw = (linear >> 4) & 0x0F;
-		else
-			alaw = (linear >> (segment + 3)) & 0x0F;
-
-		return ((alaw | (segment << 4)) ^ mask);
-	}
-	else
-		/* out of range, return maximum value. */
-		return (0x7F ^ mask);
-}
-
 static int decode ( struct iaxc_audio_codec *c,
     int *inlen, unsigned char *in, int *outlen, short *out ) {
     struct state *state = (struct state *)(c->decstate);
-    short *orig_out = out;
-    short sample;
+    int n = *inlen < *outlen ? *inlen : *outlen;
 
 
     if(*inlen == 0) {
@@ -110,22 +34,22 @@ static int decode ( struct iaxc_audio_codec *c,
     }
 
 
-    while ((*inlen > 0) && (*outlen > 0)) {
-	sample = alawdecode((unsigned char)*(in++));
-	*(out++) = sample;
-	(*inlen)--; (*outlen)--;
+    if(n > 0) {
+	g711_alaw_decode(out, in, n);
+	*inlen -= n; *outlen -= n;
+	plc_rx(&state->plc, out, n);
     }
-    plc_rx(&state->plc, orig_out, (int)(out - orig_out));
 
     return 0;
 }
 
 static int encode ( struct iaxc_audio_codec *c,
     int *inlen, short *in, int *outlen, unsigned char *out ) {
+    int n = *inlen < *outlen ? *inlen : *outlen;
 
-    while ((*inlen > 0) && (*outlen > 0)) {
-	*(out++) = alawencode(*(in++));
-	(*inlen)--; (*outlen)--;
+    if(n > 0) {
+	g711_alaw_encode(out, in, n);
+	*inlen -= n; *outlen -= n;
     }
 
     return 0;
@@ -141,6 +65,8 @@ struct iaxc_audio_codec *codec_audio_alaw_new() {
 
   if(!c) return c;
 
+  g711_init();
+
   strcpy(c->name,"alaw");
   c->format = IAXC_FORMAT_ALAW;
   c->encode = encode;
@@ -0,0 +1,604 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * G.711 u-law and A-law conversion of whole frames.
+ *
+ * The plain C kernels are the tables and functions the u-law and A-law
+ * codecs have always used, and define the results.  The SIMD kernels
+ * compute the same without tables.  Both laws code a sample as a sign,
+ * a 3 bit segment and the 4 bits below the magnitude's leading one,
+ * which is how a float holds it: the bits of the magnitude converted to
+ * float, shifted down 19, are the biased exponent over those 4 bits,
+ * and less a constant are the code.  Decoding builds that float and
+ * converts it back.
+ *
+ * u-law after Craig Reese's public domain code, A-law by Cyril Velter.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License.
+ */
+
+#include "codec_g711.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define G711_SSE2
+#endif
+
+/* AVX2 kernels are built whatever the compiler targets and only used
+ * where the CPU has AVX2 */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define G711_AVX2
+#define G711_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && _MSC_VER >= 1700 && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define G711_AVX2
+#define G711_AVX2_TARGET
+#endif
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/* float exponent bias plus 7, over the 4 bits of mantissa: the code of
+ * a magnitude of 128 to 255 */
+#define G711_FLOAT_CODE	(134 << 4)
+
+static short ulaw_2lin [256];
+static unsigned char lin_2ulaw [16384];
+static int initialized=0;
+
+/* this looks similar to asterisk, but comes from public domain code by craig reese
+   I've just followed asterisk's table sizes for lin_2u, and also too lazy to do binary arith to decide which
+   iterations to skip -- this way we get the same result.. */
+static void ulaw_initialize() {
+    int i;
+
+    /* ulaw_2lin */
+    for(i=0;i<256;i++) {
+	  int b = ~i;
+	  int exp_lut[8] = {0,132,396,924,1980,4092,8316,16764};
+	  int sign, exponent, mantissa, sample;
+
+	  sign = (b & 0x80);
+	  exponent = (b >> 4) & 0x07;
+	  mantissa = b & 0x0F;
+	  sample = exp_lut[exponent] + (mantissa << (exponent + 3));
+	  if (sign != 0) sample = -sample;
+	  ulaw_2lin[i] = sample;
+    }
+
+    /* lin_2ulaw */
+    for(i=-32767;i<32768;i+=4) {
+	int sample = i;
+	int exp_lut[256] = {0,0,1,1,2,2,2,2,3,3,3,3,3,3,3,3,
+                             4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+                             5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,
+                             5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,
+                             6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
+                             6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
+                             6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
+                             6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+                             7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7};
+	int sign, exponent, mantissa;
+	unsigned char ulawbyte;
+
+	/* Get the sample into sign-magnitude. */
+	sign = (sample >> 8) & 0x80;		/* set aside the sign */
+	if (sign != 0) sample = -sample;		/* get magnitude */
+	if (sample > 32635) sample = 32635;		/* clip the magnitude */
+
+	/* Convert from 16 bit linear to ulaw. */
+	sample = sample + 0x84;
+	exponent = exp_lut[(sample >> 7) & 0xFF];
+	mantissa = (sample >> (exponent + 3)) & 0x0F;
+	ulawbyte = ~(sign | (exponent << 4) | mantissa);
+	if (ulawbyte == 0) ulawbyte = 0x02;	/* optional CCITT trap */
+
+	lin_2ulaw[((unsigned short)i) >> 2] = ulawbyte;
+    }
+}
+
+static INLINE short int alawdecode (unsigned char alaw)
+{
+	int value;
+	int segment;
+
+	/* Mask value */
+	alaw ^= 0x55;
+
+	/* Extract and scale value */
+	value = (alaw & 0x0f) << 4;
+
+	/* Extract segment number */
+	segment = (alaw & 0x70) >> 4;
+
+	/* Compute value */
+	switch (segment) {
+		case 0:
+			break;
+		case 1:
+			value += 0x100;
+			break;
+		default:
+			value += 0x100;
+			value <<= segment - 1;
+	}
+
+	/* Extract sign */
+	return (alaw & 0x80) ? value : -value;
+}
+
+static INLINE unsigned char alawencode (short int linear)
+{
+	int mask = 0x55;
+	int segment;
+	unsigned char alaw;
+
+	static int segments[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
+
+	if (linear >= 0)
+	{
+	  /* Sign (7th) bit = 1 */
+	  mask |= 0x80;
+	}
+	else
+	{
+	  /* Sign (7th) bit = 0 */
+	  linear = -linear;
+	}
+
+	/* Find the segment */
+	for (segment = 0;segment < 8;segment++)
+	 	if (linear <= segments[segment])
+			break;
+
+	/* Combine the sign, segment, and quantization bits. */
+
+	if (segment < 8)
+	{
+		if (segment < 2)
+			alaw = (linear >> 4) & 0x0F;
+		else
+			alaw = (linear >> (segment + 3)) & 0x0F;
+
+		return ((alaw | (segment << 4)) ^ mask);
+	}
+	else
+		/* out of range, return maximum value. */
+		return (0x7F ^ mask);
+}
+
+static void ulaw_encode_c(unsigned char *out, const short *in, int n)
+{
+	int i;
+
+	for ( i = 0; i < n; i++ )
+		out[i] = lin_2ulaw[((unsigned short)in[i]) >> 2];
+}
+
+static void ulaw_decode_c(short *out, const unsigned char *in, int n)
+{
+	int i;
+
+	for ( i = 0; i < n; i++ )
+		out[i] = ulaw_2lin[in[i]];
+}
+
+static void alaw_encode_c(unsigned char *out, const short *in, int n)
+{
+	int i;
+
+	for ( i = 0; i < n; i++ )
+		out[i] = alawencode(in[i]);
+}
+
+static void alaw_decode_c(short *out, const unsigned char *in, int n)
+{
+	int i;
+
+	for ( i = 0; i < n; i++ )
+		out[i] = alawdecode(in[i]);
+}
+
+static const struct g711_kernels kernels_c =
+{
+	"c",
+	ulaw_encode_c,
+	ulaw_decode_c,
+	alaw_encode_c,
+	alaw_decode_c,
+};
+
+#ifdef G711_SSE2
+/* 8 samples to u-law, in 16 bit lanes */
+static INLINE __m128i ulaw_encode8_sse2(__m128i x)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i neg, lo, hi, code;
+
+	/* the table's entry for this sample was made from this one */
+	x = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi16(~3)), _mm_set1_epi16(1));
+	neg = _mm_cmplt_epi16(x, zero);
+	x = _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+	x = _mm_add_epi16(_mm_min_epi16(x, _mm_set1_epi16(32635)),
+			_mm_set1_epi16(0x84));
+
+	lo = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero)));
+	hi = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpackhi_epi16(x, zero)));
+	code = _mm_sub_epi16(_mm_packs_epi32(_mm_srli_epi32(lo, 19),
+				_mm_srli_epi32(hi, 19)),
+			_mm_set1_epi16(G711_FLOAT_CODE));
+
+	code = _mm_or_si128(code, _mm_and_si128(neg, _mm_set1_epi16(0x80)));
+	code = _mm_xor_si128(code, _mm_set1_epi16(0xff));
+	/* CCITT trap */
+	return _mm_or_si128(code, _mm_and_si128(_mm_cmpeq_epi16(code, zero),
+				_mm_set1_epi16(0x02)));
+}
+
+/* 8 u-law codes, in 16 bit lanes, to samples */
+static INLINE __m128i ulaw_decode8_sse2(__m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i neg, lo, hi, x;
+
+	b = _mm_xor_si128(b, _mm_set1_epi16(0xff));
+	neg = _mm_cmpgt_epi16(b, _mm_set1_epi16(0x7f));
+	b = _mm_add_epi16(_mm_and_si128(b, _mm_set1_epi16(0x7f)),
+			_mm_set1_epi16(G711_FLOAT_CODE));
+
+	/* (mantissa * 8 + 132) << segment, less 132 */
+	lo = _mm_or_si128(_mm_slli_epi32(_mm_unpacklo_epi16(b, zero), 19),
+			_mm_set1_epi32(1 << 18));
+	hi = _mm_or_si128(_mm_slli_epi32(_mm_unpackhi_epi16(b, zero), 19),
+			_mm_set1_epi32(1 << 18));
+	x = _mm_packs_epi32(_mm_cvttps_epi32(_mm_castsi128_ps(lo)),
+			_mm_cvttps_epi32(_mm_castsi128_ps(hi)));
+	x = _mm_sub_epi16(x, _mm_set1_epi16(0x84));
+
+	return _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+}
+
+/* 8 samples to A-law, in 16 bit lanes */
+static INLINE __m128i alaw_encode8_sse2(__m128i x)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i neg, big, lo, hi, code;
+
+	neg = _mm_cmplt_epi16(x, zero);
+	x = _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+
+	/* segments above 0 from the float, segment 0 directly */
+	big = _mm_cmpgt_epi16(x, _mm_set1_epi16(0xff));
+	lo = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpacklo_epi16(x, zero)));
+	hi = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpackhi_epi16(x, zero)));
+	code = _mm_sub_epi16(_mm_packs_epi32(_mm_srli_epi32(lo, 19),
+				_mm_srli_epi32(hi, 19)),
+			_mm_set1_epi16(G711_FLOAT_CODE));
+	code = _mm_or_si128(_mm_and_si128(big, code),
+			_mm_andnot_si128(big, _mm_and_si128(_mm_srli_epi16(x, 4),
+					_mm_set1_epi16(0x0f))));
+
+	return _mm_xor_si128(code, _mm_or_si128(_mm_set1_epi16(0x55),
+				_mm_andnot_si128(neg, _mm_set1_epi16(0x80))));
+}
+
+/* 8 A-law codes, in 16 bit lanes, to samples */
+static INLINE __m128i alaw_decode8_sse2(__m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i neg, small, lo, hi, x;
+
+	b = _mm_xor_si128(b, _mm_set1_epi16(0x55));
+	neg = _mm_cmplt_epi16(b, _mm_set1_epi16(0x80));
+	b = _mm_and_si128(b, _mm_set1_epi16(0x7f));
+	small = _mm_cmplt_epi16(b, _mm_set1_epi16(0x10));
+
+	/* (mantissa * 16 + 256) << (segment - 1) */
+	x = _mm_add_epi16(b, _mm_set1_epi16(G711_FLOAT_CODE));
+	lo = _mm_slli_epi32(_mm_unpacklo_epi16(x, zero), 19);
+	hi = _mm_slli_epi32(_mm_unpackhi_epi16(x, zero), 19);
+	x = _mm_packs_epi32(_mm_cvttps_epi32(_mm_castsi128_ps(lo)),
+			_mm_cvttps_epi32(_mm_castsi128_ps(hi)));
+	x = _mm_or_si128(_mm_andnot_si128(small, x),
+			_mm_and_si128(small, _mm_slli_epi16(b, 4)));
+
+	return _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+}
+
+static void ulaw_encode_sse2(unsigned char *out, const short *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(
+			ulaw_encode8_sse2(_mm_loadu_si128((const __m128i *)(in + i))),
+			ulaw_encode8_sse2(_mm_loadu_si128((const __m128i *)(in + i + 8)))));
+	ulaw_encode_c(out + i, in + i, n - i);
+}
+
+static void ulaw_decode_sse2(short *out, const unsigned char *in, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i b;
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		b = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i),
+			ulaw_decode8_sse2(_mm_unpacklo_epi8(b, zero)));
+		_mm_storeu_si128((__m128i *)(out + i + 8),
+			ulaw_decode8_sse2(_mm_unpackhi_epi8(b, zero)));
+	}
+	ulaw_decode_c(out + i, in + i, n - i);
+}
+
+static void alaw_encode_sse2(unsigned char *out, const short *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(
+			alaw_encode8_sse2(_mm_loadu_si128((const __m128i *)(in + i))),
+			alaw_encode8_sse2(_mm_loadu_si128((const __m128i *)(in + i + 8)))));
+	alaw_encode_c(out + i, in + i, n - i);
+}
+
+static void alaw_decode_sse2(short *out, const unsigned char *in, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i b;
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+	{
+		b = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i),
+			alaw_decode8_sse2(_mm_unpacklo_epi8(b, zero)));
+		_mm_storeu_si128((__m128i *)(out + i + 8),
+			alaw_decode8_sse2(_mm_unpackhi_epi8(b, zero)));
+	}
+	alaw_decode_c(out + i, in + i, n - i);
+}
+
+static const struct g711_kernels kernels_sse2 =
+{
+	"sse2",
+	ulaw_encode_sse2,
+	ulaw_decode_sse2,
+	alaw_encode_sse2,
+	alaw_decode_sse2,
+};
+#endif
+
+#ifdef G711_AVX2
+/* As the SSE2 kernels, 16 lanes at a time.  Unpacking and packing both
+ * work within each 128 bit half, so they undo each other and only the
+ * final pack to bytes needs its halves put back in order. */
+
+static G711_AVX2_TARGET INLINE __m256i ulaw_encode16_avx2(__m256i x)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i neg, lo, hi, code;
+
+	x = _mm256_or_si256(_mm256_and_si256(x, _mm256_set1_epi16(~3)),
+			_mm256_set1_epi16(1));
+	neg = _mm256_cmpgt_epi16(zero, x);
+	x = _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+	x = _mm256_add_epi16(_mm256_min_epi16(x, _mm256_set1_epi16(32635)),
+			_mm256_set1_epi16(0x84));
+
+	lo = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(x, zero)));
+	hi = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(x, zero)));
+	code = _mm256_sub_epi16(_mm256_packs_epi32(_mm256_srli_epi32(lo, 19),
+				_mm256_srli_epi32(hi, 19)),
+			_mm256_set1_epi16(G711_FLOAT_CODE));
+
+	code = _mm256_or_si256(code, _mm256_and_si256(neg, _mm256_set1_epi16(0x80)));
+	code = _mm256_xor_si256(code, _mm256_set1_epi16(0xff));
+	return _mm256_or_si256(code, _mm256_and_si256(
+				_mm256_cmpeq_epi16(code, zero), _mm256_set1_epi16(0x02)));
+}
+
+static G711_AVX2_TARGET INLINE __m256i ulaw_decode16_avx2(__m256i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i neg, lo, hi, x;
+
+	b = _mm256_xor_si256(b, _mm256_set1_epi16(0xff));
+	neg = _mm256_cmpgt_epi16(b, _mm256_set1_epi16(0x7f));
+	b = _mm256_add_epi16(_mm256_and_si256(b, _mm256_set1_epi16(0x7f)),
+			_mm256_set1_epi16(G711_FLOAT_CODE));
+
+	lo = _mm256_or_si256(_mm256_slli_epi32(_mm256_unpacklo_epi16(b, zero), 19),
+			_mm256_set1_epi32(1 << 18));
+	hi = _mm256_or_si256(_mm256_slli_epi32(_mm256_unpackhi_epi16(b, zero), 19),
+			_mm256_set1_epi32(1 << 18));
+	x = _mm256_packs_epi32(_mm256_cvttps_epi32(_mm256_castsi256_ps(lo)),
+			_mm256_cvttps_epi32(_mm256_castsi256_ps(hi)));
+	x = _mm256_sub_epi16(x, _mm256_set1_epi16(0x84));
+
+	return _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+}
+
+static G711_AVX2_TARGET INLINE __m256i alaw_encode16_avx2(__m256i x)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i neg, big, lo, hi, code;
+
+	neg = _mm256_cmpgt_epi16(zero, x);
+	x = _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+
+	big = _mm256_cmpgt_epi16(x, _mm256_set1_epi16(0xff));
+	lo = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(x, zero)));
+	hi = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(x, zero)));
+	code = _mm256_sub_epi16(_mm256_packs_epi32(_mm256_srli_epi32(lo, 19),
+				_mm256_srli_epi32(hi, 19)),
+			_mm256_set1_epi16(G711_FLOAT_CODE));
+	code = _mm256_or_si256(_mm256_and_si256(big, code),
+			_mm256_andnot_si256(big, _mm256_and_si256(
+					_mm256_srli_epi16(x, 4), _mm256_set1_epi16(0x0f))));
+
+	return _mm256_xor_si256(code, _mm256_or_si256(_mm256_set1_epi16(0x55),
+				_mm256_andnot_si256(neg, _mm256_set1_epi16(0x80))));
+}
+
+static G711_AVX2_TARGET INLINE __m256i alaw_decode16_avx2(__m256i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i neg, small, lo, hi, x;
+
+	b = _mm256_xor_si256(b, _mm256_set1_epi16(0x55));
+	neg = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x80), b);
+	b = _mm256_and_si256(b, _mm256_set1_epi16(0x7f));
+	small = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x10), b);
+
+	x = _mm256_add_epi16(b, _mm256_set1_epi16(G711_FLOAT_CODE));
+	lo = _mm256_slli_epi32(_mm256_unpacklo_epi16(x, zero), 19);
+	hi = _mm256_slli_epi32(_mm256_unpackhi_epi16(x, zero), 19);
+	x = _mm256_packs_epi32(_mm256_cvttps_epi32(_mm256_castsi256_ps(lo)),
+			_mm256_cvttps_epi32(_mm256_castsi256_ps(hi)));
+	x = _mm256_or_si256(_mm256_andnot_si256(small, x),
+			_mm256_and_si256(small, _mm256_slli_epi16(b, 4)));
+
+	return _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+}
+
+static G711_AVX2_TARGET void ulaw_encode_avx2(unsigned char *out, const short *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 32 <= n; i += 32 )
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(
+				ulaw_encode16_avx2(_mm256_loadu_si256((const __m256i *)(in + i))),
+				ulaw_encode16_avx2(_mm256_loadu_si256((const __m256i *)(in + i + 16)))),
+			0xd8));
+	ulaw_encode_c(out + i, in + i, n - i);
+}
+
+static G711_AVX2_TARGET void ulaw_decode_avx2(short *out, const unsigned char *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+		_mm256_storeu_si256((__m256i *)(out + i), ulaw_decode16_avx2(
+			_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + i)))));
+	ulaw_decode_c(out + i, in + i, n - i);
+}
+
+static G711_AVX2_TARGET void alaw_encode_avx2(unsigned char *out, const short *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 32 <= n; i += 32 )
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(
+			_mm256_packus_epi16(
+				alaw_encode16_avx2(_mm256_loadu_si256((const __m256i *)(in + i))),
+				alaw_encode16_avx2(_mm256_loadu_si256((const __m256i *)(in + i + 16)))),
+			0xd8));
+	alaw_encode_c(out + i, in + i, n - i);
+}
+
+static G711_AVX2_TARGET void alaw_decode_avx2(short *out, const unsigned char *in, int n)
+{
+	int i = 0;
+
+	for ( ; i + 16 <= n; i += 16 )
+		_mm256_storeu_si256((__m256i *)(out + i), alaw_decode16_avx2(
+			_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + i)))));
+	alaw_decode_c(out + i, in + i, n - i);
+}
+
+static const struct g711_kernels kernels_avx2 =
+{
+	"avx2",
+	ulaw_encode_avx2,
+	ulaw_decode_avx2,
+	alaw_encode_avx2,
+	alaw_decode_avx2,
+};
+
+static int g711_have_avx2(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	/* the CPU has AVX and OSXSAVE, and the OS saves the ymm registers */
+	__cpuid(info, 1);
+	if ( (info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6 )
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & 0x20) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+/* what this CPU can run, slowest first */
+static const struct g711_kernels *kernels[4] = { &kernels_c };
+static int nkernels = 1;
+
+static const struct g711_kernels *g711 = &kernels_c;
+
+void g711_init(void)
+{
+	int n = 1;
+
+	if ( initialized )
+		return;
+
+	/* racing callers all store the same */
+	ulaw_initialize();
+#ifdef G711_SSE2
+	kernels[n++] = &kernels_sse2;
+#endif
+#ifdef G711_AVX2
+	if ( g711_have_avx2() )
+		kernels[n++] = &kernels_avx2;
+#endif
+	nkernels = n;
+	g711 = kernels[n - 1];
+	initialized = 1;
+}
+
+void g711_ulaw_encode(unsigned char *out, const short *in, int n)
+{
+	g711->ulaw_encode(out, in, n);
+}
+
+void g711_ulaw_decode(short *out, const unsigned char *in, int n)
+{
+	g711->ulaw_decode(out, in, n);
+}
+
+void g711_alaw_encode(unsigned char *out, const short *in, int n)
+{
+	g711->alaw_encode(out, in, n);
+}
+
+void g711_alaw_decode(short *out, const unsigned char *in, int n)
+{
+	g711->alaw_decode(out, in, n);
+}
+
+const struct g711_kernels *g711_kernels(int i)
+{
+	return i >= 0 && i < nkernels ? kernels[i] : NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * iaxclient: a cross-platform IAX softphone library
+ *
+ * G.711 u-law and A-law conversion of whole frames, with SIMD kernels
+ * picked for the CPU at run time.  Every kernel gives exactly what the
+ * plain C one does, and that is what codec_ulaw.c and codec_alaw.c have
+ * always given.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License.
+ */
+
+#ifndef _CODEC_G711_H
+#define _CODEC_G711_H
+
+struct g711_kernels
+{
+	const char *name;
+	void (*ulaw_encode)(unsigned char *out, const short *in, int n);
+	void (*ulaw_decode)(short *out, const unsigned char *in, int n);
+	void (*alaw_encode)(unsigned char *out, const short *in, int n);
+	void (*alaw_decode)(short *out, const unsigned char *in, int n);
+};
+
+/* Builds the tables and picks the kernels; call before converting */
+void g711_init(void);
+
+void g711_ulaw_encode(unsigned char *out, const short *in, int n);
+void g711_ulaw_decode(short *out, const unsigned char *in, int n);
+void g711_alaw_encode(unsigned char *out, const short *in, int n);
+void g711_alaw_decode(short *out, const unsigned char *in, int n);
+
+/* The i'th set of kernels this CPU can run, plain C first and the one
+ * g711_init() picks last, or NULL past the end; for benchmarks */
+const struct g711_kernels *g711_kernels(int i);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * g711bench: G.711 kernel benchmark
+ *
+ * Checks every kernel set this CPU can run gives what the plain C one
+ * does for every sample and every code, then times each kernel
+ * converting frames and reports samples per second.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codec_g711.h"
+
+static int frame = 160;
+static double seconds = 0.5;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: g711bench [options]\n"
+		"  -n samples   per call (160)\n"
+		"  -t seconds   per kernel (0.5)\n");
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* mismatches against c over every sample and every code */
+static long check(const struct g711_kernels *k, const struct g711_kernels *c)
+{
+	static short lin[65536], want_lin[256], got_lin[256];
+	static unsigned char code[256], want[65536], got[65536];
+	long bad = 0;
+	int i;
+
+	for ( i = 0; i < 65536; i++ )
+		lin[i] = (short)(i - 32768);
+	for ( i = 0; i < 256; i++ )
+		code[i] = (unsigned char)i;
+
+	c->ulaw_encode(want, lin, 65536);
+	k->ulaw_encode(got, lin, 65536);
+	for ( i = 0; i < 65536; i++ )
+		bad += want[i] != got[i];
+	c->alaw_encode(want, lin, 65536);
+	k->alaw_encode(got, lin, 65536);
+	for ( i = 0; i < 65536; i++ )
+		bad += want[i] != got[i];
+
+	c->ulaw_decode(want_lin, code, 256);
+	k->ulaw_decode(got_lin, code, 256);
+	for ( i = 0; i < 256; i++ )
+		bad += want_lin[i] != got_lin[i];
+	c->alaw_decode(want_lin, code, 256);
+	k->alaw_decode(got_lin, code, 256);
+	for ( i = 0; i < 256; i++ )
+		bad += want_lin[i] != got_lin[i];
+
+	return bad;
+}
+
+/* samples per second, converting frame at a time */
+static double run_encode(void (*f)(unsigned char *, const short *, int),
+		const short *lin, unsigned char *code)
+{
+	double start = now(), t;
+	long calls = 0;
+	int i;
+
+	do {
+		for ( i = 0; i < 1000; i++ )
+			f(code, lin, frame);
+		calls += 1000;
+	} while ( (t = now() - start) < seconds );
+	return calls * frame / t;
+}
+
+static double run_decode(void (*f)(short *, const unsigned char *, int),
+		const unsigned char *code, short *lin)
+{
+	double start = now(), t;
+	long calls = 0;
+	int i;
+
+	do {
+		for ( i = 0; i < 1000; i++ )
+			f(lin, code, frame);
+		calls += 1000;
+	} while ( (t = now() - start) < seconds );
+	return calls * frame / t;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct g711_kernels *k, *c;
+	short *lin, *out;
+	unsigned char *code;
+	long bad;
+	int i, opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n': frame = atoi(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || frame <= 0 || seconds <= 0)
+		usage();
+
+	lin = (short *)malloc(frame * sizeof(short));
+	out = (short *)malloc(frame * sizeof(short));
+	code = (unsigned char *)malloc(frame);
+	if (!lin || !out || !code) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	/* speech-like levels, all segments */
+	srand(1);
+	for (i = 0; i < frame; i++)
+		lin[i] = (short)((rand() % 65536 - 32768) >> (rand() % 8));
+
+	g711_init();
+	c = g711_kernels(0);
+
+	printf("# %d samples per call, Msamples/s\n", frame);
+	printf("# %-6s %8s %8s %8s %8s  %s\n", "kernel",
+			"ulaw-enc", "ulaw-dec", "alaw-enc", "alaw-dec", "check");
+	for (i = 0; (k = g711_kernels(i)); i++) {
+		bad = check(k, c);
+		failed |= bad != 0;
+		k->ulaw_encode(code, lin, frame);
+		printf("  %-6s %8.1f", k->name,
+				run_encode(k->ulaw_encode, lin, code) / 1e6);
+		printf(" %8.1f", run_decode(k->ulaw_decode, code, out) / 1e6);
+		k->alaw_encode(code, lin, frame);
+		printf(" %8.1f", run_encode(k->alaw_encode, lin, code) / 1e6);
+		printf(" %8.1f", run_decode(k->alaw_decode, code, out) / 1e6);
+		if (bad)
+			printf("  %ld mismatches\n", bad);
+		else
+			printf("  exact\n");
+	}
+	printf("# in use: %s\n", g711_kernels(i - 1)->name);
+
+	free(code);
+	free(out);
+	free(lin);
+	return failed;
+}
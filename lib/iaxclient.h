@@ -954,6 +954,165 @@ EXPORT char* iaxc_version(char *ver);
 */
 EXPORT void iaxc_set_jb_target_extra( long value );
 
+/*!
+	Select the jitterbuffer used for calls started from now on.
+	\param name "jitterbuf" (default), or "speex" for the Speex adaptive
+	jitter buffer's algorithm, which usually holds less delay. NULL selects
+	the default.
+	\return 0 on success, -1 if there is no engine called \a name.
+*/
+EXPORT int iaxc_set_jb_engine(const char *name);
+
+/*!
+	Time-stretch received speech by up to \a percent, without changing its
+	pitch, instead of relying only on the jitterbuffer dropping and
+	interpolating frames and the audio driver skipping or padding samples.
+	Excess jitterbuffer delay is played out slightly faster, and the audio
+	driver's queue is kept near its target by playing slightly faster or
+	slower. With this on, a lower iaxc_set_jb_target_extra() can be used.
+	Adds about 20ms of delay while enabled.
+	\param percent Largest speed change, 0 (default) disables. 5 is a good
+	start; changes above 10 percent become audible.
+*/
+EXPORT void iaxc_set_time_stretch(int percent);
+
+/*!
+	Play received audio by pulling it from the jitterbuffer when the audio
+	driver needs it, instead of decoding it as it becomes due and queueing
+	it in the driver's output buffer. The driver's buffer then holds about
+	one period and the jitterbuffer is the only source of playout delay,
+	which saves most of the output buffer's delay. Only the selected call is
+	played this way. Needs an audio driver that supports it (PortAudio);
+	others carry on as before.
+	\param enable 1 to pull playout, 0 (default) to push.
+*/
+EXPORT void iaxc_set_pull_playout(int enable);
+
+/*!
+	Conference all calls together, for hubs linking several calls, instead
+	of only the selected call being heard and sent audio. Each call is sent
+	the mix of the local input and every other call, and the mix of all the
+	calls is played locally. Received audio is queued per call and mixed as
+	each frame of input is read, so the input device paces the mix; time
+	stretching and pull playout are not used meanwhile. The local input
+	goes through the transmit processing (normalization, filters and
+	silence suppression) once, before it is mixed; the mixes sent to the
+	calls are only encoded, as each call processed its own audio before
+	sending it, so they are sent continuously. With
+	IAXC_AUDIO_PREF_SEND_DISABLE set the local input is left out of the
+	mix, but the calls still hear each other.
+	\param enable 1 to conference all calls, 0 (default) for the selected
+	call only.
+*/
+EXPORT void iaxc_set_conference(int enable);
+
+/*!
+	Receive up to \a count datagrams per system call where the platform
+	supports it (recvmmsg on Linux). Has no effect with application-defined
+	networking.
+	\param count Datagrams per read; 0 disables. With 1, datagrams are
+	still read into pooled buffers and voice is passed up without copying.
+
+	\note Must be called before iaxc_initialize!
+*/
+EXPORT void iaxc_set_recv_batch(int count);
+
+/*!
+	Queue outgoing datagrams and send them in batches where the platform
+	supports it (sendmmsg on Linux). The queue is flushed each time the
+	library lock is released, i.e. once per processing pass and after each
+	API call that sends. Has no effect with application-defined networking.
+	\param count Datagrams per batch; 1 or less disables batching.
+
+	\note Must be called before iaxc_initialize!
+*/
+EXPORT void iaxc_set_send_batch(int count);
+
+/*!
+	Transmit batching counters, see iaxc_set_send_batch(). frames / flushes
+	is the average batching factor.
+*/
+struct iaxc_tx_stats
+{
+	unsigned long flushes; /*!< non-empty queue flushes */
+	unsigned long frames;  /*!< datagrams sent through the queue */
+	unsigned long syscalls; /*!< send system calls made */
+	int max_batch;         /*!< most datagrams sent by one flush */
+};
+
+/*!
+	Fetch the transmit batching counters.
+	\param stats Filled in on return.
+*/
+EXPORT void iaxc_get_tx_stats(struct iaxc_tx_stats *stats);
+
+#define IAXC_TRUNK_OFF  0 /*!< one mini frame per call */
+#define IAXC_TRUNK_ON   1 /*!< always trunk voice to the peer */
+#define IAXC_TRUNK_AUTO 2 /*!< trunk once the peer sends trunked voice */
+
+/*!
+	Sets the trunking mode for calls created from now on. With trunking,
+	the voice of all calls to the same peer travels in one meta-trunk
+	datagram per 20ms tick instead of one datagram per call. IAX2 does not
+	negotiate trunking, so only enable it toward peers configured to accept
+	it (trunk=yes in Asterisk), or use IAXC_TRUNK_AUTO.
+	\param mode One of IAXC_TRUNK_OFF (default), IAXC_TRUNK_ON or
+	IAXC_TRUNK_AUTO.
+*/
+EXPORT void iaxc_set_trunk(int mode);
+
+/*!
+	Sets the trunking mode of an existing call.
+	\param callNo The call number.
+	\param mode See iaxc_set_trunk().
+
+	\return 0 on success, -1 if there is no such call.
+*/
+EXPORT int iaxc_set_call_trunk(int callNo, int mode);
+
+/*!
+	Trunking counters, see iaxc_set_trunk().
+*/
+struct iaxc_trunk_stats
+{
+	unsigned long datagrams;     /*!< datagrams sent from trunk buffers */
+	unsigned long frames;        /*!< voice frames carried by them */
+	unsigned long saved;         /*!< datagrams avoided by trunking */
+	unsigned long saved_per_sec; /*!< datagrams avoided over the last second */
+	unsigned long rx_datagrams;  /*!< trunk datagrams received */
+	unsigned long rx_frames;     /*!< voice frames taken out of them */
+};
+
+/*!
+	Fetch the trunking counters.
+	\param stats Filled in on return.
+*/
+EXPORT void iaxc_get_trunk_stats(struct iaxc_trunk_stats *stats);
+
+/*!
+	Allocation pool counters for one size class of the network stack's
+	per-packet objects (events, frames, timers).
+*/
+struct iaxc_pool_stats
+{
+	int size;             /*!< block size, 0 for oversize allocations */
+	unsigned long hits;   /*!< allocations served from the free list */
+	unsigned long misses; /*!< allocations that went to the heap */
+	int inuse;            /*!< blocks currently allocated */
+	int highwater;        /*!< most blocks allocated at once */
+	int free;             /*!< blocks on the free list */
+};
+
+/*!
+	Fetch the allocation pool counters.
+	\param stats Array to fill, one entry per size class followed by the
+	oversize entry.
+	\param max Number of entries in \a stats.
+
+	\return The number of entries filled.
+*/
+EXPORT int iaxc_get_pool_stats(struct iaxc_pool_stats *stats, int max);
+
 /*!
 	Application-defined networking; give substitute sendto and recvfrom
 	functions.
@@ -973,6 +1132,41 @@ EXPORT void iaxc_set_networking(iaxc_sendto_t st, iaxc_recvfrom_t rf) ;
 */
 EXPORT int iaxc_get_netstats(int call, int *rtt, struct iaxc_netstat *local, struct iaxc_netstat *remote);
 
+#define IAXC_JB_HIST_BUCKETS 16 /*!< buckets in each jitterbuffer histogram */
+
+/*!
+	A histogram of jitterbuffer behaviour. count[i] counts values from
+	bound[i] up to bound[i + 1]; the last bucket is open ended.
+*/
+struct iaxc_jb_histogram
+{
+	int bound[IAXC_JB_HIST_BUCKETS];           /*!< lower bound of each bucket */
+	unsigned long count[IAXC_JB_HIST_BUCKETS]; /*!< values in each bucket */
+};
+
+/*!
+	Jitterbuffer histograms of a call, counted since it started.
+*/
+struct iaxc_jb_histograms
+{
+	struct iaxc_jb_histogram delay;  /*!< ms each voice frame waited in the jitterbuffer */
+	struct iaxc_jb_histogram jitter; /*!< ms between the transit times of successive voice frames */
+	struct iaxc_jb_histogram interp; /*!< frames in each run of interpolated (lost or late) audio */
+};
+
+/*!
+	Take a snapshot of a call's jitterbuffer histograms. The counters are
+	only ever added to, so the difference between two snapshots covers the
+	time between them. It takes the library lock, as the call's session
+	may go away meanwhile, so it is safe from any thread but should not be
+	called many times a second.
+	\param callNo The call number.
+	\param hist Filled in on return.
+
+	\return 0 on success, -1 if there is no such call.
+*/
+EXPORT int iaxc_get_jb_histograms(int callNo, struct iaxc_jb_histograms *hist);
+
 /*!
 	A structure containing information about a video capture device.
 */
@@ -78,6 +78,8 @@
 #include "audio_openal.h" 
 #include "audio_portaudio.h"
 #include "audio_encode.h"
+#include "audio_tsm.h"
+#include "audio_mixer.h"
 #ifdef USE_VIDEO
 #include "video.h"
 #endif
@@ -115,6 +117,30 @@ static struct iaxc_registration *find_registration_by_hostname(const char *hostn
 /* configurable jitterbuffer options */
 static long jb_target_extra = -1;
 
+/* datagrams per network read, see iaxc_set_recv_batch */
+static int recv_batch = 0;
+
+/* datagrams per network write, see iaxc_set_send_batch */
+static int send_batch = 0;
+
+/* trunking mode for new calls, see iaxc_set_trunk */
+static int trunk_mode = IAXC_TRUNK_OFF;
+
+/* largest time-stretch of received audio, percent; see
+ * iaxc_set_time_stretch */
+static int time_stretch = 0;
+
+/* received audio pulled from the jitterbuffer by the audio driver, see
+ * iaxc_set_pull_playout */
+static int pull_playout = 0;
+
+/* all calls mixed together, instead of only the selected call heard and
+ * fed; see iaxc_set_conference */
+static int conference = 0;
+static struct mixer_state *mixer = NULL;
+/* transmit processing of the local input before it is mixed */
+static struct iaxc_audio_pipeline *conference_pipeline = NULL;
+
 struct iaxc_registration
 {
 	struct iax_session *session;
@@ -161,6 +187,7 @@ int max_calls; // number of calls for this library session
 static int radioNo = -1;
 
 static void service_network();
+static void service_playout();
 static int service_audio();
 
 /* external global networking replacements */
@@ -176,6 +203,19 @@ static THREADID main_proc_thread_id;
 /* 0 running, 1 should quit, -1 not running */
 static int main_proc_thread_flag = -1;
 
+/* Set by audio drivers that call iaxci_audio_ready() */
+int iaxci_audio_ready_notify = 0;
+
+#ifdef IAXC_PROC_WAIT
+/* The processing thread is blocked in iaxci_proc_wait() between passes */
+static int proc_wait_active = 0;
+/* The processing thread holds iaxc_lock for a pass */
+static int proc_in_pass = 0;
+/* iaxci_audio_ready() has woken the processing thread since its pass
+ * began; later calls have nothing to add until the next pass */
+static volatile int proc_audio_woken = 0;
+#endif
+
 static iaxc_event_callback_t iaxc_event_callback = NULL;
 
 // Internal queue of events, waiting to be posted once the library
@@ -203,6 +243,18 @@ void put_iaxc_lock()
 	event_queue = NULL;
 	MUTEXUNLOCK(&event_queue_lock);
 
+	/* send whatever this pass or API call queued */
+	iax_flush_tx();
+
+#ifdef IAXC_PROC_WAIT
+	/* An API call may have scheduled something earlier than the
+	 * deadline the processing thread is sleeping towards */
+	if ( proc_in_pass )
+		proc_in_pass = 0;
+	else if ( proc_wait_active )
+		iaxci_proc_wake();
+#endif
+
 	MUTEXUNLOCK(&iaxc_lock);
 
 	while (event)
@@ -490,9 +542,22 @@ static void iaxc_clear_call(int toDump)
 	calls[toDump].format = 0;
 	calls[toDump].vformat = 0;
 	calls[toDump].session = NULL;
+	calls[toDump].jb_pull = 0;
+	if ( mixer )
+		mixer_clear(mixer, toDump);
 	iaxci_do_state_callback(toDump);
 }
 
+/* Calls tag their session's private pointer with callNo + 1, so
+ * iaxc_find_call_by_session() is O(1).  The tag is only trusted while
+ * the call still owns the session. */
+static void iaxc_bind_call_session(int callNo, struct iax_session *session)
+{
+	calls[callNo].session = session;
+	iax_set_private(session, (void *)(size_t)(callNo + 1));
+	iax_set_trunk(session, trunk_mode);
+}
+
 /* select a call.  */
 /* XXX Locking??  Start/stop audio?? */
 EXPORT int iaxc_select_call(int callNo)
@@ -561,6 +626,121 @@ EXPORT void iaxc_set_jb_target_extra( long value )
 	jb_target_extra = value;
 }
 
+EXPORT int iaxc_set_jb_engine(const char *name)
+{
+	return iax_set_jb_engine( name );
+}
+
+EXPORT void iaxc_set_time_stretch(int percent)
+{
+	if ( percent < 0 )
+		percent = 0;
+	else if ( percent > 50 )
+		percent = 50;
+	time_stretch = percent;
+}
+
+EXPORT void iaxc_set_pull_playout(int enable)
+{
+	/* applied by service_playout on its next pass */
+	pull_playout = enable;
+}
+
+EXPORT void iaxc_set_conference(int enable)
+{
+	int i;
+
+	get_iaxc_lock();
+	/* don't mix in what was queued before a previous disable */
+	if ( mixer && enable && !conference )
+		for ( i = 0; i < max_calls; i++ )
+			mixer_clear(mixer, i);
+	conference = enable;
+	put_iaxc_lock();
+}
+
+EXPORT void iaxc_set_recv_batch(int count)
+{
+	/* applied to libiax2 in iaxc_initialize */
+	recv_batch = count;
+}
+
+EXPORT void iaxc_set_send_batch(int count)
+{
+	/* applied to libiax2 in iaxc_initialize */
+	send_batch = count;
+}
+
+EXPORT void iaxc_get_tx_stats(struct iaxc_tx_stats *stats)
+{
+	struct iax_tx_stats s;
+
+	iax_get_tx_stats(&s);
+	stats->flushes = s.flushes;
+	stats->frames = s.frames;
+	stats->syscalls = s.syscalls;
+	stats->max_batch = s.max_batch;
+}
+
+EXPORT void iaxc_set_trunk(int mode)
+{
+	trunk_mode = mode;
+}
+
+EXPORT int iaxc_set_call_trunk(int callNo, int mode)
+{
+	int ret = -1;
+
+	get_iaxc_lock();
+	if ( callNo >= 0 && callNo < max_calls && calls[callNo].session )
+	{
+		iax_set_trunk(calls[callNo].session, mode);
+		ret = 0;
+	}
+	put_iaxc_lock();
+	return ret;
+}
+
+EXPORT void iaxc_get_trunk_stats(struct iaxc_trunk_stats *stats)
+{
+	struct iax_trunk_stats s;
+
+	get_iaxc_lock();
+	iax_get_trunk_stats(&s);
+	put_iaxc_lock();
+
+	stats->datagrams = s.datagrams;
+	stats->frames = s.frames;
+	stats->saved = s.saved;
+	stats->saved_per_sec = s.saved_per_sec;
+	stats->rx_datagrams = s.rx_datagrams;
+	stats->rx_frames = s.rx_frames;
+}
+
+EXPORT int iaxc_get_pool_stats(struct iaxc_pool_stats *stats, int max)
+{
+	struct iax_pool_stats s[16];
+	int i, n;
+
+	if ( max > (int)(sizeof(s) / sizeof(s[0])) )
+		max = sizeof(s) / sizeof(s[0]);
+
+	get_iaxc_lock();
+	n = iax_get_pool_stats(s, max);
+	put_iaxc_lock();
+
+	for ( i = 0; i < n; i++ )
+	{
+		stats[i].size = s[i].size;
+		stats[i].hits = s[i].hits;
+		stats[i].misses = s[i].misses;
+		stats[i].inuse = s[i].inuse;
+		stats[i].highwater = s[i].highwater;
+		stats[i].free = s[i].free;
+	}
+	return n;
+}
+
 static void jb_errf(const char *fmt, ...)
 {
 	va_list args;
@@ -682,6 +862,12 @@ EXPORT int iaxc_initialize(int num_calls)
 	/* tweak the jitterbuffer settings */
 	iax_set_jb_target_extra( jb_target_extra );
 
+	if ( recv_batch > 0 )
+		iax_set_recv_batch(recv_batch);
+	if ( send_batch > 1 && iaxc_sendto == (iaxc_sendto_t)sendto &&
+			iax_set_send_batch(send_batch) < 0 )
+		iaxci_usermsg(IAXC_ERROR, "Unable to enable batched transmit");
+
 	max_calls = num_calls;
 	/* initialize calls */
 	if ( max_calls <= 0 )
@@ -758,10 +944,17 @@ EXPORT void iaxc_shutdown()
 				calls[i].vencoder->destroy(calls[i].vencoder);
 			if ( calls[i].vdecoder )
 				calls[i].vdecoder->destroy(calls[i].vdecoder);
+			audio_pipeline_destroy(calls[i].pipeline);
+			tsm_destroy(calls[i].tsm);
                 }
 		free(calls);
 		calls = NULL;
 	}
+	mixer_destroy(mixer);
+	mixer = NULL;
+	audio_pipeline_destroy(conference_pipeline);
+	conference_pipeline = NULL;
+	iax_trunk_shutdown();
 	put_iaxc_lock();
 #ifdef WIN32
 	//closesocket(iax_get_fd()); //fd:
@@ -834,7 +1027,128 @@ static void iaxc_refresh_registrations()
 	}
 }
 
+void iaxci_audio_ready(void)
+{
+#ifdef IAXC_PROC_WAIT
+	/* called every driver period, so only the first since the thread
+	 * last looked at the audio costs a syscall */
+	if ( proc_wait_active &&
+	     __sync_bool_compare_and_swap(&proc_audio_woken, 0, 1) )
+		iaxci_proc_wake();
+#endif
+}
+
+/* a call that hears, and is heard by, the others in conference mode */
+static int iaxc_conference_member(int callNo)
+{
+	return (calls[callNo].state & IAXC_CALL_STATE_OUTGOING) ||
+		(calls[callNo].state & IAXC_CALL_STATE_COMPLETE);
+}
+
+static int iaxc_want_send_audio()
+{
+	int i;
+
+	/* input paces the mix, even with sending disabled */
+	if ( conference )
+	{
+		for ( i = 0; i < max_calls; i++ )
+			if ( iaxc_conference_member(i) )
+				return 1;
+		return 0;
+	}
+
+	return selected_call >= 0 &&
+		((calls[selected_call].state & IAXC_CALL_STATE_OUTGOING) ||
+		 (calls[selected_call].state & IAXC_CALL_STATE_COMPLETE))
+		&& !(audio_prefs & IAXC_AUDIO_PREF_SEND_DISABLE);
+}
+
+static int iaxc_want_local_audio()
+{
+	return (audio_prefs & IAXC_AUDIO_PREF_RECV_LOCAL_RAW) ||
+		(audio_prefs & IAXC_AUDIO_PREF_RECV_LOCAL_ENCODED);
+}
+
 #define LOOP_SLEEP 5 // In ms
+
+#ifdef IAXC_PROC_WAIT
+/* longest sleep while idle, keeps the levels heartbeat in service_audio() */
+#define LOOP_IDLE_WAKE 250 // In ms
+
+static void iaxc_tv_add_ms(struct timeval *tv, long ms)
+{
+	tv->tv_sec += ms / 1000;
+	tv->tv_usec += (ms % 1000) * 1000;
+	if ( tv->tv_usec >= 1000000 )
+	{
+		tv->tv_usec -= 1000000;
+		tv->tv_sec++;
+	}
+}
+
+/* Event driven processing loop: instead of sleeping LOOP_SLEEP between
+ * passes, block until the socket is readable, the audio driver signals
+ * captured audio, or the next libiax2 deadline (retransmission, ping,
+ * jitterbuffer playout) is due. */
+static void main_proc_event_loop()
+{
+	struct timeval now, deadline, limit, last_refresh;
+
+	last_refresh = iax_tvnow();
+	proc_wait_active = 1;
+
+	while ( !main_proc_thread_flag )
+	{
+		get_iaxc_lock();
+		proc_in_pass = 1;
+		/* audio from here on is seen by this pass or wakes the next */
+		__sync_bool_compare_and_swap(&proc_audio_woken, 1, 0);
+
+		service_network();
+		if ( !test_mode )
+		{
+			service_playout();
+			service_audio();
+		}
+
+		now = iax_tvnow();
+
+		// Check registration refresh once a second
+		if ( iaxci_msecdiff(&now, &last_refresh) >= 1000 )
+		{
+			iaxc_refresh_registrations();
+			last_refresh = now;
+		}
+
+		limit = now;
+		if ( !test_mode && !iaxci_audio_ready_notify &&
+				(iaxc_want_send_audio() || iaxc_want_local_audio()) )
+			iaxc_tv_add_ms(&limit, LOOP_SLEEP); /* driver must be polled */
+		else
+			iaxc_tv_add_ms(&limit, LOOP_IDLE_WAKE);
+
+		if ( iax_next_event_time(&deadline) < 0 ||
+				iaxci_usecdiff(&deadline, &limit) > 0 )
+			deadline = limit;
+
+		/* Everything due was handled above; a deadline still in the
+		 * past is a jitterbuffer with nothing to hand out yet */
+		if ( iaxci_usecdiff(&deadline, &now) < 1000 )
+		{
+			deadline = now;
+			iaxc_tv_add_ms(&deadline, 1);
+		}
+
+		put_iaxc_lock();
+
+		iaxci_proc_wait(&deadline);
+	}
+
+	proc_wait_active = 0;
+}
+#endif
+
 static THREADFUNCDECL(main_proc_thread_func)
 {
 	static int refresh_registration_count = 0;
@@ -844,13 +1158,25 @@ static THREADFUNCDECL(main_proc_thread_func)
 	/* Increase Priority */
 	iaxci_prioboostbegin();
 
+#ifdef IAXC_PROC_WAIT
+	/* Needs our own socket; application networking is polled */
+	if ( iaxci_bound_port >= 0 && !iaxci_proc_wait_init(iax_get_fd()) )
+	{
+		main_proc_event_loop();
+		iaxci_proc_wait_destroy();
+	}
+#endif
+
 	while ( !main_proc_thread_flag )
 	{
 		get_iaxc_lock();
 
 		service_network();
 		if ( !test_mode )
+		{
+			service_playout();
 			service_audio();
+		}
 
 		// Check registration refresh once a second
 		if ( refresh_registration_count++ > 1000/LOOP_SLEEP )
@@ -888,26 +1214,65 @@ EXPORT int iaxc_stop_processing_thread()
 	if ( main_proc_thread_flag >= 0 )
 	{
 		main_proc_thread_flag = 1;
+#ifdef IAXC_PROC_WAIT
+		if ( proc_wait_active )
+			iaxci_proc_wake();
+#endif
 		THREADJOIN(main_proc_thread);
 	}
 
 	return 0;
 }
 
+static struct mixer_state *iaxc_conference_mixer()
+{
+	if ( !mixer )
+		mixer = mixer_create(max_calls);
+	return mixer;
+}
+
+/* Sends each member of the conference the mix of the local input and
+ * everyone else, and plays the mix of all the members locally.  The
+ * local input is processed once, before mixing; what the members send
+ * was processed at their end, so the mixes are only encoded. */
+static void service_conference(short *buf, int n)
+{
+	short *local = buf;
+	int i;
+
+	if ( !iaxc_conference_mixer() )
+		return;
+
+	/* with sending disabled the members still hear each other, and
+	 * local silence is left out rather than mixed in */
+	if ( (audio_prefs & IAXC_AUDIO_PREF_SEND_DISABLE) ||
+	     audio_process_local(&conference_pipeline, buf, n) > 0 )
+		local = NULL;
+
+	if ( mixer_run(mixer, local, n) )
+		return;
+
+	for ( i = 0; i < max_calls; i++ )
+	{
+		if ( iaxc_conference_member(i) )
+			audio_send_mixed_audio(&calls[i], i,
+					mixer_out(mixer, i),
+					calls[i].format & IAXC_AUDIO_FORMAT_MASK,
+					n);
+	}
+
+	if ( !iaxci_audio_output_mode )
+		audio_driver.output(&audio_driver, mixer_out(mixer, -1), n);
+}
+
 static int service_audio()
 {
 	/* TODO: maybe we shouldn't allocate 8kB on the stack here. */
 	short buf [4096];
 
-	int want_send_audio =
-		selected_call >= 0 &&
-		((calls[selected_call].state & IAXC_CALL_STATE_OUTGOING) ||
-		 (calls[selected_call].state & IAXC_CALL_STATE_COMPLETE))
-		&& !(audio_prefs & IAXC_AUDIO_PREF_SEND_DISABLE);
+	int want_send_audio = iaxc_want_send_audio();
 
-	int want_local_audio =
-		(audio_prefs & IAXC_AUDIO_PREF_RECV_LOCAL_RAW) ||
-		(audio_prefs & IAXC_AUDIO_PREF_RECV_LOCAL_ENCODED);
+	int want_local_audio = iaxc_want_local_audio();
 
 	if ( want_local_audio || want_send_audio )
 	{
@@ -915,13 +1280,21 @@ static int service_audio()
 		{
 			int to_read;
 			int cmin;
+			int i;
 
 			audio_driver.start(&audio_driver);
 
 			/* use codec minimum if higher */
-			cmin = want_send_audio && calls[selected_call].encoder ?
+			cmin = want_send_audio && !conference &&
+				calls[selected_call].encoder ?
 				calls[selected_call].encoder->minimum_frame_size :
 				1;
+			for ( i = 0; conference && i < max_calls; i++ )
+			{
+				if ( iaxc_conference_member(i) && calls[i].encoder &&
+						calls[i].encoder->minimum_frame_size > cmin )
+					cmin = calls[i].encoder->minimum_frame_size;
+			}
 
 			to_read = cmin > minimum_outgoing_framesize ?
 				cmin : minimum_outgoing_framesize;
@@ -958,7 +1331,9 @@ static int service_audio()
 						IAXC_SOURCE_LOCAL, 0, 0,
 						to_read * 2, (unsigned char *)buf);
 
-			if ( want_send_audio ) {
+			if ( conference ) {
+				service_conference(buf, to_read);
+			} else if ( want_send_audio ) {
 #ifdef VERBOSE
 				IAX_LOG("service_audio:calling audio_send_encoded_audio");
 #endif
@@ -976,7 +1351,8 @@ static int service_audio()
 	}
 	else
 	{
-		static int i = 0;
+		static struct timeval last_levels;
+		struct timeval now;
 
 		audio_driver.stop(&audio_driver);
 
@@ -991,9 +1367,13 @@ static int service_audio()
 		   so any applications relying on this behavior should maybe
 		   be changed.
 		 */
-		if ( i++ % 50 == 0 )
+		now = iax_tvnow();
+		if ( iaxci_msecdiff(&now, &last_levels) >= 50 * LOOP_SLEEP )
+		{
+			last_levels = now;
 			iaxci_do_levels_callback(AUDIO_ENCODE_SILENCE_DB,
 					AUDIO_ENCODE_SILENCE_DB);
+		}
 	}
 
 	return 0;
@@ -1079,6 +1459,36 @@ EXPORT int iaxc_get_netstats(int call, int *rtt, struct iaxc_netstat *local,
 			(struct iax_netstat *)remote);
 }
 
+static void copy_jb_histogram(struct iaxc_jb_histogram *to,
+		const struct iax_jb_histogram *from)
+{
+	int i;
+
+	for ( i = 0; i < IAXC_JB_HIST_BUCKETS && i < IAX_JB_HIST_BUCKETS; i++ )
+	{
+		to->bound[i] = from->bound[i];
+		to->count[i] = from->count[i];
+	}
+}
+
+EXPORT int iaxc_get_jb_histograms(int callNo, struct iaxc_jb_histograms *hist)
+{
+	struct iax_jb_histograms h;
+	int ret = -1;
+
+	get_iaxc_lock();
+	if ( callNo >= 0 && callNo < max_calls && calls[callNo].session )
+		ret = iax_get_jb_histograms(calls[callNo].session, &h);
+	put_iaxc_lock();
+	if ( ret )
+		return -1;
+
+	copy_jb_histogram(&hist->delay, &h.delay);
+	copy_jb_histogram(&hist->jitter, &h.jitter);
+	copy_jb_histogram(&hist->interp, &h.interp);
+	return 0;
+}
+
 /* handle IAX text events */
 static void generate_netstat_event(int callNo)
 {
@@ -1096,6 +1506,66 @@ static void generate_netstat_event(int callNo)
 		iaxci_post_event(ev);
 }
 
+/* received audio is all decoded at 8kHz */
+#define RECV_SAMPLES_PER_MS	8
+/* ms off target that get the full time_stretch, less get proportionally
+ * less, and ms off target that are left alone */
+#define STRETCH_FULL_MS		40
+#define STRETCH_DEADBAND_MS	10
+
+/* Time-scales decoded audio ahead of the audio driver.  Excess
+ * jitterbuffer delay is played out faster, and the jitterbuffer moved
+ * on by what that took out, so it converges on its target without
+ * dropping frames; otherwise the driver's queue is steered to its
+ * target.  Returns the samples in out, or -1 to play in as it is. */
+static int stretch_audio(struct iaxc_call *call, short *in, int n,
+		short *out, int maxout)
+{
+	long current, target, excess = 0, stretched, ms;
+	int backlog, backlog_target;
+	int coupled = 0, speed;
+
+	if ( !call->tsm && !(call->tsm = tsm_create(8000)) )
+		return -1;
+
+	if ( !iax_get_jb_delay(call->session, &current, &target) &&
+			current - target > STRETCH_DEADBAND_MS )
+	{
+		excess = current - target;
+		coupled = 1;
+	} else if ( audio_driver.output_backlog )
+	{
+		backlog = audio_driver.output_backlog(&audio_driver, &backlog_target);
+		excess = (backlog - backlog_target) / RECV_SAMPLES_PER_MS;
+		if ( excess > -STRETCH_DEADBAND_MS && excess < STRETCH_DEADBAND_MS )
+			excess = 0;
+	}
+
+	if ( excess > STRETCH_FULL_MS )
+		excess = STRETCH_FULL_MS;
+	else if ( excess < -STRETCH_FULL_MS )
+		excess = -STRETCH_FULL_MS;
+	speed = TSM_SPEED_NORMAL + excess * time_stretch * 10 / STRETCH_FULL_MS;
+
+	n = tsm_process(call->tsm, in, n, out, maxout, speed);
+
+	/* move the jitterbuffer on by whole ms of what was taken out */
+	stretched = tsm_stretched(call->tsm) - call->tsm_credited;
+	if ( coupled )
+	{
+		ms = stretched / RECV_SAMPLES_PER_MS;
+		if ( ms > 0 )
+		{
+			iax_jb_stretch(call->session, -ms);
+			call->tsm_credited += ms * RECV_SAMPLES_PER_MS;
+		}
+	} else
+	{
+		call->tsm_credited += stretched;
+	}
+	return n;
+}
+
 // Add this function implementation somewhere before it's referenced:
 
 static void handle_audio_event(struct iax_event *e, int callNo)
@@ -1103,6 +1573,7 @@ static void handle_audio_event(struct iax_event *e, int callNo)
 	int total_consumed = 0;
 	short fr[4096];
 	const int fr_samples = sizeof(fr) / sizeof(short);
+	short stretched[2 * 4096 + 320];
 	int samples, format;
 #ifdef WIN32
 	int cycles_max = 100; //fd:
@@ -1114,7 +1585,7 @@ static void handle_audio_event(struct iax_event *e, int callNo)
 
 	call = &calls[callNo];
 
-	if ( callNo != selected_call )
+	if ( callNo != selected_call && !conference )
 	{
 	    /* drop audio for unselected call? */
 	    return;
@@ -1171,12 +1642,35 @@ static void handle_audio_event(struct iax_event *e, int callNo)
 					0, 0, size, (unsigned char *)fr);
 		}
 
+		if ( conference )
+		{
+			/* mixed, sent on and played by service_conference() */
+			if ( !test_mode && iaxc_conference_mixer() )
+				mixer_put(mixer, callNo, fr,
+						fr_samples - samples - mainbuf_delta);
+			continue;
+		}
+
 		if ( iaxci_audio_output_mode )
 			continue;
 
 		if ( !test_mode )
-			audio_driver.output(&audio_driver, fr,
-			    fr_samples - samples - mainbuf_delta);
+		{
+			short *out = fr;
+			int n = fr_samples - samples - mainbuf_delta;
+
+			if ( time_stretch > 0 )
+			{
+				int m = stretch_audio(call, fr, n, stretched,
+						sizeof(stretched) / sizeof(short));
+				if ( m >= 0 )
+				{
+					out = stretched;
+					n = m;
+				}
+			}
+			audio_driver.output(&audio_driver, out, n);
+		}
 
 	} while ( total_consumed < e->datalen );
 }
@@ -1510,6 +2004,11 @@ static void codec_destroy( int callNo )
 		calls[callNo].vencoder->destroy(calls[callNo].vencoder);
 		calls[callNo].vencoder = NULL;
 	}
+	audio_pipeline_destroy(calls[callNo].pipeline);
+	calls[callNo].pipeline = NULL;
+	tsm_destroy(calls[callNo].tsm);
+	calls[callNo].tsm = NULL;
+	calls[callNo].tsm_credited = 0;
 }
 
 EXPORT int iaxc_call(const char * num)
@@ -1556,7 +2055,7 @@ EXPORT int iaxc_call_ex(const char *num, const char* callerid_name, const char*
 		goto iaxc_call_bail;
 	}
 
-	calls[callNo].session = newsession;
+	iaxc_bind_call_session(callNo, newsession);
 
 	codec_destroy( callNo );
 
@@ -1826,9 +2325,12 @@ EXPORT void iaxc_send_url(const char * url, int link)
 static int iaxc_find_call_by_session(struct iax_session *session)
 {
 	int i;
-	for ( i = 0; i < max_calls; i++ )
-		if ( calls[i].session == session )
-			return i;
+
+	if ( !session )
+		return -1;
+	i = (int)(size_t)iax_get_private(session) - 1;
+	if ( i >= 0 && i < max_calls && calls[i].session == session )
+		return i;
 	return -1;
 }
 
@@ -2082,7 +2584,7 @@ static void iaxc_handle_connect(struct iax_event * e)
 
 	codec_destroy( callno );
 
-	calls[callno].session = e->session;
+	iaxc_bind_call_session(callno, e->session);
 	calls[callno].state = IAXC_CALL_STATE_ACTIVE|IAXC_CALL_STATE_RINGING;
 
 	iax_accept(calls[callno].session, format | video_format);
@@ -2093,52 +2595,109 @@ static void iaxc_handle_connect(struct iax_event * e)
 	iaxci_usermsg(IAXC_STATUS, "Incoming call on line %d", callno);
 }
 
-static void service_network()
+/* Dispatch and free an event from libiax2 */
+static void service_event(struct iax_event *e)
 {
-	struct iax_event *e = 0;
 	int callNo;
 	struct iaxc_registration *reg;
 
+	// first, see if this is an event for one of our calls.
+	// NULL events carry no session.
+	callNo = e->etype == IAX_EVENT_NULL ? -1 :
+		iaxc_find_call_by_session(e->session);
+	if ( e->etype == IAX_EVENT_NULL )
+	{
+		// Should we do something here?
+		// Right now we do nothing, just go with the flow
+		// and let the event be deallocated.
+	} else if ( callNo >= 0 )
+	{
+		iaxc_handle_network_event(e, callNo);
+	} else if ( (reg = iaxc_find_registration_by_session(e->session)) != NULL )
+	{
+		iaxc_handle_regreply(e,reg);
+	} else if ( e->etype == IAX_EVENT_REGACK || e->etype == IAX_EVENT_REGREJ )
+	{
+		iaxci_usermsg(IAXC_ERROR, "Unexpected registration reply");
+	} else if ( e->etype == IAX_EVENT_REGREQ )
+	{
+		iaxci_usermsg(IAXC_ERROR,
+				"Registration requested by someone, but we don't understand!");
+	} else if ( e->etype == IAX_EVENT_CONNECT )
+	{
+		iaxc_handle_connect(e);
+	} else if ( e->etype == IAX_EVENT_TIMEOUT )
+	{
+		iaxci_usermsg(IAXC_STATUS,
+				"Timeout for a non-existant session. Dropping",
+				e->etype);
+	} else
+	{
+		iaxci_usermsg(IAXC_ERROR,
+				"Event (type %d) for a non-existant session. Dropping",
+				e->etype);
+	}
+	iax_event_free(e);
+}
+
+static void service_network()
+{
+	struct iax_event *e = 0;
+
 	while ( (e = iax_get_event(0)) )
 	{
 #ifdef WIN32
 		iaxc_millisleep(0); //fd:
 #endif
-		// first, see if this is an event for one of our calls.
-		callNo = iaxc_find_call_by_session(e->session);
-		if ( e->etype == IAX_EVENT_NULL )
-		{
-			// Should we do something here?
-			// Right now we do nothing, just go with the flow
-			// and let the event be deallocated.
-		} else if ( callNo >= 0 )
-		{
-			iaxc_handle_network_event(e, callNo);
-		} else if ( (reg = iaxc_find_registration_by_session(e->session)) != NULL )
-		{
-			iaxc_handle_regreply(e,reg);
-		} else if ( e->etype == IAX_EVENT_REGACK || e->etype == IAX_EVENT_REGREJ )
-		{
-			iaxci_usermsg(IAXC_ERROR, "Unexpected registration reply");
-		} else if ( e->etype == IAX_EVENT_REGREQ )
-		{
-			iaxci_usermsg(IAXC_ERROR,
-					"Registration requested by someone, but we don't understand!");
-		} else if ( e->etype == IAX_EVENT_CONNECT )
-		{
-			iaxc_handle_connect(e);
-		} else if ( e->etype == IAX_EVENT_TIMEOUT )
-		{
-			iaxci_usermsg(IAXC_STATUS,
-					"Timeout for a non-existant session. Dropping",
-					e->etype);
-		} else
+		service_event(e);
+	}
+}
+
+/* Pull playout: rather than libiax2 handing out the selected call's voice
+ * as its jitterbuffer makes it due, to wait again in the audio driver's
+ * buffer, it is taken from the jitterbuffer when the driver is down to
+ * less than a period queued, as due by the time that has played.  The
+ * driver wakes us with iaxci_audio_ready() after each period it plays, so
+ * the jitterbuffer is the only place received audio waits. */
+static void service_playout()
+{
+	int i, want = -1, backlog, target;
+	struct iax_event *e;
+	static int driver_pull = 0;
+
+	if ( pull_playout && !conference && !iaxci_audio_output_mode &&
+			audio_driver.output_pull && audio_driver.output_backlog &&
+			selected_call >= 0 && calls[selected_call].session &&
+			(iaxc_want_send_audio() || iaxc_want_local_audio()) )
+		want = selected_call;
+
+	for ( i = 0; i < max_calls; i++ )
+	{
+		if ( calls[i].jb_pull && i != want )
 		{
-			iaxci_usermsg(IAXC_ERROR,
-					"Event (type %d) for a non-existant session. Dropping",
-					e->etype);
+			iax_set_jb_pull(calls[i].session, 0);
+			calls[i].jb_pull = 0;
 		}
-		iax_event_free(e);
+	}
+
+	if ( want >= 0 && !calls[want].jb_pull &&
+			!iax_set_jb_pull(calls[want].session, 1) )
+		calls[want].jb_pull = 1;
+
+	if ( (want >= 0) != driver_pull &&
+			!audio_driver.output_pull(&audio_driver, want >= 0) )
+		driver_pull = want >= 0;
+
+	/* an event may clear the call */
+	while ( want >= 0 && calls[want].jb_pull )
+	{
+		backlog = audio_driver.output_backlog(&audio_driver, &target);
+		if ( backlog >= target )
+			break;
+		e = iax_jb_pull(calls[want].session, backlog / RECV_SAMPLES_PER_MS);
+		if ( !e )
+			break;
+		service_event(e);
 	}
 }
 
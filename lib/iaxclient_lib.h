@@ -157,6 +157,16 @@ struct iaxc_audio_driver {
 	/* mic boost */
 	int (*mic_boost_get)(struct iaxc_audio_driver *d ) ;
 	int (*mic_boost_set)(struct iaxc_audio_driver *d, int enable);
+
+	/* samples queued for output, and the level the driver aims for;
+	 * optional */
+	int (*output_backlog)(struct iaxc_audio_driver *d, int *target);
+
+	/* pull playout: keep one period queued for output, and call
+	 * iaxci_audio_ready() after taking each, so the processing thread
+	 * tops it up from the jitterbuffer; output_backlog() then aims at
+	 * one period.  Optional, returns 0 if supported */
+	int (*output_pull)(struct iaxc_audio_driver *d, int enable);
 };
 
 struct iaxc_audio_codec {
@@ -210,6 +220,9 @@ struct iaxc_call {
 	struct iaxc_video_codec *vdecoder;
 	int vformat;
 
+	/* preprocess, AGC, VAD and level state of this call's audio */
+	struct iaxc_audio_pipeline *pipeline;
+
 	/* the "state" of this call */
 	int state;
 	char remote[IAXC_EVENT_BUFSIZ];
@@ -231,6 +244,13 @@ struct iaxc_call {
 	/* we've sent a silent frame since the last audio frame */
 	int tx_silent;
 
+	/* time-stretching of received audio, see iaxc_set_time_stretch */
+	struct tsm_state *tsm;
+	long tsm_credited;	/* samples the jitterbuffer has been moved by */
+
+	/* the session's jitterbuffer is played out by service_playout() */
+	int jb_pull;
+
 	struct iax_session *session;
 };
 
@@ -261,6 +281,26 @@ extern int post_event_id;
 extern int iaxci_prioboostbegin(void);
 extern int iaxci_prioboostend(void);
 
+/* Event driven processing thread support (epoll/timerfd/eventfd) */
+#if defined(__linux__) && !defined(IAXC_NO_EPOLL)
+#define IAXC_PROC_WAIT 1
+/* watch fd and set up the wakeup/timer descriptors; 0 on success */
+extern int iaxci_proc_wait_init(int fd);
+extern void iaxci_proc_wait_destroy(void);
+/* sleep until fd is readable, a wakeup, or the absolute deadline
+ * (iax_tvnow() time base) if not NULL */
+extern int iaxci_proc_wait(const struct timeval *deadline);
+/* wake iaxci_proc_wait(), from any thread */
+extern void iaxci_proc_wake(void);
+#endif
+
+/* Called by audio drivers when captured audio is ready, typically from
+ * the driver callback; only wakes the processing thread, and makes no
+ * syscall if a wakeup is already pending for its next pass.  Drivers
+ * doing so set iaxci_audio_ready_notify, others are polled. */
+extern void iaxci_audio_ready(void);
+extern int iaxci_audio_ready_notify;
+
 long iaxci_usecdiff(struct timeval *t0, struct timeval *t1);
 long iaxci_msecdiff(struct timeval *t0, struct timeval *t1);
 
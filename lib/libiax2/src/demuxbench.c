@@ -0,0 +1,182 @@
+/*
+ * demuxbench: libiax2 session lookup benchmark
+ *
+ * Opens sessions from as many peers, then resolves a random stream of
+ * incoming frames to them, mini frames by the peer's call number and
+ * full frames by ours as well, the way iax_net_process() does.  The
+ * same frames go through the session indexes and through the walk of
+ * the whole session list they replaced, timing both and checking they
+ * find the same sessions.  Nothing is sent or received.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+/* the lookup is static; first, as it picks the features the system
+ * headers provide */
+#include "iax.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PEER_PORT	4569
+
+struct frame {
+	struct sockaddr_in sin;
+	short callno;
+	short dcallno;	/* 0 for a mini frame */
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: demuxbench [options]\n"
+		"  -n frames    frames resolved per run (10000)\n"
+		"  -c sessions  sessions, repeatable, at most 32767 (1000, 2000, 5000, 10000)\n"
+		"  -f permille  full frames (100)\n"
+		"  -s seed      random seed (1)\n");
+	exit(1);
+}
+
+/* The lookup as it was before the indexes */
+static struct iax_session *legacy_find(struct sockaddr_in *sin, short callno,
+		short dcallno)
+{
+	struct iax_session *cur;
+
+	for (cur = sessions; cur; cur = cur->next)
+		if (forward_match(sin, callno, dcallno, cur))
+			return cur;
+	for (cur = sessions; cur; cur = cur->next)
+		if (reverse_match(sin, callno, cur))
+			return cur;
+	return NULL;
+}
+
+/* peer i is 10.x.y.z, calling from its call number i + 1 */
+static void peer_addr(struct sockaddr_in *sin, int i)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0a000000 + i + 1);
+	sin->sin_port = htons(PEER_PORT);
+}
+
+int main(int argc, char *argv[])
+{
+	int nframes = 10000, full = 100;
+	int counts[16], ncounts = 0;
+	unsigned int seed = 1;
+	struct iax_session **byindex, **want, **got;
+	struct iax_session *s;
+	struct sockaddr_in sin;
+	struct frame *frames;
+	double tl, th;
+	long bad, mismatches = 0;
+	int i, j, k, peer, opt;
+
+	while ((opt = getopt(argc, argv, "n:c:f:s:")) != -1) {
+		switch (opt) {
+		case 'n': nframes = atoi(optarg); break;
+		case 'c':
+			if (ncounts == 16)
+				usage();
+			counts[ncounts++] = atoi(optarg);
+			break;
+		case 'f': full = atoi(optarg); break;
+		case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || nframes < 1 || full < 0 || full > 1000)
+		usage();
+	if (!ncounts) {
+		counts[ncounts++] = 1000;
+		counts[ncounts++] = 2000;
+		counts[ncounts++] = 5000;
+		counts[ncounts++] = 10000;
+	}
+	for (i = 0; i < ncounts; i++)
+		if (counts[i] < 1 || counts[i] > 32767)
+			usage();
+
+	frames = (struct frame *)malloc(nframes * sizeof(*frames));
+	want = (struct iax_session **)malloc(nframes * sizeof(*want));
+	got = (struct iax_session **)malloc(nframes * sizeof(*got));
+	if (!frames || !want || !got) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	iax_disable_debug();
+
+	printf("# %d frames per run, %d%% full, ns per frame\n", nframes,
+			full / 10);
+	printf("# %8s %10s %10s  %s\n", "sessions", "list", "index", "found");
+	for (i = 0; i < ncounts; i++) {
+		byindex = (struct iax_session **)malloc(counts[i] * sizeof(*byindex));
+		if (!byindex) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		for (j = 0; j < counts[i]; j++) {
+			peer_addr(&sin, j);
+			byindex[j] = iax_find_session(&sin, j + 1, 0, 1);
+			if (!byindex[j]) {
+				fprintf(stderr, "Out of memory\n");
+				return 1;
+			}
+		}
+
+		srand(seed);
+		for (k = 0; k < nframes; k++) {
+			peer = rand() % counts[i];
+			peer_addr(&frames[k].sin, peer);
+			frames[k].callno = peer + 1;
+			frames[k].dcallno = rand() % 1000 < full ?
+				byindex[peer]->callno : 0;
+		}
+
+		tl = now();
+		for (k = 0; k < nframes; k++)
+			want[k] = legacy_find(&frames[k].sin, frames[k].callno,
+					frames[k].dcallno);
+		tl = now() - tl;
+
+		th = now();
+		for (k = 0; k < nframes; k++)
+			got[k] = iax_find_session(&frames[k].sin, frames[k].callno,
+					frames[k].dcallno, 0);
+		th = now() - th;
+
+		for (bad = 0, k = 0; k < nframes; k++)
+			bad += !got[k] || want[k] != got[k];
+		mismatches += bad;
+		printf("  %8d %10.1f %10.1f  ", counts[i], tl * 1e9 / nframes,
+				th * 1e9 / nframes);
+		if (bad)
+			printf("%ld mismatches\n", bad);
+		else
+			printf("same\n");
+
+		while ((s = sessions))
+			destroy_session(s);
+		free(byindex);
+	}
+
+	free(got);
+	free(want);
+	free(frames);
+	return mismatches ? 2 : 0;
+}
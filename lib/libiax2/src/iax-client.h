@@ -118,6 +118,7 @@ struct iax_event {
 	unsigned int ts;             /* Timestamp */
 	struct iax_session *session; /* Applicable session */
 	int datalen;                 /* Length of raw data */
+	int rxstamp;                 /* When queued in the jitterbuffer, ms */
 	struct iax_ies ies;          /* IE's for IAX2 frames */
 	unsigned char data[0];       /* Raw data if applicable */
 };
@@ -141,6 +142,10 @@ extern int iax_get_fd(void);
 /* Find out how many milliseconds until the next scheduled event */
 extern int iax_time_to_next_event(void);
 
+/* Absolute time (as iax_tvnow()) of the next scheduled event, including
+ * jitterbuffer playout.  Returns 0 and fills tv, or -1 if nothing is due. */
+extern int iax_next_event_time(struct timeval *tv);
+
 /* Generate a new IAX session */
 extern struct iax_session *iax_session_new(void);
 
@@ -199,6 +204,11 @@ extern void iax_disable_debug(void);
 
 extern struct timeval iax_tvnow(void);
 
+/* Replace the clock behind iax_tvnow(), e.g. with a simulated one (see
+ * iax-netsim.h).  NULL restores gettimeofday(). */
+typedef void (*iax_clock_t)(struct timeval *tv);
+extern void iax_set_clock(iax_clock_t clock);
+
 /* For attended transfer, application create a new session,
  * make a call on the new session.
  * On answer of the new session, call iax_setup_transfer and wait for
@@ -220,6 +230,27 @@ struct iax_netstat {
 /* fills in rtt, and an iax_netstat structure for each of local/remote directions of call */
 extern int iax_get_netstats(struct iax_session *s, int *rtt, struct iax_netstat *local, struct iax_netstat *remote);
 
+/* Jitterbuffer distributions of a call, counted since it started.  Each
+ * bucket counts values from its bound up to the next one's; the last is
+ * open ended.  The counters are only ever added to, so the difference
+ * between two snapshots covers the time between them.  Like the rest of
+ * the session calls, this must not race iax_get_event(), which may
+ * destroy the session. */
+#define IAX_JB_HIST_BUCKETS 16
+
+struct iax_jb_histogram {
+	int bound[IAX_JB_HIST_BUCKETS];
+	unsigned long count[IAX_JB_HIST_BUCKETS];
+};
+
+struct iax_jb_histograms {
+	struct iax_jb_histogram delay;	/* ms voice frames waited in the jitterbuffer */
+	struct iax_jb_histogram jitter;	/* ms between the transit times of successive voice frames */
+	struct iax_jb_histogram interp;	/* frames in each run of interpolation */
+};
+
+extern int iax_get_jb_histograms(struct iax_session *s, struct iax_jb_histograms *h);
+
 
 extern void iax_set_private(struct iax_session *s, void *pvt);
 extern void *iax_get_private(struct iax_session *s);
@@ -245,6 +276,97 @@ extern int iax_pref_codec_get(struct iax_session *session, unsigned int *array,
 /* Fine tune jitterbuffer */
 extern void iax_set_jb_target_extra( long value );
 
+/* Jitterbuffer implementation, by name: "jitterbuf" (the default) or
+ * "speex" (see jb-engine.h).  iax_set_jb_engine() picks it for sessions
+ * created afterwards; iax_set_session_jb_engine() switches one session,
+ * and only while its jitterbuffer is empty.  Both return 0, or -1 if the
+ * name is unknown or the session can't switch now. */
+extern int iax_set_jb_engine(const char *name);
+extern int iax_set_session_jb_engine(struct iax_session *session, const char *name);
+
+/* Jitterbuffer playout delay and the delay it is aiming for, in ms */
+extern int iax_get_jb_delay(struct iax_session *session, long *current, long *target);
+/* Moves the jitterbuffer's playout delay by ms (negative plays out sooner)
+ * without dropping or interpolating frames, for applications that
+ * time-scale the audio they play by the same amount.  Returns 0, or -1
+ * if the session has no jitterbuffer. */
+extern int iax_jb_stretch(struct iax_session *session, long ms);
+
+/* Pull playout: with pull set, the session's jitterbuffer is no longer
+ * played out by iax_get_event(); the application calls iax_jb_pull()
+ * whenever its audio device wants more, and gets the next event the
+ * jitterbuffer has due within ahead ms (usually what the device still has
+ * queued), or NULL.  Interpolation and any other events queued in the
+ * jitterbuffer come the same way.  iax_set_jb_pull() returns 0, or -1 if
+ * the session has no jitterbuffer. */
+extern int iax_set_jb_pull(struct iax_session *session, int pull);
+extern struct iax_event *iax_jb_pull(struct iax_session *session, long ahead);
+
+/* Receive up to count datagrams per system call (recvmmsg, Linux only).
+ * Only applies when the default recvfrom is in use; 0 disables.  Datagrams
+ * are read into pooled buffers and mini voice frames with large payloads
+ * are handed up in the buffer they arrived in, so count 1 still avoids
+ * their copy; small ones are copied so the buffer is reused at once.
+ * Datagrams read ahead are returned by subsequent iax_get_event() calls,
+ * so keep calling it until it returns NULL before waiting on iax_get_fd().
+ * Returns the batch size in effect. */
+extern int iax_set_recv_batch(int count);
+
+/* Queue up to count outgoing datagrams and send them with one system call
+ * (sendmmsg, Linux only).  Frames for sessions with a replaced sendto
+ * are sent immediately.  The queue is sent when full, before a blocking
+ * iax_get_event() waits, and whenever iax_flush_tx() is called, which the
+ * application should do at the end of each processing pass.  Datagrams
+ * the socket has no room for yet stay queued, in order, for the next
+ * flush; iax_flush_tx() returns how many it sent.
+ * count <= 1 disables queueing.  Returns the queue depth in effect, or -1. */
+extern int iax_set_send_batch(int count);
+extern int iax_flush_tx(void);
+
+struct iax_tx_stats {
+	unsigned long flushes;	/* non-empty queue flushes */
+	unsigned long frames;	/* datagrams sent through the queue */
+	unsigned long syscalls;	/* sendmmsg() calls made */
+	int max_batch;		/* most datagrams sent by one flush */
+};
+extern void iax_get_tx_stats(struct iax_tx_stats *stats);
+
+/* Trunking carries the voice of all calls to one peer in a single
+ * meta-trunk datagram per tick instead of a mini frame per call.  Peers
+ * do not negotiate it in band; AUTO starts trunking a session once the
+ * peer has sent trunked voice for it. */
+#define IAX_TRUNK_OFF	0
+#define IAX_TRUNK_ON	1
+#define IAX_TRUNK_AUTO	2
+extern void iax_set_trunk(struct iax_session *session, int mode);
+
+struct iax_trunk_stats {
+	unsigned long datagrams;	/* datagrams sent from trunk buffers */
+	unsigned long frames;		/* voice frames carried by them */
+	unsigned long saved;		/* datagrams avoided, frames - datagrams */
+	unsigned long saved_per_sec;	/* datagrams avoided over the last second */
+	unsigned long rx_datagrams;	/* trunk datagrams received */
+	unsigned long rx_frames;	/* voice frames taken out of them */
+};
+extern void iax_get_trunk_stats(struct iax_trunk_stats *stats);
+
+/* Trunks go with the last call using them; this sends what they still
+ * hold and frees them all, for shutting down with calls left open. */
+extern void iax_trunk_shutdown(void);
+
+/* Events, frames and scheduler entries come from size-classed free lists */
+struct iax_pool_stats {
+	int size;		/* block size, 0 for the oversize (plain malloc) entry */
+	unsigned long hits;	/* allocations served from the free list */
+	unsigned long misses;	/* allocations that had to malloc() */
+	int inuse;		/* blocks currently allocated */
+	int highwater;		/* most blocks allocated at once */
+	int free;		/* blocks on the free list */
+};
+/* Fills up to max entries, one per size class followed by the oversize
+ * entry.  Returns the number of entries filled. */
+extern int iax_get_pool_stats(struct iax_pool_stats *stats, int max);
+
 /* Portable 'decent' random number generation */
 extern void iax_seed_random(void);
 extern int iax_random(void);
@@ -0,0 +1,371 @@
+/*
+ * libiax: An implementation of Inter-Asterisk eXchange
+ *
+ * Deterministic in-process network simulator.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#include "winpoop.h"
+#else
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "iax-client.h"
+#include "iax2.h"
+#include "iax-netsim.h"
+
+#define NETSIM_PORT	4569
+
+/* Call numbers are 15 bits */
+#define NETSIM_CALLNOS	32768
+
+/* Simulated time starts well away from zero, since libiax2 treats a zero
+   timeval as unset */
+#define NETSIM_EPOCH	1000000000LL
+
+struct netsim_packet {
+	long long when;		/* delivery time, us */
+	unsigned int seq;	/* send order, breaks ties */
+	int from;
+	int to;
+	int len;
+	unsigned char data[1];
+};
+
+static int endpoints = 0;
+static struct iax_netsim_link *links = NULL;
+static short *owner = NULL;	/* endpoint of each call number, or -1 */
+static int current = 0;
+static long long now_us = NETSIM_EPOCH * 1000000LL;
+static unsigned int rng = 1;
+static unsigned int seq = 0;
+static struct netsim_packet **queue = NULL;	/* min-heap on (when, seq) */
+static int queuelen = 0;
+static int queuesize = 0;
+static struct iax_netsim_stats stats;
+
+/* xorshift32, so runs do not depend on the C library */
+static unsigned int netsim_rand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static int netsim_chance(int permille)
+{
+	return permille > 0 && (int)(netsim_rand() % 1000) < permille;
+}
+
+static int packet_before(struct netsim_packet *a, struct netsim_packet *b)
+{
+	if (a->when != b->when)
+		return a->when < b->when;
+	return (int)(a->seq - b->seq) < 0;
+}
+
+static int queue_push(struct netsim_packet *p)
+{
+	struct netsim_packet *tmp;
+	int i;
+
+	if (queuelen == queuesize) {
+		int newsize = queuesize ? queuesize * 2 : 256;
+		struct netsim_packet **q;
+
+		q = (struct netsim_packet **)realloc(queue, newsize * sizeof(*q));
+		if (!q)
+			return -1;
+		queue = q;
+		queuesize = newsize;
+	}
+	i = queuelen++;
+	queue[i] = p;
+	while (i > 0 && packet_before(queue[i], queue[(i - 1) / 2])) {
+		tmp = queue[i];
+		queue[i] = queue[(i - 1) / 2];
+		queue[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+	return 0;
+}
+
+static struct netsim_packet *queue_pop(void)
+{
+	struct netsim_packet *top, *tmp;
+	int i = 0, c;
+
+	if (!queuelen)
+		return NULL;
+	top = queue[0];
+	queue[0] = queue[--queuelen];
+	for (;;) {
+		c = 2 * i + 1;
+		if (c >= queuelen)
+			break;
+		if (c + 1 < queuelen && packet_before(queue[c + 1], queue[c]))
+			c++;
+		if (!packet_before(queue[c], queue[i]))
+			break;
+		tmp = queue[i];
+		queue[i] = queue[c];
+		queue[c] = tmp;
+		i = c;
+	}
+	return top;
+}
+
+/* Source call number of a datagram, or -1 if it has none we can use */
+static int netsim_callno(const unsigned char *buf, int len)
+{
+	const struct ast_iax2_meta_hdr *meta = (const struct ast_iax2_meta_hdr *)buf;
+	int callno;
+
+	if (len < 4)
+		return -1;
+	callno = (buf[0] << 8) | buf[1];
+	if (callno)
+		return callno & ~IAX_FLAG_FULL;
+
+	/* Meta frames: video carries a call number, trunks carry entries */
+	if (buf[2] & 0x80)
+		return ((buf[2] << 8) | buf[3]) & 0x7FFF;
+	if (meta->metacmd != IAX_META_TRUNK)
+		return -1;
+	if (meta->cmddata == IAX_META_TRUNK_MINI) {
+		if (len < 12)
+			return -1;
+		return (buf[10] << 8) | buf[11];
+	}
+	if (len < 10)
+		return -1;
+	return (buf[8] << 8) | buf[9];
+}
+
+static int netsim_endpoint(const struct sockaddr_in *sin)
+{
+	unsigned int a = ntohl(sin->sin_addr.s_addr);
+
+	if ((a & 0xFFFFFF00) != 0x0A000000 || ntohs(sin->sin_port) != NETSIM_PORT)
+		return -1;
+	a &= 0xFF;
+	if (a < 1 || (int)a > endpoints)
+		return -1;
+	return a - 1;
+}
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+static int PASCAL netsim_sendto(SOCKET fd, const char *buf, int len, int flags,
+		const struct sockaddr *to, int tolen)
+#else
+static int netsim_sendto(int fd, const void *buf, size_t len, int flags,
+		const struct sockaddr *to, socklen_t tolen)
+#endif
+{
+	struct iax_netsim_link *link;
+	struct netsim_packet *p;
+	int from, dest, callno, copies, i;
+
+	(void)fd;
+	(void)flags;
+	(void)tolen;
+	stats.sent++;
+
+	callno = netsim_callno((const unsigned char *)buf, (int)len);
+	if (callno >= 0) {
+		if (owner[callno] < 0)
+			owner[callno] = (short)current;
+		from = owner[callno];
+	} else
+		from = current;
+
+	dest = netsim_endpoint((const struct sockaddr_in *)to);
+	if (dest < 0) {
+		stats.unroutable++;
+		return (int)len;
+	}
+
+	link = &links[from * endpoints + dest];
+	if (netsim_chance(link->loss)) {
+		stats.lost++;
+		return (int)len;
+	}
+
+	copies = 1;
+	if (netsim_chance(link->duplicate)) {
+		stats.duplicated++;
+		copies = 2;
+	}
+
+	for (i = 0; i < copies; i++) {
+		p = (struct netsim_packet *)malloc(sizeof(*p) + len);
+		if (!p)
+			break;
+		p->when = now_us + link->delay * 1000LL;
+		if (link->jitter > 0)
+			p->when += (netsim_rand() % (link->jitter + 1)) * 1000LL;
+		if (netsim_chance(link->reorder)) {
+			stats.reordered++;
+			p->when += link->reorder_delay * 1000LL;
+		}
+		p->seq = seq++;
+		p->from = from;
+		p->to = dest;
+		p->len = (int)len;
+		memcpy(p->data, buf, len);
+		if (queue_push(p) < 0) {
+			free(p);
+			break;
+		}
+	}
+	return (int)len;
+}
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+static int PASCAL netsim_recvfrom(SOCKET fd, char *buf, int len, int flags,
+		struct sockaddr *from, int *fromlen)
+#else
+static int netsim_recvfrom(int fd, void *buf, size_t len, int flags,
+		struct sockaddr *from, socklen_t *fromlen)
+#endif
+{
+	struct netsim_packet *p;
+	int res;
+
+	(void)fd;
+	(void)flags;
+
+	if (!queuelen || queue[0]->when > now_us) {
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+		WSASetLastError(WSAEWOULDBLOCK);
+#else
+		errno = EAGAIN;
+#endif
+		return -1;
+	}
+
+	p = queue_pop();
+	res = p->len < (int)len ? p->len : (int)len;
+	memcpy(buf, p->data, res);
+	if (from && fromlen && *fromlen >= (int)sizeof(struct sockaddr_in)) {
+		iax_netsim_addr(p->from, (struct sockaddr_in *)from);
+		*fromlen = sizeof(struct sockaddr_in);
+	}
+	/* Anything sent while this is processed comes from its receiver */
+	current = p->to;
+	stats.delivered++;
+	free(p);
+	return res;
+}
+
+static void netsim_clock(struct timeval *tv)
+{
+	tv->tv_sec = (long)(now_us / 1000000);
+	tv->tv_usec = (long)(now_us % 1000000);
+}
+
+int iax_netsim_init(int count, unsigned int seed)
+{
+	int i;
+
+	if (count < 1 || count > IAX_NETSIM_MAX_ENDPOINTS)
+		return -1;
+
+	iax_netsim_destroy();
+	links = (struct iax_netsim_link *)calloc(count * count, sizeof(*links));
+	owner = (short *)malloc(NETSIM_CALLNOS * sizeof(*owner));
+	if (!links || !owner) {
+		iax_netsim_destroy();
+		return -1;
+	}
+	for (i = 0; i < NETSIM_CALLNOS; i++)
+		owner[i] = -1;
+	endpoints = count;
+	current = 0;
+	now_us = NETSIM_EPOCH * 1000000LL;
+	rng = seed ? seed : 1;
+	seq = 0;
+	memset(&stats, 0, sizeof(stats));
+
+	iax_set_networking((iax_sendto_t)netsim_sendto, (iax_recvfrom_t)netsim_recvfrom);
+	iax_set_clock(netsim_clock);
+	return 0;
+}
+
+void iax_netsim_destroy(void)
+{
+	while (queuelen)
+		free(queue_pop());
+	free(queue);
+	queue = NULL;
+	queuesize = 0;
+	free(links);
+	links = NULL;
+	free(owner);
+	owner = NULL;
+	if (endpoints) {
+		iax_set_networking((iax_sendto_t)sendto, (iax_recvfrom_t)recvfrom);
+		iax_set_clock(NULL);
+	}
+	endpoints = 0;
+}
+
+void iax_netsim_set_link(int from, int to, const struct iax_netsim_link *link)
+{
+	int i, j;
+
+	for (i = 0; i < endpoints; i++) {
+		if (from >= 0 && i != from)
+			continue;
+		for (j = 0; j < endpoints; j++) {
+			if (to >= 0 && j != to)
+				continue;
+			links[i * endpoints + j] = *link;
+		}
+	}
+}
+
+void iax_netsim_addr(int endpoint, struct sockaddr_in *sin)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0A000000 | (endpoint + 1));
+	sin->sin_port = htons(NETSIM_PORT);
+}
+
+void iax_netsim_select(int endpoint)
+{
+	if (endpoint >= 0 && endpoint < endpoints)
+		current = endpoint;
+}
+
+void iax_netsim_advance(int ms)
+{
+	now_us += ms * 1000LL;
+}
+
+int iax_netsim_next_delivery(void)
+{
+	if (!queuelen)
+		return -1;
+	if (queue[0]->when <= now_us)
+		return 0;
+	return (int)((queue[0]->when - now_us + 999) / 1000);
+}
+
+void iax_netsim_get_stats(struct iax_netsim_stats *s)
+{
+	*s = stats;
+}
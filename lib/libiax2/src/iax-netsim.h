@@ -0,0 +1,70 @@
+/*
+ * libiax: An implementation of Inter-Asterisk eXchange
+ *
+ * Deterministic in-process network simulator.  Replaces libiax2's
+ * networking and clock so that several endpoints in one process can call
+ * each other over links with configurable delay, jitter, loss,
+ * reordering and duplication, in simulated time.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _IAX_NETSIM_H
+#define _IAX_NETSIM_H
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#include "winpoop.h"
+#else
+#include <sys/types.h>
+#include <netinet/in.h>
+#endif
+
+/* Endpoint n (from 0) has address 10.0.0.(n + 1), port 4569 */
+#define IAX_NETSIM_MAX_ENDPOINTS	250
+
+/* Impairments of one direction of a link.  Chances are per mille. */
+struct iax_netsim_link {
+	int delay;		/* one way delay, ms */
+	int jitter;		/* extra delay, uniform over 0..jitter ms */
+	int loss;		/* chance a datagram is lost */
+	int reorder;		/* chance a datagram is held back by reorder_delay */
+	int reorder_delay;	/* ms */
+	int duplicate;		/* chance a datagram is delivered twice */
+};
+
+struct iax_netsim_stats {
+	unsigned long sent;		/* datagrams handed to the simulator */
+	unsigned long delivered;	/* datagrams returned by recvfrom */
+	unsigned long lost;
+	unsigned long reordered;
+	unsigned long duplicated;
+	unsigned long unroutable;	/* not addressed to an endpoint */
+};
+
+/* Installs the simulator as libiax2's networking and clock, with the
+ * given number of endpoints and perfect links.  Use it instead of
+ * iax_init().  The same seed gives the same run.  Returns 0 or -1. */
+extern int iax_netsim_init(int endpoints, unsigned int seed);
+/* Frees queued datagrams and restores the real network and clock */
+extern void iax_netsim_destroy(void);
+
+/* Sets the link from one endpoint to another; -1 means every endpoint */
+extern void iax_netsim_set_link(int from, int to, const struct iax_netsim_link *link);
+extern void iax_netsim_addr(int endpoint, struct sockaddr_in *sin);
+
+/* libiax2 has a single socket, so the simulator tells endpoints apart by
+ * the source call number of each datagram.  A call number is bound to
+ * an endpoint the first time it sends: to the endpoint of the datagram
+ * being received at the time, otherwise to the one last selected here.
+ * Select the calling endpoint before starting each outgoing call. */
+extern void iax_netsim_select(int endpoint);
+
+/* Simulated time.  The clock only moves when advanced. */
+extern void iax_netsim_advance(int ms);
+/* ms until the next datagram is deliverable, 0 if one is, -1 if none */
+extern int iax_netsim_next_delivery(void);
+
+extern void iax_netsim_get_stats(struct iax_netsim_stats *stats);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * libiax: An implementation of Inter-Asterisk eXchange
+ *
+ * Size-classed free-list allocator for per-packet objects
+ * (events, frames, scheduler entries).
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#include "winpoop.h"
+#else
+#include <sys/types.h>
+#include <netinet/in.h>
+#endif
+
+#include "iax-pool.h"
+#include "iax-client.h"
+
+/* Precedes every block.  While the block is free it links the class
+   free list; the union keeps the payload aligned as malloc() would. */
+typedef union iax_pool_block {
+	struct {
+		union iax_pool_block *next;
+		int cls;		/* size class, -1 for oversize blocks */
+	} h;
+	long double align;
+} iax_pool_block;
+
+struct iax_pool_class {
+	iax_pool_block *free;
+	struct iax_pool_stats stats;
+};
+
+static struct iax_pool_class pools[IAX_POOL_CLASSES];
+static struct iax_pool_stats oversize;
+
+static int pool_class(size_t size)
+{
+	size_t bsize = (size_t)1 << IAX_POOL_MIN_SHIFT;
+	int cls = 0;
+
+	while (bsize < size) {
+		if (++cls == IAX_POOL_CLASSES)
+			return -1;
+		bsize <<= 1;
+	}
+	return cls;
+}
+
+void *iax_pool_alloc(size_t size)
+{
+	iax_pool_block *b;
+	struct iax_pool_stats *st;
+	int cls = pool_class(size);
+
+	if (cls < 0) {
+		st = &oversize;
+		b = (iax_pool_block *)malloc(sizeof(*b) + size);
+		st->misses++;
+	} else {
+		st = &pools[cls].stats;
+		b = pools[cls].free;
+		if (b) {
+			pools[cls].free = b->h.next;
+			st->free--;
+			st->hits++;
+		} else {
+			b = (iax_pool_block *)malloc(sizeof(*b) +
+					((size_t)1 << (IAX_POOL_MIN_SHIFT + cls)));
+			st->misses++;
+		}
+	}
+	if (!b)
+		return NULL;
+
+	b->h.cls = cls;
+	b->h.next = NULL;
+	if (++st->inuse > st->highwater)
+		st->highwater = st->inuse;
+	return b + 1;
+}
+
+void *iax_pool_calloc(size_t size)
+{
+	void *p = iax_pool_alloc(size);
+
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+void iax_pool_free(void *ptr)
+{
+	iax_pool_block *b;
+	struct iax_pool_class *pc;
+
+	if (!ptr)
+		return;
+	b = (iax_pool_block *)ptr - 1;
+
+	if (b->h.cls < 0) {
+		oversize.inuse--;
+		free(b);
+		return;
+	}
+
+	pc = &pools[b->h.cls];
+	pc->stats.inuse--;
+	if (pc->stats.free >= IAX_POOL_MAX_FREE) {
+		free(b);
+		return;
+	}
+	b->h.next = pc->free;
+	pc->free = b;
+	pc->stats.free++;
+}
+
+int iax_get_pool_stats(struct iax_pool_stats *stats, int max)
+{
+	int i;
+
+	for (i = 0; i < IAX_POOL_CLASSES && i < max; i++) {
+		stats[i] = pools[i].stats;
+		stats[i].size = 1 << (IAX_POOL_MIN_SHIFT + i);
+	}
+	if (i < max) {
+		stats[i] = oversize;
+		stats[i].size = 0;
+		i++;
+	}
+	return i;
+}
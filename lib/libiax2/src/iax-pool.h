@@ -0,0 +1,30 @@
+/*
+ * libiax: An implementation of Inter-Asterisk eXchange
+ *
+ * Size-classed free-list allocator for per-packet objects
+ * (events, frames, scheduler entries).
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _IAX_POOL_H
+#define _IAX_POOL_H
+
+#include <stddef.h>
+
+/* Blocks are rounded up to a power of two between these sizes.  Larger
+   requests fall through to malloc() but are still released with
+   iax_pool_free(). */
+#define IAX_POOL_MIN_SHIFT	6	/* 64 bytes */
+#define IAX_POOL_CLASSES	8	/* up to 8 KB */
+
+/* Free blocks kept per class; surplus is returned to the heap */
+#define IAX_POOL_MAX_FREE	512
+
+/* Like libiax2 itself these are not thread safe */
+void *iax_pool_alloc(size_t size);
+void *iax_pool_calloc(size_t size);
+void iax_pool_free(void *ptr);
+
+#endif
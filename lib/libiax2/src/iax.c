@@ -14,6 +14,10 @@
 #include "config.h"
 #endif
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* recvmmsg(), sendmmsg() */
+#endif
+
 #if defined(WIN32)  ||  defined(_WIN32_WCE)
 #undef __STRICT_ANSI__ //for strdup with ms
 #include "winpoop.h"
@@ -107,6 +111,13 @@
 #include <arpa/inet.h>
 #include <time.h>
 
+/* Windows sends these to the debugger; here they follow iax_enable_debug() */
+#define IAX_LOG(fmt, ...)                                                      \
+    do {                                                                       \
+      if (debug)                                                               \
+        fprintf(stderr, "[iax-debug] " fmt "\n", ##__VA_ARGS__);               \
+    } while(0)
+
 // FlightGear: Modified to include FreeBSD
 #if !defined(MACOSX) && !defined(__OpenBSD__) && !defined(__FreeBSD__)
 #include <malloc.h>
@@ -121,7 +132,9 @@
 #endif
 
 #include "jitterbuf.h"
+#include "jb-engine.h"
 #include "iax-client.h"
+#include "iax-pool.h"
 #include "md5.h"
 
 /* Define socket options for IAX2 sockets, based on platform
@@ -155,6 +168,49 @@
 #define MAX_RETRY_TIME 4000
 #define MEMORY_SIZE 1000
 
+/* Batched receive (recvmmsg) is only available on Linux */
+#if defined(__linux__) && !defined(IAX_NO_RECVMMSG)
+#define IAX_HAVE_RECVMMSG 1
+#endif
+
+/* Most datagrams a single recvmmsg() may return, and the size of each
+   receive slot (a pool block), an Ethernet MTU and the headroom below
+   rounded up to a pool class.  Datagrams that do not fit after the
+   headroom are truncated by the kernel and dropped. */
+#define IAX_RECV_BATCH_MAX 64
+#define IAX_RECV_SLOT_SIZE 2048
+
+/* Datagrams are received this far into their slot, so that a mini voice
+   frame's payload lands exactly on iax_event.data and the slot can be
+   handed up as the event without copying */
+#define IAX_RECV_HEADROOM (offsetof(struct iax_event, data) - sizeof(struct ast_iax2_mini_hdr))
+
+/* Events a smaller pool block holds are copied out of their slot
+   instead, which is then reused at once: a slot queued in the
+   jitterbuffer for a frame of voice would pin several times its size */
+#define IAX_RECV_COPY_MAX (IAX_RECV_SLOT_SIZE / 2)
+
+/* Kernel receive timestamps (SO_TIMESTAMPNS), likewise */
+#if defined(__linux__) && defined(SO_TIMESTAMPNS) && !defined(IAX_NO_RX_TIMESTAMPS)
+#define IAX_HAVE_RX_TIMESTAMPS 1
+#define IAX_RX_CMSG_SIZE CMSG_SPACE(sizeof(struct timespec))
+#endif
+
+/* Batched transmit (sendmmsg) likewise */
+#if defined(__linux__) && !defined(IAX_NO_SENDMMSG)
+#define IAX_HAVE_SENDMMSG 1
+#endif
+
+/* Transmit queue depth limit and slot size; larger frames bypass the queue */
+#define IAX_SEND_BATCH_MAX 64
+#define IAX_SEND_SLOT_SIZE 2048
+
+/* Largest trunk datagram we build, and how often (ms) pending trunk
+   datagrams are sent.  Same defaults as Asterisk. */
+#define IAX_TRUNK_MTU 1240
+#define IAX_TRUNK_TICK 20
+#define IAX_TRUNK_HDRLEN (sizeof(struct ast_iax2_meta_hdr) + sizeof(struct ast_iax2_meta_trunk_hdr))
+
 #define TRANSFER_NONE  0
 #define TRANSFER_BEGIN 1
 #define TRANSFER_READY 2
@@ -174,15 +230,99 @@ static const int maxretries = 10;
 
 /* configurable jitterbuffer options */
 static long jb_target_extra = -1;
+static const jb_engine *jb_default_engine = &jb_engine_default;
 
 /* external global networking replacements */
 static iax_sendto_t   iax_sendto = (iax_sendto_t) sendto;
 static iax_recvfrom_t iax_recvfrom = (iax_recvfrom_t) recvfrom;
 
+/* external clock replacement, see iax_set_clock() */
+static iax_clock_t iax_clock = NULL;
+
+#ifdef IAX_HAVE_RECVMMSG
+/* Batched receive state.  recv_next..recv_count are datagrams read by the
+   last recvmmsg() that have not been processed yet. */
+static int recv_batch = 0;
+static int recv_count = 0;
+static int recv_next = 0;
+static unsigned char *recv_slots[IAX_RECV_BATCH_MAX];
+static struct mmsghdr recv_msgs[IAX_RECV_BATCH_MAX];
+static struct iovec recv_iov[IAX_RECV_BATCH_MAX];
+static struct sockaddr_in recv_addrs[IAX_RECV_BATCH_MAX];
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+static union {
+	char buf[IAX_RX_CMSG_SIZE];
+	struct cmsghdr align;
+} recv_cmsgs[IAX_RECV_BATCH_MAX];
+#endif
+#endif
+
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+/* Set once the socket delivers receive timestamps */
+static int rx_timestamps = 0;
+#endif
+/* When the kernel received the datagram being processed, if known.
+   calc_rxstamp() prefers it to the time we got round to reading it. */
+static struct timeval rx_stamp;
+static int rx_stamp_valid = 0;
+
+#ifdef IAX_HAVE_SENDMMSG
+/* Transmit queue, flushed by iax_flush_tx() or when full.  A single FIFO,
+   so frames leave in the order they were produced. */
+static int send_batch = 0;
+static int send_count = 0;
+static unsigned char *send_bufs = NULL;
+static struct mmsghdr send_msgs[IAX_SEND_BATCH_MAX];
+static struct iovec send_iov[IAX_SEND_BATCH_MAX];
+static struct sockaddr_in send_addrs[IAX_SEND_BATCH_MAX];
+#endif
+static struct iax_tx_stats tx_stats;
+
+/* Trunk state for one peer address.  Only sessions create trunks, and
+   each goes with the last session pointing at it, so a peer cannot make
+   us keep state by sending trunk datagrams alone. */
+struct iax_trunk {
+	struct sockaddr_in addr;
+	/* Session pointers to it, see iax_trunk_ref() */
+	int refs;
+	/* Trunk timestamps we send count from here */
+	struct timeval txtrunktime;
+	/* Local time of the peer's trunk timestamp 0 */
+	struct timeval rxtrunktime;
+	/* Pending datagram: meta and trunk headers, then entries */
+	iax_sendto_t sendto;
+	unsigned char buf[IAX_TRUNK_MTU];
+	int len;
+	int entries;
+	/* Calls that sent voice during the last tick; once that many entries
+	   are pending the datagram goes out without waiting for the tick */
+	int expect;
+	int calls;
+	/* Bumped on every send, see iax_session.trunkflush */
+	unsigned int flushes;
+	struct iax_trunk *next;
+};
+
+static struct iax_trunk *trunks = NULL;
+static int trunk_tick_pending = 0;
+static unsigned int trunk_ticks = 1;
+static struct iax_trunk_stats trunk_stats;
+/* saved_per_sec is measured from here */
+static struct timeval trunk_rate_start;
+static unsigned long trunk_rate_saved;
+
 /* ping interval (seconds) */
 static int ping_time = 10;
 static void send_ping(void *session);
 
+/* histograms of struct iax_jb_histograms */
+enum {
+	JB_HIST_DELAY,
+	JB_HIST_JITTER,
+	JB_HIST_INTERP,
+	JB_HIST_COUNT
+};
+
 struct iax_session {
 	/* Private data */
 	void *pvt;
@@ -218,6 +358,13 @@ struct iax_session {
 #endif
 	/* Our last measured ping time */
 	unsigned int pingtime;
+	/* Retransmission timeout (ms) once we have RTT samples, else 0.
+	   srtt is kept scaled by 8 and rttvar by 4, as in BSD TCP. */
+	int srtt;
+	int rttvar;
+	int rto;
+	/* Reliable frames not yet acknowledged, indexed by oseqno */
+	struct iax_frame *rtxwin[256];
 	/* Address of peer */
 	struct sockaddr_in peeraddr;
 	/* Explicit port to use for peer (for consistent port usage) */
@@ -251,8 +398,8 @@ struct iax_session {
 	/* Refresh if applicable */
 	int refresh;
 
-	/* ping scheduler id */
-	int pingid;
+	/* pending ping, NULL while none is scheduled */
+	struct iax_sched *ping;
 
 	/* Transfer stuff */
 	struct sockaddr_in transfer;
@@ -262,12 +409,43 @@ struct iax_session {
 	int transferpeer;	/* for attended transfer */
 	int transfer_moh;	/* for music on hold while performing attended transfer */
 
-	jitterbuf *jb;
+	const jb_engine *jbe;
+	void *jb;
+	/* When the jitterbuffer next has something to play, and our place in
+	   playheap: -1 while it has nothing, PLAY_DEFERRED while on playdefer */
+	struct timeval playdue;
+	int playslot;
+	struct iax_session *playnext;
+	/* Played out by iax_jb_pull() rather than iax_get_event() */
+	int jbpull;
+
+	/* see iax_get_jb_histograms() */
+	unsigned long jbhist[JB_HIST_COUNT][IAX_JB_HIST_BUCKETS];
+	int lasttransit;
+	int havetransit;
+	int interprun;
 
 	struct iax_netstat remote_netstats;
 
 	/* For linking if there are multiple connections */
 	struct iax_session *next;
+
+	/* Trunking mode (IAX_TRUNK_*), and whether the peer trunks to us */
+	int trunkmode;
+	int peertrunks;
+	/* Trunk our voice currently goes through, and the one the peer's
+	   comes in on; both counted in their refs */
+	struct iax_trunk *trunk;
+	struct iax_trunk *rxtrunk;
+	/* trunk->flushes + 1 while we have an entry pending in it */
+	unsigned int trunkflush;
+	/* Last trunk_ticks value we were counted in trunk->calls */
+	unsigned int trunktick;
+
+	/* Session index chains, see session_link() */
+	struct iax_session *callno_next;
+	struct iax_session *peer_next;
+	struct iax_session *ptr_next;
 };
 
 char iax_errstr[256];
@@ -402,14 +580,119 @@ struct iax_sched {
 	sched_func func;
 	/* and pass it this argument */
 	void *arg;
-	/* Easy linking */
-	struct iax_sched *next;
+	/* Insertion order, breaks ties between equal deadlines (FIFO) */
+	unsigned int seq;
+	/* Where it is in schedheap, so it can be cancelled without a search */
+	int slot;
 };
 
-static struct iax_sched *schedq = NULL;
+/* Pending scheduler entries, kept as a binary min-heap ordered on
+   (when, seq) so the next deadline is always schedheap[0] */
+static struct iax_sched **schedheap = NULL;
+static int schedlen = 0;
+static int schedsize = 0;
+static unsigned int schedseq = 0;
 static struct iax_session *sessions = NULL;
+static int nsessions = 0;
+
+/* Sessions whose jitterbuffer holds something to play, kept as a binary
+   min-heap ordered on playdue so iax_get_event() visits only those that
+   are due.  Sized for every session, so arming one never allocates. */
+static struct iax_session **playheap = NULL;
+static int playlen = 0;
+static int playsize = 0;
+/* Sessions already visited by this iax_get_event() and still due, put
+   back on playheap when it returns */
+#define PLAY_DEFERRED -2
+static struct iax_session *playdefer = NULL;
 static int callnums = 1;
 
+/* Session indexes.  Incoming frames are resolved through these instead
+   of walking the session list:
+     callno_hash - by our call number (unique), for forward matches
+     peer_hash   - by the peer's call number; the peer or transfer address
+                   is checked by reverse_match() on the (short) chain
+     ptr_hash    - by session pointer, for iax_session_valid() */
+#ifndef IAX_SESSION_HASH
+#define IAX_SESSION_HASH 4096	/* must be a power of 2 */
+#endif
+#define SESSION_BUCKET(n) ((unsigned int)(n) & (IAX_SESSION_HASH - 1))
+#define SESSION_PTR_BUCKET(p) SESSION_BUCKET((size_t)(p) / sizeof(struct iax_session *))
+
+static struct iax_session *callno_hash[IAX_SESSION_HASH];
+static struct iax_session *peer_hash[IAX_SESSION_HASH];
+static struct iax_session *ptr_hash[IAX_SESSION_HASH];
+
+static void session_link(struct iax_session *s)
+{
+	unsigned int b;
+
+	b = SESSION_BUCKET(s->callno);
+	s->callno_next = callno_hash[b];
+	callno_hash[b] = s;
+	b = SESSION_BUCKET(s->peercallno);
+	s->peer_next = peer_hash[b];
+	peer_hash[b] = s;
+	b = SESSION_PTR_BUCKET(s);
+	s->ptr_next = ptr_hash[b];
+	ptr_hash[b] = s;
+}
+
+static void session_unlink_peer(struct iax_session *s)
+{
+	struct iax_session **pp;
+
+	for (pp = &peer_hash[SESSION_BUCKET(s->peercallno)]; *pp; pp = &(*pp)->peer_next) {
+		if (*pp == s) {
+			*pp = s->peer_next;
+			break;
+		}
+	}
+}
+
+static void session_unlink(struct iax_session *s)
+{
+	struct iax_session **pp;
+
+	for (pp = &callno_hash[SESSION_BUCKET(s->callno)]; *pp; pp = &(*pp)->callno_next) {
+		if (*pp == s) {
+			*pp = s->callno_next;
+			break;
+		}
+	}
+	session_unlink_peer(s);
+	for (pp = &ptr_hash[SESSION_PTR_BUCKET(s)]; *pp; pp = &(*pp)->ptr_next) {
+		if (*pp == s) {
+			*pp = s->ptr_next;
+			break;
+		}
+	}
+}
+
+/* All changes of peercallno must go through here to keep peer_hash valid */
+static void session_set_peercallno(struct iax_session *s, int peercallno)
+{
+	unsigned int b;
+
+	if (s->peercallno == peercallno)
+		return;
+	session_unlink_peer(s);
+	s->peercallno = peercallno;
+	b = SESSION_BUCKET(peercallno);
+	s->peer_next = peer_hash[b];
+	peer_hash[b] = s;
+}
+
+static struct iax_session *session_by_callno(int callno)
+{
+	struct iax_session *cur;
+
+	for (cur = callno_hash[SESSION_BUCKET(callno)]; cur; cur = cur->callno_next)
+		if (cur->callno == callno)
+			return cur;
+	return NULL;
+}
+
 unsigned int iax_session_get_capability(struct iax_session *s)
 {
 	return s->capability;
@@ -423,20 +706,105 @@ static int inaddrcmp(struct sockaddr_in *sin1, struct sockaddr_in *sin2)
 	return (sin1->sin_addr.s_addr != sin2->sin_addr.s_addr);
 }
 
-static int iax_sched_add(struct iax_event *event, struct iax_frame *frame, sched_func func, void *arg, int ms)
+static int sched_before(struct iax_sched *a, struct iax_sched *b)
+{
+	if (a->when.tv_sec != b->when.tv_sec)
+		return a->when.tv_sec < b->when.tv_sec;
+	if (a->when.tv_usec != b->when.tv_usec)
+		return a->when.tv_usec < b->when.tv_usec;
+	/* seq wraps, compare as a signed distance */
+	return (int)(a->seq - b->seq) < 0;
+}
+
+static void sched_sift_up(int i)
+{
+	struct iax_sched *s = schedheap[i];
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!sched_before(s, schedheap[parent]))
+			break;
+		schedheap[i] = schedheap[parent];
+		schedheap[i]->slot = i;
+		i = parent;
+	}
+	schedheap[i] = s;
+	s->slot = i;
+}
+
+static void sched_sift_down(int i)
+{
+	struct iax_sched *s = schedheap[i];
+
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= schedlen)
+			break;
+		if (child + 1 < schedlen && sched_before(schedheap[child + 1], schedheap[child]))
+			child++;
+		if (!sched_before(schedheap[child], s))
+			break;
+		schedheap[i] = schedheap[child];
+		schedheap[i]->slot = i;
+		i = child;
+	}
+	schedheap[i] = s;
+	s->slot = i;
+}
+
+/* Take entry i out of the heap; the caller owns it afterwards */
+static struct iax_sched *sched_remove(int i)
+{
+	struct iax_sched *s = schedheap[i];
+
+	schedlen--;
+	if (i != schedlen) {
+		schedheap[i] = schedheap[schedlen];
+		if (i > 0 && sched_before(schedheap[i], schedheap[(i - 1) / 2]))
+			sched_sift_up(i);
+		else
+			sched_sift_down(i);
+	}
+	return s;
+}
+
+/* Restore heap order after entries were dropped in place */
+static void sched_heapify(void)
+{
+	int i;
+
+	for (i = schedlen / 2 - 1; i >= 0; i--)
+		sched_sift_down(i);
+}
+
+/* Returns the entry, for iax_sched_del(), or NULL if it could not be added */
+static struct iax_sched *iax_sched_add(struct iax_event *event, struct iax_frame *frame, sched_func func, void *arg, int ms)
 {
 
 	/* Schedule event to be delivered to the client
 	   in ms milliseconds from now, or a reliable frame to be retransmitted */
-	struct iax_sched *sched, *cur, *prev = NULL;
+	struct iax_sched *sched;
 
 	if (!event && !frame && !func) {
 		DEBU(G "No event, no frame, no func?  what are we scheduling?\n");
-		return -1;
+		return NULL;
+	}
+
+	if (schedlen == schedsize) {
+		int newsize = schedsize ? schedsize * 2 : 64;
+		struct iax_sched **tmp;
+
+		tmp = (struct iax_sched **)realloc(schedheap, newsize * sizeof(*tmp));
+		if (!tmp) {
+			DEBU(G "Out of memory!\n");
+			return NULL;
+		}
+		schedheap = tmp;
+		schedsize = newsize;
 	}
 
 	//fprintf(stderr, "scheduling event %d ms from now\n", ms);
-	sched = (struct iax_sched*)malloc(sizeof(struct iax_sched));
+	sched = (struct iax_sched*)iax_pool_alloc(sizeof(struct iax_sched));
 	if (sched) {
 		memset(sched, 0, sizeof(struct iax_sched));
 		sched->when = iax_tvnow();
@@ -451,72 +819,226 @@ static int iax_sched_add(struct iax_event *event, struct iax_frame *frame, sched
 		sched->frame = frame;
 		sched->func = func;
 		sched->arg = arg;
-		/* Put it in the list, in order */
-		cur = schedq;
-		while(cur && ((cur->when.tv_sec < sched->when.tv_sec) ||
-					 ((cur->when.tv_usec <= sched->when.tv_usec) &&
-					  (cur->when.tv_sec == sched->when.tv_sec)))) {
-				prev = cur;
-				cur = cur->next;
-		}
-		sched->next = cur;
-		if (prev) {
-			prev->next = sched;
-		} else {
-			schedq = sched;
-		}
-		return 0;
+		sched->seq = schedseq++;
+		schedheap[schedlen] = sched;
+		sched_sift_up(schedlen++);
+		return sched;
 	} else {
 		DEBU(G "Out of memory!\n");
-		return -1;
+		return NULL;
 	}
 }
 
-static int iax_sched_del(struct iax_event *event, struct iax_frame *frame, sched_func func, void *arg, int all)
+/* Cancel an entry iax_sched_add() returned that has not run yet */
+static void iax_sched_del(struct iax_sched *sched)
 {
-	struct iax_sched *cur, *tmp, *prev = NULL;
+	iax_pool_free(sched_remove(sched->slot));
+}
 
-	cur = schedq;
-	while (cur) {
-		if (cur->event == event && cur->frame == frame && cur->func == func && cur->arg == arg) {
-			if (prev)
-				prev->next = cur->next;
-			else
-				schedq = cur->next;
-			tmp = cur;
-			cur = cur->next;
-			free(tmp);
-			if (!all)
-				return -1;
-		} else {
-			prev = cur;
-			cur = cur->next;
+static void cancel_ping(struct iax_session *session)
+{
+	if (session->ping) {
+		iax_sched_del(session->ping);
+		session->ping = NULL;
+	}
+}
+
+/* (Re)arm the session's ping for ms from now */
+static void schedule_ping(struct iax_session *session, int ms)
+{
+	cancel_ping(session);
+	session->ping = iax_sched_add(NULL, NULL, send_ping, (void *)session, ms);
+}
+
+
+static const int jb_hist_bounds[JB_HIST_COUNT][IAX_JB_HIST_BUCKETS] = {
+	/* JB_HIST_DELAY */
+	{ 0, 10, 20, 30, 40, 50, 60, 80, 100, 120, 150, 200, 300, 400, 600, 1000 },
+	/* JB_HIST_JITTER */
+	{ 0, 2, 4, 6, 8, 10, 15, 20, 30, 40, 60, 80, 100, 150, 200, 500 },
+	/* JB_HIST_INTERP */
+	{ 1, 2, 3, 4, 5, 6, 8, 10, 15, 20, 30, 50, 100, 200, 500, 1000 },
+};
+
+static void jb_hist_add(struct iax_session *s, int hist, int value)
+{
+	const int *bound = jb_hist_bounds[hist];
+	int i = IAX_JB_HIST_BUCKETS - 1;
+
+	while (i > 0 && value < bound[i])
+		i--;
+	s->jbhist[hist][i]++;
+}
+
+static int tv_before(const struct timeval *a, const struct timeval *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_usec < b->tv_usec;
+}
+
+static void play_sift_up(int i)
+{
+	struct iax_session *s = playheap[i];
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!tv_before(&s->playdue, &playheap[parent]->playdue))
+			break;
+		playheap[i] = playheap[parent];
+		playheap[i]->playslot = i;
+		i = parent;
+	}
+	playheap[i] = s;
+	s->playslot = i;
+}
+
+static void play_sift_down(int i)
+{
+	struct iax_session *s = playheap[i];
+
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= playlen)
+			break;
+		if (child + 1 < playlen &&
+		    tv_before(&playheap[child + 1]->playdue, &playheap[child]->playdue))
+			child++;
+		if (!tv_before(&playheap[child]->playdue, &s->playdue))
+			break;
+		playheap[i] = playheap[child];
+		playheap[i]->playslot = i;
+		i = child;
+	}
+	playheap[i] = s;
+	s->playslot = i;
+}
+
+static void play_disarm(struct iax_session *s)
+{
+	struct iax_session **pp;
+	int i = s->playslot;
+
+	if (i == PLAY_DEFERRED) {
+		for (pp = &playdefer; *pp; pp = &(*pp)->playnext) {
+			if (*pp == s) {
+				*pp = s->playnext;
+				break;
+			}
 		}
+		s->playslot = -1;
+		return;
+	}
+	if (i < 0)
+		return;
+	s->playslot = -1;
+	playlen--;
+	if (i != playlen) {
+		playheap[i] = playheap[playlen];
+		if (i > 0 && tv_before(&playheap[i]->playdue, &playheap[(i - 1) / 2]->playdue))
+			play_sift_up(i);
+		else
+			play_sift_down(i);
+	}
+}
+
+/* Re-read the session's jitterbuffer deadline after anything that may have
+   moved it */
+static void play_arm(struct iax_session *s)
+{
+	struct timeval when;
+	long next;
+
+	if (s->playslot == PLAY_DEFERRED)
+		play_disarm(s);
+	if (s->jbpull || (!s->rxcore.tv_sec && !s->rxcore.tv_usec) ||
+	    (next = s->jbe->next(s->jb)) == JB_LONGMAX) {
+		play_disarm(s);
+		return;
+	}
+
+	/* Delivered once the rxcore-relative time exceeds next */
+	next++;
+	when.tv_sec = s->rxcore.tv_sec + next / 1000;
+	when.tv_usec = s->rxcore.tv_usec + (next % 1000) * 1000;
+	if (when.tv_usec >= 1000000) {
+		when.tv_usec -= 1000000;
+		when.tv_sec++;
+	} else if (when.tv_usec < 0) {
+		when.tv_usec += 1000000;
+		when.tv_sec--;
+	}
+
+	if (s->playslot < 0) {
+		s->playdue = when;
+		s->playslot = playlen;
+		playheap[playlen++] = s;
+		play_sift_up(s->playslot);
+	} else if (tv_before(&when, &s->playdue)) {
+		s->playdue = when;
+		play_sift_up(s->playslot);
+	} else {
+		s->playdue = when;
+		play_sift_down(s->playslot);
 	}
-	return 0;
 }
 
+/* Re-arm a session just visited, keeping it off playheap for the rest of
+   this iax_get_event() if it is still due by tv, so that each session gets
+   at most one jb_get() per call */
+static void play_visited(struct iax_session *s, const struct timeval *tv)
+{
+	play_arm(s);
+	if (s->playslot >= 0 && !tv_before(tv, &s->playdue)) {
+		play_disarm(s);
+		s->playslot = PLAY_DEFERRED;
+		s->playnext = playdefer;
+		playdefer = s;
+	}
+}
+
+static void play_undefer(void)
+{
+	struct iax_session *s;
+
+	while ((s = playdefer)) {
+		playdefer = s->playnext;
+		s->playslot = -1;
+		play_arm(s);
+	}
+}
+
+int iax_next_event_time(struct timeval *tv)
+{
+	int found = 0;
+
+	if (schedlen) {
+		*tv = schedheap[0]->when;
+		found = 1;
+	}
+
+	/* Jitterbuffer playout, see the delivery loop in iax_get_event() */
+	if (playlen && (!found || tv_before(&playheap[0]->playdue, tv))) {
+		*tv = playheap[0]->playdue;
+		found = 1;
+	}
+	return found ? 0 : -1;
+}
 
 int iax_time_to_next_event(void)
 {
-	struct timeval tv;
-	struct iax_sched *cur = schedq;
-	int ms, min = 999999999;
+	struct timeval tv, when;
+	int ms;
 
 	/* If there are no pending events, we don't need to timeout */
-	if (!cur)
+	if (iax_next_event_time(&when) < 0)
 		return -1;
 	tv = iax_tvnow();
-	while(cur) {
-		ms = (cur->when.tv_sec - tv.tv_sec) * 1000 +
-		     (cur->when.tv_usec - tv.tv_usec) / 1000;
-		if (ms < min)
-			min = ms;
-		cur = cur->next;
-	}
-	if (min < 0)
-		min = 0;
-	return min;
+	ms = (when.tv_sec - tv.tv_sec) * 1000 +
+	     (when.tv_usec - tv.tv_usec) / 1000;
+	if (ms < 0)
+		ms = 0;
+	return ms;
 }
 
 struct iax_session *iax_session_new(void)
@@ -525,6 +1047,7 @@ struct iax_session *iax_session_new(void)
 	s = calloc(1, sizeof(struct iax_session));
 	if (s) {
 		jb_conf jbconf;
+		int i;
 
 		/* Initialize important fields */
 		s->voiceformat = -1;
@@ -532,24 +1055,46 @@ struct iax_session *iax_session_new(void)
 		s->videoformat = -1;
 		/* Default pingtime to 100 ms -- should cover most decent net connections */
 		s->pingtime = 100;
-		/* XXX Not quite right -- make sure it's not in use, but that won't matter
-		   unless you've had at least 65k calls.  XXX */
-		s->callno = callnums++;
-		if (callnums > 32767)
-			callnums = 1;
+		/* Pick the next call number not already in use */
+		for (i = 0; i < 32767; i++) {
+			s->callno = callnums++;
+			if (callnums > 32767)
+				callnums = 1;
+			if (!session_by_callno(s->callno))
+				break;
+		}
+		if (i == 32767) {
+			DEBU(G "No free call numbers\n");
+			free(s);
+			return 0;
+		}
+		if (nsessions == playsize) {
+			int newsize = playsize ? playsize * 2 : 64;
+			struct iax_session **tmp;
+
+			tmp = (struct iax_session **)realloc(playheap, newsize * sizeof(*tmp));
+			if (!tmp) {
+				DEBU(G "Out of memory!\n");
+				free(s);
+				return 0;
+			}
+			playheap = tmp;
+			playsize = newsize;
+		}
 		s->peercallno = 0;
 		s->peerport = 0;  /* Initialize peerport to 0 (will use default) */
 		s->lastvnak = -1;
 		s->transferpeer = 0; /* for attended transfer */
 		s->next = sessions;
 		s->sendto = iax_sendto;
-		s->pingid = -1;
+		s->playslot = -1;
 
 #ifdef USE_VOICE_TS_PREDICTION
 		s->nextpred = 0;
 #endif
 
-		s->jb = jb_new();
+		s->jbe = jb_default_engine;
+		s->jb = s->jbe->create();
 		if ( !s->jb )
 		{
 			free(s);
@@ -559,9 +1104,11 @@ struct iax_session *iax_session_new(void)
 		jbconf.resync_threshold = 1000;
 		jbconf.max_contig_interp = 0;
 		jbconf.target_extra = jb_target_extra;
-		jb_setconf(s->jb, &jbconf);
+		s->jbe->setconf(s->jb, &jbconf);
 
 		sessions = s;
+		nsessions++;
+		session_link(s);
 	}
 	return s;
 }
@@ -569,12 +1116,11 @@ struct iax_session *iax_session_new(void)
 static int iax_session_valid(struct iax_session *session)
 {
 	/* Return -1 on a valid iax session pointer, 0 on a failure */
-	struct iax_session *cur = sessions;
-	while(cur) {
+	struct iax_session *cur;
+
+	for (cur = ptr_hash[SESSION_PTR_BUCKET(session)]; cur; cur = cur->ptr_next)
 		if (session == cur)
 			return -1;
-		cur = cur->next;
-	}
 	return 0;
 }
 
@@ -588,7 +1134,7 @@ int iax_get_netstats(struct iax_session *session, int *rtt, struct iax_netstat *
 
 	*remote = session->remote_netstats;
 
-	jb_getinfo(session->jb, &stats);
+	session->jbe->getinfo(session->jb, &stats);
 
 	local->jitter = stats.jitter;
 	/* XXX: should be short-term loss pct.. */
@@ -603,6 +1149,59 @@ int iax_get_netstats(struct iax_session *session, int *rtt, struct iax_netstat *
 	return 0;
 }
 
+int iax_get_jb_histograms(struct iax_session *session, struct iax_jb_histograms *h)
+{
+	struct iax_jb_histogram *out[JB_HIST_COUNT];
+	int i, j;
+
+	if (!iax_session_valid(session))
+		return -1;
+
+	out[JB_HIST_DELAY] = &h->delay;
+	out[JB_HIST_JITTER] = &h->jitter;
+	out[JB_HIST_INTERP] = &h->interp;
+	for (i = 0; i < JB_HIST_COUNT; i++) {
+		for (j = 0; j < IAX_JB_HIST_BUCKETS; j++) {
+			out[i]->bound[j] = jb_hist_bounds[i][j];
+			out[i]->count[j] = session->jbhist[i][j];
+		}
+	}
+	return 0;
+}
+
+int iax_get_jb_delay(struct iax_session *session, long *current, long *target)
+{
+	jb_info stats;
+
+	if (!iax_session_valid(session) || !session->jb)
+		return -1;
+
+	session->jbe->getinfo(session->jb, &stats);
+	*current = stats.current;
+	*target = stats.target;
+	return 0;
+}
+
+int iax_jb_stretch(struct iax_session *session, long ms)
+{
+	if (!iax_session_valid(session) || !session->jb)
+		return -1;
+
+	session->jbe->stretch(session->jb, ms);
+	play_arm(session);
+	return 0;
+}
+
+int iax_set_jb_pull(struct iax_session *session, int pull)
+{
+	if (!iax_session_valid(session) || !session->jb)
+		return -1;
+
+	session->jbpull = pull;
+	play_arm(session);
+	return 0;
+}
+
 #ifdef USE_VOICE_TS_PREDICTION
 static void add_ms(struct timeval *tv, int ms)
 {
@@ -898,11 +1497,61 @@ static int get_sample_cnt(struct iax_event *e)
 	return cnt;
 }
 
-static int iax_xmit_frame(struct iax_frame *f)
+/* Where a session's frames go when not transferring */
+static void iax_session_dest(struct iax_session *session, struct sockaddr_in *addr)
 {
-	int res;
+	/* Use peer address, but ensure correct port if we have a specific peer port */
+	memcpy(addr, &(session->peeraddr), sizeof(*addr));
+	if (session->peerport > 0) {
+		/* Log before changing port to see what's happening */
+		/*IAX_LOG("iax_send_raw: Using explicit peer port %d instead of %d", 
+			session->peerport, ntohs(addr->sin_port));
+		*/	
+		addr->sin_port = htons((short)session->peerport);
+	}
 
+	/* Log final destination for debugging */
+	/*
+	IAX_LOG("iax_send_raw: Sending to %s:%d", 
+		inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+		*/
+}
+
+/* Send one datagram, through the transmit queue when it is enabled */
+static int iax_xmit_raw(iax_sendto_t st, const void *data, int datalen, struct sockaddr_in *addr)
+{
+#ifdef IAX_HAVE_SENDMMSG
+	if (send_batch) {
+		/* Queue only what would go out on our own socket anyway */
+		if (st == (iax_sendto_t)sendto && datalen <= IAX_SEND_SLOT_SIZE) {
+			/* Still full of what the socket had no room for: this one
+			   fails as a sendto() with no room would */
+			if (send_count == send_batch) {
+				iax_flush_tx();
+				if (send_count == send_batch) {
+					errno = ENOBUFS;
+					return -1;
+				}
+			}
+			memcpy(send_bufs + send_count * IAX_SEND_SLOT_SIZE, data, datalen);
+			send_iov[send_count].iov_len = datalen;
+			send_addrs[send_count] = *addr;
+			if (++send_count == send_batch)
+				iax_flush_tx();
+			return datalen;
+		}
+		/* Keep ordering with anything already queued */
+		iax_flush_tx();
+	}
+#endif
 
+	return st(netfd, (const char *) data, datalen,
+			IAX_SOCKOPTS, (struct sockaddr *)addr,
+			sizeof(*addr));
+}
+
+static int iax_xmit_frame(struct iax_frame *f)
+{
 #ifdef DEBUG_SUPPORT
 	if (debug) {
 		struct ast_iax2_full_hdr *h = (struct ast_iax2_full_hdr *)f->data;
@@ -921,32 +1570,14 @@ static int iax_xmit_frame(struct iax_frame *f)
 
 	/* Send the frame raw */
 	struct sockaddr_in send_addr;
-	
+
 	if (f->transfer) {
 		/* Use transfer address */
 		memcpy(&send_addr, &(f->session->transfer), sizeof(send_addr));
-	} else {
-		/* Use peer address, but ensure correct port if we have a specific peer port */
-		memcpy(&send_addr, &(f->session->peeraddr), sizeof(send_addr));
-		if (f->session->peerport > 0) {
-			/* Log before changing port to see what's happening */
-			/*IAX_LOG("iax_send_raw: Using explicit peer port %d instead of %d", 
-				f->session->peerport, ntohs(send_addr.sin_port));
-			*/	
-			send_addr.sin_port = htons((short)f->session->peerport);
-		}
-	}
-	
-	/* Log final destination for debugging */
-	/*
-	IAX_LOG("iax_send_raw: Sending to %s:%d", 
-		inet_ntoa(send_addr.sin_addr), ntohs(send_addr.sin_port));
-		*/
-		
-	res = f->session->sendto(netfd, (const char *) f->data, f->datalen,
-			IAX_SOCKOPTS, (struct sockaddr *)&send_addr,
-			sizeof(send_addr));
-	return res;
+	} else
+		iax_session_dest(f->session, &send_addr);
+
+	return iax_xmit_raw(f->session->sendto, f->data, f->datalen, &send_addr);
 }
 
 static int iax_reliable_xmit(struct iax_frame *f)
@@ -957,28 +1588,29 @@ static int iax_reliable_xmit(struct iax_frame *f)
 	if (!fh->type) {
 		return -2;
 	}
-	fc = (struct iax_frame *)malloc(sizeof(struct iax_frame));
-	if (fc) {
-		/* Make a copy of the frame */
-		memcpy(fc, f, sizeof(struct iax_frame));
-		/* And a copy of the data if applicable */
-		if (!fc->data || !fc->datalen) {
-			IAXERROR "No frame data?");
-			DEBU(G "No frame data?\n");
-			return -1;
-		} else {
-			fc->data = (char *)malloc(fc->datalen);
-			if (!fc->data) {
-				DEBU(G "Out of memory\n");
-				IAXERROR "Out of memory\n");
-				return -1;
-			}
-			memcpy(fc->data, f->data, f->datalen);
-			iax_sched_add(NULL, fc, NULL, NULL, fc->retrytime);
-			return iax_xmit_frame(fc);
-		}
-	} else
+	if (!f->data || !f->datalen) {
+		IAXERROR "No frame data?");
+		DEBU(G "No frame data?\n");
+		return -1;
+	}
+	/* Copy the frame and its data into one pooled block */
+	fc = (struct iax_frame *)iax_pool_alloc(sizeof(struct iax_frame) + f->datalen);
+	if (!fc) {
+		DEBU(G "Out of memory\n");
+		IAXERROR "Out of memory\n");
 		return -1;
+	}
+	memcpy(fc, f, sizeof(struct iax_frame));
+	fc->data = (char *)(fc + 1);
+	memcpy(fc->data, f->data, f->datalen);
+	fc->retrans = 0;
+	fc->txtime = iax_tvnow();
+	/* Transfer frames are acknowledged by the transfer peer, outside
+	   the session's window */
+	if (fc->retries >= 0 && !fc->transfer)
+		fc->session->rtxwin[(unsigned char)fc->oseqno] = fc;
+	iax_sched_add(NULL, fc, NULL, NULL, fc->retrytime);
+	return iax_xmit_frame(fc);
 }
 
 void iax_set_networking(iax_sendto_t st, iax_recvfrom_t rf)
@@ -993,6 +1625,160 @@ void iax_set_jb_target_extra( long value )
 	jb_target_extra = value ;
 }
 
+int iax_set_jb_engine(const char *name)
+{
+	const jb_engine *engine = jb_engine_find(name);
+
+	if (!engine)
+		return -1;
+	jb_default_engine = engine;
+	return 0;
+}
+
+int iax_set_session_jb_engine(struct iax_session *session, const char *name)
+{
+	const jb_engine *engine = jb_engine_find(name);
+	jb_info info;
+	void *jb;
+
+	if (!engine || !iax_session_valid(session))
+		return -1;
+	if (engine == session->jbe)
+		return 0;
+
+	/* Only between talkspurts, with nothing queued to carry over */
+	session->jbe->getinfo(session->jb, &info);
+	if (info.frames_cur)
+		return -1;
+	if (!(jb = engine->create()))
+		return -1;
+	engine->setconf(jb, &info.conf);
+	session->jbe->destroy(session->jb);
+	session->jbe = engine;
+	session->jb = jb;
+	play_disarm(session);
+	return 0;
+}
+
+int iax_set_send_batch(int count)
+{
+#ifdef IAX_HAVE_SENDMMSG
+	unsigned char *bufs = NULL;
+	int i;
+
+	iax_flush_tx();
+	if (count > IAX_SEND_BATCH_MAX)
+		count = IAX_SEND_BATCH_MAX;
+	if (count > 1) {
+		bufs = (unsigned char *)malloc(count * IAX_SEND_SLOT_SIZE);
+		if (!bufs) {
+			IAXERROR "Out of memory for transmit batch\n");
+			return -1;
+		}
+	} else
+		count = 0;
+
+	/* anything the socket still had no room for goes with the old queue */
+	free(send_bufs);
+	send_bufs = bufs;
+	send_batch = count;
+	send_count = 0;
+
+	for (i = 0; i < count; i++) {
+		send_iov[i].iov_base = send_bufs + i * IAX_SEND_SLOT_SIZE;
+		memset(&send_msgs[i].msg_hdr, 0, sizeof(send_msgs[i].msg_hdr));
+		send_msgs[i].msg_hdr.msg_name = &send_addrs[i];
+		send_msgs[i].msg_hdr.msg_namelen = sizeof(send_addrs[i]);
+		send_msgs[i].msg_hdr.msg_iov = &send_iov[i];
+		send_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return count ? count : 1;
+#else
+	(void)count;
+	return 1;
+#endif
+}
+
+int iax_flush_tx(void)
+{
+#ifdef IAX_HAVE_SENDMMSG
+	int sent = 0, done = 0, res, i;
+
+	if (!send_count)
+		return 0;
+
+	while (done < send_count) {
+		res = sendmmsg(netfd, send_msgs + done, send_count - done, IAX_SOCKOPTS);
+		tx_stats.syscalls++;
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			/* No room in the socket for now; the rest waits for the
+			   next flush */
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				break;
+			/* The first remaining datagram failed; drop it as a failed
+			   sendto() would have and carry on with the rest */
+			DEBU(G "Error on write: %s\n", strerror(errno));
+			done++;
+			continue;
+		}
+		sent += res;
+		done += res;
+	}
+
+	tx_stats.flushes++;
+	tx_stats.frames += sent;
+	if (sent > tx_stats.max_batch)
+		tx_stats.max_batch = sent;
+
+	/* Move what is left to the front, in order */
+	send_count -= done;
+	if (done) {
+		for (i = 0; i < send_count; i++) {
+			memcpy(send_bufs + i * IAX_SEND_SLOT_SIZE,
+			       send_bufs + (done + i) * IAX_SEND_SLOT_SIZE,
+			       send_iov[done + i].iov_len);
+			send_iov[i].iov_len = send_iov[done + i].iov_len;
+			send_addrs[i] = send_addrs[done + i];
+		}
+	}
+	return sent;
+#else
+	return 0;
+#endif
+}
+
+void iax_get_tx_stats(struct iax_tx_stats *stats)
+{
+	*stats = tx_stats;
+}
+
+int iax_set_recv_batch(int count)
+{
+#ifdef IAX_HAVE_RECVMMSG
+	int i;
+
+	if (count > IAX_RECV_BATCH_MAX)
+		count = IAX_RECV_BATCH_MAX;
+	if (count < 0)
+		count = 0;
+
+	/* Anything still pending from the old batch is discarded; slots are
+	   (re)filled from the pool before each read */
+	for (i = 0; i < IAX_RECV_BATCH_MAX; i++) {
+		iax_pool_free(recv_slots[i]);
+		recv_slots[i] = NULL;
+	}
+	recv_batch = count;
+	recv_count = recv_next = 0;
+	return count;
+#else
+	(void)count;
+	return 0;
+#endif
+}
+
 int iax_init(int preferredportno)
 {
 	int portno = preferredportno;
@@ -1108,6 +1894,14 @@ int iax_init(int preferredportno)
 			IAXERROR "Unable to set send buffer size.");
 		}
 
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+		flags = 1;
+		rx_timestamps = setsockopt(netfd, SOL_SOCKET, SO_TIMESTAMPNS,
+				(char *)&flags, sizeof(flags)) == 0;
+		if (!rx_timestamps)
+			DEBU(G "No kernel receive timestamps, using read time.");
+#endif
+
 		portno = ntohs(sin.sin_port);
 		DEBU(G "Started on port %d\n", portno);
 	}
@@ -1147,6 +1941,228 @@ static unsigned char compress_subclass(int subclass)
 	return power | IAX_FLAG_SC_LOG;
 }
 
+static int tvdiff_ms(struct timeval a, struct timeval b)
+{
+	return (a.tv_sec - b.tv_sec) * 1000 + (a.tv_usec - b.tv_usec) / 1000;
+}
+
+static struct iax_trunk *iax_trunk_find(struct sockaddr_in *addr, int create)
+{
+	struct iax_trunk *t;
+
+	for (t = trunks; t; t = t->next) {
+		if (t->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+				t->addr.sin_port == addr->sin_port)
+			return t;
+	}
+	if (!create)
+		return NULL;
+
+	t = (struct iax_trunk *)calloc(1, sizeof(struct iax_trunk));
+	if (!t) {
+		DEBU(G "Out of memory\n");
+		return NULL;
+	}
+	t->addr = *addr;
+	t->txtrunktime = iax_tvnow();
+	t->next = trunks;
+	trunks = t;
+	return t;
+}
+
+static int iax_trunk_flush(struct iax_trunk *t);
+
+/* Drop a session's reference, freeing the trunk with its last */
+static void iax_trunk_unref(struct iax_trunk **ref)
+{
+	struct iax_trunk *t = *ref, **pp;
+
+	if (!t)
+		return;
+	*ref = NULL;
+	if (--t->refs > 0)
+		return;
+
+	iax_trunk_flush(t);
+	for (pp = &trunks; *pp; pp = &(*pp)->next) {
+		if (*pp == t) {
+			*pp = t->next;
+			break;
+		}
+	}
+	free(t);
+}
+
+/* Point a session's reference at the trunk for addr, creating it if need
+   be; the old one, if different, is dropped */
+static struct iax_trunk *iax_trunk_ref(struct iax_trunk **ref, struct sockaddr_in *addr)
+{
+	struct iax_trunk *t = *ref;
+
+	if (t && t->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+			t->addr.sin_port == addr->sin_port)
+		return t;
+
+	t = iax_trunk_find(addr, 1);
+	if (!t)
+		return NULL;
+	iax_trunk_unref(ref);
+	t->refs++;
+	*ref = t;
+	return t;
+}
+
+void iax_trunk_shutdown(void)
+{
+	struct iax_session *s;
+	struct iax_trunk *t;
+
+	for (s = sessions; s; s = s->next) {
+		s->trunk = NULL;
+		s->rxtrunk = NULL;
+	}
+	while ((t = trunks)) {
+		iax_trunk_flush(t);
+		trunks = t->next;
+		free(t);
+	}
+}
+
+/* Send whatever is pending in a trunk */
+static int iax_trunk_flush(struct iax_trunk *t)
+{
+	struct ast_iax2_meta_hdr *meta = (struct ast_iax2_meta_hdr *)t->buf;
+	struct ast_iax2_meta_trunk_hdr *mth = (struct ast_iax2_meta_trunk_hdr *)meta->data;
+	int res;
+
+	if (!t->entries)
+		return 0;
+
+	if (t->entries == 1) {
+		/* Not worth the extra headers; the entry is a mini frame already */
+		res = iax_xmit_raw(t->sendto,
+				t->buf + IAX_TRUNK_HDRLEN + sizeof(unsigned short),
+				t->len - IAX_TRUNK_HDRLEN - sizeof(unsigned short), &t->addr);
+	} else {
+		meta->zeros = 0;
+		meta->metacmd = IAX_META_TRUNK;
+		meta->cmddata = IAX_META_TRUNK_MINI;
+		mth->ts = htonl(tvdiff_ms(iax_tvnow(), t->txtrunktime));
+		res = iax_xmit_raw(t->sendto, t->buf, t->len, &t->addr);
+		trunk_stats.saved += t->entries - 1;
+	}
+
+	trunk_stats.datagrams++;
+	trunk_stats.frames += t->entries;
+	t->entries = 0;
+	t->len = 0;
+	t->flushes++;
+	return res;
+}
+
+static void iax_trunk_tick(void *arg)
+{
+	struct iax_trunk *t;
+	struct timeval now;
+	int active = 0;
+	int ms;
+
+	(void)arg;
+	trunk_tick_pending = 0;
+	trunk_ticks++;
+
+	for (t = trunks; t; t = t->next) {
+		if (t->entries || t->calls)
+			active = 1;
+		iax_trunk_flush(t);
+		t->expect = t->calls;
+		t->calls = 0;
+	}
+
+	now = iax_tvnow();
+	ms = tvdiff_ms(now, trunk_rate_start);
+	if (!active || ms >= 1000) {
+		trunk_stats.saved_per_sec = active && ms > 0 ?
+			(trunk_stats.saved - trunk_rate_saved) * 1000 / ms : 0;
+		trunk_rate_saved = trunk_stats.saved;
+		trunk_rate_start = now;
+	}
+
+	/* Keep ticking while any call is trunking */
+	if (active) {
+		trunk_tick_pending = 1;
+		iax_sched_add(NULL, NULL, iax_trunk_tick, NULL, IAX_TRUNK_TICK);
+	}
+}
+
+static int iax_session_trunking(struct iax_session *session)
+{
+	return session->trunkmode == IAX_TRUNK_ON ||
+		(session->trunkmode == IAX_TRUNK_AUTO && session->peertrunks);
+}
+
+/* Add a mini voice frame to the trunk for the session's peer */
+static int iax_trunk_xmit(struct iax_frame *fr)
+{
+	struct iax_session *session = fr->session;
+	struct iax_trunk *t;
+	struct ast_iax2_meta_trunk_mini *mtm;
+	struct sockaddr_in addr;
+	int need = sizeof(struct ast_iax2_meta_trunk_mini) + fr->af.datalen;
+
+	if (IAX_TRUNK_HDRLEN + need > IAX_TRUNK_MTU)
+		return iax_xmit_frame(fr);
+
+	/* Follow the peer if it has moved */
+	iax_session_dest(session, &addr);
+	t = iax_trunk_ref(&session->trunk, &addr);
+	if (!t)
+		return iax_xmit_frame(fr);
+
+	/* One entry per call per datagram, all through the same sendto */
+	if (session->trunkflush == t->flushes + 1 ||
+			t->len + need > IAX_TRUNK_MTU ||
+			(t->entries && t->sendto != session->sendto))
+		iax_trunk_flush(t);
+
+	if (!t->entries)
+		t->len = IAX_TRUNK_HDRLEN;
+	mtm = (struct ast_iax2_meta_trunk_mini *)(t->buf + t->len);
+	mtm->len = htons(fr->af.datalen);
+	mtm->mini.callno = htons(fr->callno);
+	mtm->mini.ts = htons(fr->ts & 0xFFFF);
+	memcpy(mtm->mini.data, fr->af.data, fr->af.datalen);
+	t->len += need;
+	t->entries++;
+	t->sendto = session->sendto;
+	session->trunkflush = t->flushes + 1;
+
+	if (session->trunktick != trunk_ticks) {
+		session->trunktick = trunk_ticks;
+		t->calls++;
+	}
+
+	/* Everyone who spoke last tick has spoken again */
+	if (t->expect && t->entries >= t->expect)
+		iax_trunk_flush(t);
+
+	if (!trunk_tick_pending) {
+		trunk_tick_pending = 1;
+		iax_sched_add(NULL, NULL, iax_trunk_tick, NULL, IAX_TRUNK_TICK);
+	}
+	return fr->af.datalen;
+}
+
+void iax_set_trunk(struct iax_session *session, int mode)
+{
+	session->trunkmode = mode;
+}
+
+void iax_get_trunk_stats(struct iax_trunk_stats *stats)
+{
+	*stats = trunk_stats;
+}
+
 static int iax_send(struct iax_session *pvt, struct ast_frame *f, unsigned int ts, int seqno, int now, int transfer, int final, int fullframe)
 {
 	/* Queue a packet for delivery on a given private structure.  Use "ts" for
@@ -1280,8 +2296,9 @@ static int iax_send(struct iax_session *pvt, struct ast_frame *f, unsigned int t
 		fr->datalen = fr->af.datalen + sizeof(struct ast_iax2_full_hdr);
 		fr->data = fh;
 		fr->retries = maxretries;
-		/* Retry after 2x the ping time has passed */
-		fr->retrytime = pvt->pingtime * 2;
+		/* Retry after the estimated RTO, or 2x the ping time until we
+		   have one */
+		fr->retrytime = pvt->rto ? pvt->rto : (int)(pvt->pingtime * 2);
 		if (fr->retrytime < MIN_RETRY_TIME)
 			fr->retrytime = MIN_RETRY_TIME;
 		if (fr->retrytime > MAX_RETRY_TIME)
@@ -1329,7 +2346,10 @@ static int iax_send(struct iax_session *pvt, struct ast_frame *f, unsigned int t
 			fr->datalen = fr->af.datalen + sizeof(struct ast_iax2_mini_hdr);
 			fr->data = mh;
 			fr->retries = -1;
-			res = iax_xmit_frame(fr);
+			if (!transfer && iax_session_trunking(pvt))
+				res = iax_trunk_xmit(fr);
+			else
+				res = iax_xmit_frame(fr);
 		}
 	}
 	if( !now && fr!=NULL )
@@ -1451,20 +2471,21 @@ int iax_transfer(struct iax_session *session, const char *number)
 static void stop_transfer(struct iax_session *session)
 {
 	struct iax_sched *sch;
+	int i;
 
-	sch = schedq;
-	while(sch) {
+	for (i = 0; i < schedlen; i++) {
+		sch = schedheap[i];
 		if (sch->frame && (sch->frame->session == session))
 					sch->frame->retries = -1;
-		sch = sch->next;
 	}
+	memset(session->rtxwin, 0, sizeof(session->rtxwin));
 }	/* stop_transfer */
 
 static void complete_transfer(struct iax_session *session, int peercallno, int xfr2peer, int preserveSeq)
 {
 	jb_frame frame;
 
-	session->peercallno = peercallno;
+	session_set_peercallno(session, peercallno);
 	/* Change from transfer to session now */
 	if (xfr2peer) {
 		memcpy(&session->peeraddr, &session->transfer, sizeof(session->peeraddr));
@@ -1483,10 +2504,11 @@ static void complete_transfer(struct iax_session *session, int peercallno, int x
 	memset(&session->offset, 0, sizeof(session->offset));
 
 	/* Reset jitterbuffer */
-	while(jb_getall(session->jb,&frame) == JB_OK)
+	while(session->jbe->getall(session->jb,&frame) == JB_OK)
 		iax_event_free((struct iax_event *)frame.data);
 
-	jb_reset(session->jb);
+	session->jbe->reset(session->jb);
+	play_disarm(session);
 
 	if (! preserveSeq)
 	{
@@ -1499,6 +2521,10 @@ static void complete_transfer(struct iax_session *session, int peercallno, int x
 	session->lastsent = 0;
 	session->last_ts = 0;
 	session->pingtime = 30;
+	/* New path, new round trip time, and no transit time to compare
+	   the first frame over it with */
+	session->srtt = session->rttvar = session->rto = 0;
+	session->havetransit = 0;
 	/* We have to dump anything we were going to (re)transmit now that we've been
 	   transferred since they're all invalid and for the old host. */
 	stop_transfer(session);
@@ -1655,27 +2681,29 @@ static void iax_handle_txreject(struct iax_session *s)
 static void destroy_session(struct iax_session *session)
 {
 	struct iax_session *cur, *prev=NULL;
-	struct iax_sched *curs, *prevs=NULL, *nexts=NULL;
-	int    loop_cnt=0;
-	curs = schedq;
-	while(curs) {
-		nexts = curs->next;
+	struct iax_sched *curs;
+	int i, j;
+
+	cancel_ping(session);
+	for (i = 0, j = 0; i < schedlen; i++) {
+		curs = schedheap[i];
 		if (curs->frame && curs->frame->session == session) {
 			/* Just mark these frames as if they've been sent */
 			curs->frame->retries = -1;
 		} else if (curs->event && curs->event->session == session) {
-			if (prevs)
-				prevs->next = nexts;
-			else
-				schedq = nexts;
-			if (curs->event)
-				iax_event_free(curs->event);
-			free(curs);
-		} else {
-			prevs = curs;
+			/* Detach first so a queued HANGUP/REJECT does not re-enter
+			   destroy_session() while the heap is being compacted */
+			curs->event->session = NULL;
+			iax_event_free(curs->event);
+			iax_pool_free(curs);
+			continue;
 		}
-		curs = nexts;
-		loop_cnt++;
+		curs->slot = j;
+		schedheap[j++] = curs;
+	}
+	if (j != schedlen) {
+		schedlen = j;
+		sched_heapify();
 	}
 
 	cur = sessions;
@@ -1687,11 +2715,16 @@ static void destroy_session(struct iax_session *session)
 				prev->next = session->next;
 			else
 				sessions = session->next;
+			nsessions--;
+			session_unlink(session);
+			play_disarm(session);
+			iax_trunk_unref(&session->trunk);
+			iax_trunk_unref(&session->rxtrunk);
 
-			while(jb_getall(session->jb,&frame) == JB_OK)
+			while(session->jbe->getall(session->jb,&frame) == JB_OK)
 				iax_event_free((struct iax_event *)frame.data);
 
-			jb_destroy(session->jb);
+			session->jbe->destroy(session->jb);
 
 			free(session);
 			return;
@@ -1949,7 +2982,7 @@ int iax_reject(struct iax_session *session, char *reason)
 int iax_hangup(struct iax_session *session, char *byemsg)
 {
 	struct iax_ie_data ied;
-	iax_sched_del(NULL, NULL, send_ping, (void *) session, 1);
+	cancel_ping(session);
 	memset(&ied, 0, sizeof(ied));
 	iax_ie_append_str(&ied, IAX_IE_CAUSE, byemsg ? byemsg : "Normal clearing");
 	return send_command_final(session, AST_FRAME_IAX, IAX_COMMAND_HANGUP, 0, ied.buf, ied.pos, -1);
@@ -2030,7 +3063,7 @@ static int iax_send_pong(struct iax_session *session, unsigned int ts)
 
         memset(&ied, 0, sizeof(ied));
 
-	jb_getinfo(session->jb, &stats);
+	session->jbe->getinfo(session->jb, &stats);
 
 	iax_ie_append_int(&ied,IAX_IE_RR_JITTER, stats.jitter);
 	/* XXX: should be short-term loss pct.. */
@@ -2061,8 +3094,10 @@ static void send_ping(void *s)
 	/* important, eh? */
 	if(!iax_session_valid(session)) return;
 
+	/* this is the entry that just ran */
+	session->ping = NULL;
 	send_command(session, AST_FRAME_IAX, IAX_COMMAND_PING, 0, NULL, 0, -1);
-	session->pingid = iax_sched_add(NULL,NULL, send_ping, (void *)session, ping_time * 1000);
+	schedule_ping(session, ping_time * 1000);
 	return;
 }
 
@@ -2263,7 +3298,7 @@ int iax_call(struct iax_session *session, const char *cidnum, const char *cidnam
 	}
 
 	session->capability = capabilities;
-	session->pingid = iax_sched_add(NULL,NULL, send_ping, (void *)session, 2 * 1000);
+	schedule_ping(session, 2 * 1000);
 
 	/* XXX We should have a preferred format XXX */
 	iax_ie_append_int(&ied, IAX_IE_FORMAT, formats);
@@ -2358,10 +3393,13 @@ static int calc_rxstamp(struct iax_session *session)
 	struct timeval tv;
 	int ms;
 
+	tv = iax_tvnow();
+	/* Kernel timestamps are on the system clock, so not with iax_set_clock() */
+	if (rx_stamp_valid && !iax_clock && tv_before(&rx_stamp, &tv))
+		tv = rx_stamp;
 	if (!session->rxcore.tv_sec && !session->rxcore.tv_usec) {
-		session->rxcore = iax_tvnow();
+		session->rxcore = tv;
 	}
-	tv = iax_tvnow();
 
 	ms = (tv.tv_sec - session->rxcore.tv_sec) * 1000 +
 		 (tv.tv_usec - session->rxcore.tv_usec) / 1000;
@@ -2430,7 +3468,7 @@ static int forward_match(struct sockaddr_in *sin, short callno, short dcallno, s
 		if (dcallno == cur->callno && dcallno != 0)  {
 			/* That's us. Be sure we keep track of the peer call number */
 			if (cur->peercallno == 0) {
-				cur->peercallno = callno;
+				session_set_peercallno(cur, callno);
 				//IAX_LOG("forward_match: Found match and set peercallno=%d for session", callno);
 			}
 			else if (cur->peercallno != callno) {
@@ -2489,29 +3527,31 @@ static struct iax_session *iax_find_session(struct sockaddr_in *sin,
 		short dcallno,
 		int makenew)
 {
-	struct iax_session *cur = sessions;
-	while(cur) {
-		if (forward_match(sin, callno, dcallno, cur)) {
+	struct iax_session *cur;
+
+	/* Our call numbers are unique, so at most one session can match
+	   forward.  forward_match() never matches a zero dcallno. */
+	if (dcallno) {
+		cur = session_by_callno(dcallno);
+		if (cur && forward_match(sin, callno, dcallno, cur))
 			return cur;
-		}
-		cur = cur->next;
 	}
 
-	cur = sessions;
-	while(cur) {
+	for (cur = peer_hash[SESSION_BUCKET(callno)]; cur; cur = cur->peer_next) {
 		if (reverse_match(sin, callno, cur)) {
 			return cur;
 		}
-		cur = cur->next;
 	}
 
 	if (makenew && !dcallno) {
 		cur = iax_session_new();
-		cur->peercallno = callno;
+		if (!cur)
+			return NULL;
+		session_set_peercallno(cur, callno);
 		cur->peeraddr.sin_addr.s_addr = sin->sin_addr.s_addr;
 		cur->peeraddr.sin_port = sin->sin_port;
 		cur->peeraddr.sin_family = AF_INET;
-		cur->pingid = iax_sched_add(NULL,NULL, send_ping, (void *)cur, 2 * 1000);
+		schedule_ping(cur, 2 * 1000);
 		DEBU(G "Making new session, peer callno %d, our callno %d\n", callno, cur->callno);
 	} else {
 		DEBU(G "No session, peer = %d, us = %d\n", callno, dcallno);
@@ -2609,6 +3649,7 @@ static struct iax_event *schedule_delivery(struct iax_event *e, unsigned int ts,
 		return NULL;
 	} else
 	{
+		struct iax_session *session = e->session;
 		int type = JB_TYPE_CONTROL;
 		int len = 0;
 
@@ -2636,11 +3677,24 @@ static struct iax_event *schedule_delivery(struct iax_event *e, unsigned int ts,
 			e->session->last_ts = ts;
 		}
 
-		if(jb_put(e->session->jb, e, type, len, ts,
-					calc_rxstamp(e->session)) == JB_DROP)
+		e->rxstamp = calc_rxstamp(session);
+		if(type == JB_TYPE_VOICE)
+		{
+			int transit = e->rxstamp - (int)ts;
+
+			if(session->havetransit)
+				jb_hist_add(session, JB_HIST_JITTER,
+					abs(transit - session->lasttransit));
+			session->lasttransit = transit;
+			session->havetransit = 1;
+		}
+
+		if(session->jbe->put(session->jb, e, type, len, ts,
+					e->rxstamp) == JB_DROP)
 		{
 			iax_event_free(e);
 		}
+		play_arm(session);
 	}
 
 	return NULL;
@@ -2655,9 +3709,70 @@ static int uncompress_subclass(unsigned char csub)
 		return csub;
 }
 
+/* Feed one round trip time measurement (ms) into the RTO estimator
+   (Jacobson/Karels, RFC 6298) */
+static void iax_rtt_sample(struct iax_session *session, int rtt)
+{
+	int delta;
+
+	if (rtt < 0)
+		return;
+	if (!session->srtt && !session->rttvar) {
+		session->srtt = rtt << 3;
+		session->rttvar = rtt << 1;
+	} else {
+		/* srtt += (rtt - srtt) / 8, rttvar += (|rtt - srtt| - rttvar) / 4 */
+		delta = rtt - (session->srtt >> 3);
+		session->srtt += delta;
+		if (delta < 0)
+			delta = -delta;
+		session->rttvar += delta - (session->rttvar >> 2);
+	}
+	/* rto = srtt + 4 * rttvar */
+	session->rto = (session->srtt >> 3) + session->rttvar;
+	if (session->rto < MIN_RETRY_TIME)
+		session->rto = MIN_RETRY_TIME;
+	if (session->rto > MAX_RETRY_TIME)
+		session->rto = MAX_RETRY_TIME;
+}
+
+/* Acknowledge our frames up to but not including iseqno.  ack_ts is the
+   arrival time of an explicit ACK, or NULL for an implicit one, which may
+   have waited for other traffic and so says nothing about the RTT. */
+static void iax_ack_window(struct iax_session *session, unsigned char iseqno, struct timeval *ack_ts)
+{
+	struct iax_frame *frame;
+	unsigned char x;
+
+	for (x = session->rseqno; x != iseqno; x++)
+	{
+		frame = session->rtxwin[x];
+		if (!frame)
+			continue;
+		DEBU(G "Cancelling transmission of packet %d\n", x);
+		/* Karn: only frames sent once give an unambiguous sample */
+		if (ack_ts && (unsigned char)(x + 1) == iseqno && !frame->retrans)
+			iax_rtt_sample(session,
+					(ack_ts->tv_sec - frame->txtime.tv_sec) * 1000 +
+					(ack_ts->tv_usec - frame->txtime.tv_usec) / 1000);
+		/* The scheduler frees it when it comes due */
+		frame->retries = -1;
+		session->rtxwin[x] = NULL;
+	}
+}
+
+/* Forget a frame the scheduler is about to free while still unacked */
+static void iax_rtx_forget(struct iax_frame *frame)
+{
+	if (!frame->transfer &&
+			frame->session->rtxwin[(unsigned char)frame->oseqno] == frame)
+		frame->session->rtxwin[(unsigned char)frame->oseqno] = NULL;
+}
+
 static void iax_handle_vnak(struct iax_session *session, struct ast_iax2_full_hdr *fh)
 {
-	struct iax_sched *sch, *list, *l, *tmp;
+	struct iax_frame *frame;
+	unsigned char x;
 
 	/*
 	 * According to the IAX2 02 draft, we MUST immediately retransmit all frames
@@ -2665,71 +3780,25 @@ static void iax_handle_vnak(struct iax_session *session, struct ast_iax2_full_hd
 	 * However, it seems that the right thing to do would be to retransmit
 	 * frames with sequence numbers higher OR EQUAL to VNAK's iseqno.
 	 */
-	sch = schedq;
-	list = NULL;
-	while ( sch != NULL )
+	if ((unsigned char)(fh->iseqno - session->rseqno) >
+			(unsigned char)(session->oseqno - session->rseqno))
+		return;
+
+	/* The window is indexed by oseqno, so this goes out in order */
+	for (x = fh->iseqno; x != session->oseqno; x++)
 	{
-		if ( sch->frame != NULL &&
-		     sch->frame->session == session
-		   )
+		frame = session->rtxwin[x];
+		if (frame)
 		{
-			/*
-			 * We want to check if our frame's oseqno is greater or equal than
-			 * the VNAK's iseqno, but we need to take into account sequence
-			 * number wrap-arounds
-			 * session->rseqno is our last acknowledged sequence number, so
-			 * we use that as a base
-			 */
-			if ( (unsigned char)(fh->iseqno - session->rseqno) <= (unsigned char)(sch->frame->oseqno - session->rseqno) )
-			{
-				/*
-				 * We cannot retransmit immediately, since the frames are ordered by retransmit time
-				 * We need to collect them and orrange them in ascending order of their oseqno
-				 */
-				tmp = (struct iax_sched *)calloc(1, sizeof(struct iax_sched));
-				tmp->frame = sch->frame;
-
-				if ( list == NULL ||
-				     (list->frame->oseqno - session->rseqno) > (tmp->frame->oseqno - session->rseqno)
-				   )
-				{
-					tmp->next = list;
-					list = tmp;
-				} else
-				{
-					l = list;
-					while ( l != NULL )
-					{
-						if ( l->next == NULL ||
-						     (l->next->frame->oseqno - session->rseqno) > (tmp->frame->oseqno - session->rseqno)
-						   )
-						{
-							tmp->next = l->next;
-							l->next = tmp;
-							break;
-						}
-						l = l->next;
-					}
-				}
-			}
+			frame->retrans++;
+			iax_xmit_frame(frame);
 		}
-		sch = sch->next;
-	}
-
-	/* Transmit collected frames and free the space */
-	while ( list != NULL )
-	{
-		tmp = list;
-		iax_xmit_frame(tmp->frame);
-		list = list->next;
-		free(tmp);
 	}
 }
 
 static struct iax_event *iax_header_to_event(struct iax_session *session, struct ast_iax2_full_hdr *fh, int datalen, struct sockaddr_in *sin)
 {
 	struct iax_event *e;
-	struct iax_sched *sch;
 	unsigned int ts;
 	int subclass;
 	int nowts;
@@ -2778,21 +3847,12 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 		{
 			/* The acknowledgement is within our window.  Time to acknowledge everything
 				that it says to */
-			for (x=session->rseqno; x != fh->iseqno; x++)
+			if (fh->type == AST_FRAME_IAX && subclass == IAX_COMMAND_ACK)
 			{
-				/* Ack the packet with the given timestamp */
-				DEBU(G "Cancelling transmission of packet %d\n", x);
-				sch = schedq;
-				while(sch)
-				{
-					if ( sch->frame &&
-					     sch->frame->session == session &&
-					     sch->frame->oseqno == x
-					   )
-						sch->frame->retries = -1;
-					sch = sch->next;
-				}
-			}
+				struct timeval now = iax_tvnow();
+				iax_ack_window(session, fh->iseqno, &now);
+			} else
+				iax_ack_window(session, fh->iseqno, NULL);
 			/* Note how much we've received acknowledgement for */
 			session->rseqno = fh->iseqno;
 		} else
@@ -2859,7 +3919,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 			session->iseqno++;
 	}
 
-	e = (struct iax_event *)malloc(sizeof(struct iax_event) + datalen + 1);
+	e = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event) + datalen + 1);
 
 	if (e) {
 		memset(e, 0, sizeof(struct iax_event) + datalen);
@@ -2905,7 +3965,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 			}
 			if (iax_parse_ies(&e->ies, e->data, e->datalen)) {
 				IAXERROR "Unable to parse IE's");
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			}
@@ -2931,7 +3991,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 					strlen(session->secret)) {
 						/* Hey, we already know this one */
 						iax_auth_reply(session, session->secret, e->ies.challenge, e->ies.authmethods);
-						free(e);
+						iax_pool_free(e);
 						e = NULL;
 						break;
 				}
@@ -2950,12 +4010,12 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 				e = schedule_delivery(e, ts, updatehistory);
 				break;
 			case IAX_COMMAND_ACK:
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_VNAK:
 				iax_handle_vnak(session, fh);
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_LAGRQ:
@@ -2976,7 +4036,9 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 			case IAX_COMMAND_PONG:
 				e->etype = IAX_EVENT_PONG;
 				/* track weighted average of ping time */
-				session->pingtime = ((2 * session->pingtime) + (calc_timestamp(session,0,NULL) - ts)) / 3;
+				nowts = calc_timestamp(session, 0, NULL) - ts;
+				session->pingtime = ((2 * session->pingtime) + nowts) / 3;
+				iax_rtt_sample(session, nowts);
 				session->remote_netstats.jitter = e->ies.rr_jitter;
 				session->remote_netstats.losspct = e->ies.rr_loss >> 24;;
 				session->remote_netstats.losscnt = e->ies.rr_loss & 0xffffff;
@@ -3011,7 +4073,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 				break;
 			case IAX_COMMAND_REGAUTH:
 				iax_regauth_reply(session, session->secret, e->ies.challenge, e->ies.authmethods);
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_REGREJ:
@@ -3041,7 +4103,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 					session->transferid = e->ies.transferid;
 					iax_send_txcnt(session);
 				}
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_DPREP:
@@ -3054,7 +4116,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 					session->transfer = *sin;
 					iax_send_txaccept(session);
 				}
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_TXACC:
@@ -3063,7 +4125,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 					session->transferring = TRANSFER_READY;
 					iax_send_txready(session);
 				}
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 				break;
 			case IAX_COMMAND_TXREL:
@@ -3098,13 +4160,13 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 					e->etype = IAX_EVENT_TXREADY;
 				}
 				else {
-					free(e);
+					iax_pool_free(e);
 					e = NULL;
 				}
 				break;
 			default:
 				DEBU(G "Don't know what to do with IAX command %d\n", subclass);
-				free(e);
+				iax_pool_free(e);
 				e = NULL;
 			}
 			break;
@@ -3133,7 +4195,7 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
                 break;
 			default:
 				DEBU(G "Don't know what to do with AST control %d\n", subclass);
-				free(e);
+				iax_pool_free(e);
 				return NULL;
 			}
 			break;
@@ -3192,13 +4254,13 @@ static struct iax_event *iax_header_to_event(struct iax_session *session, struct
 				break;
 			default:
 				DEBU(G "Don't know how to handle HTML type %d frames\n", fh->csub);
-				free(e);
+				iax_pool_free(e);
 				return NULL;
 			}
 			break;
 		default:
 			DEBU(G "Don't know what to do with frame type %d\n", fh->type);
-			free(e);
+			iax_pool_free(e);
 			return NULL;
 		}
 	} else
@@ -3224,7 +4286,7 @@ static struct iax_event *iax_videoheader_to_event(struct iax_session *session,
 		return 0;
 	}
 
-	e = (struct iax_event *)malloc(sizeof(struct iax_event) + datalen);
+	e = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event) + datalen);
 
 	if ( !e )
 	{
@@ -3243,9 +4305,10 @@ static struct iax_event *iax_videoheader_to_event(struct iax_session *session,
 }
 
 static struct iax_event *iax_miniheader_to_event(struct iax_session *session,
-		struct ast_iax2_mini_hdr *mh, int datalen)
+		struct ast_iax2_mini_hdr *mh, int datalen, unsigned char **slot)
 {
 	struct iax_event * e;
+	unsigned int ts;
 
 	if ( session->voiceformat <= 0 )
 	{
@@ -3253,36 +4316,318 @@ static struct iax_event *iax_miniheader_to_event(struct iax_session *session,
 		return 0;
 	}
 
-	e = (struct iax_event *)malloc(sizeof(struct iax_event) + datalen);
+	ts = (session->last_ts & 0xFFFF0000) | ntohs(mh->ts);
+
+	if ( slot && *slot && (unsigned char *)mh == *slot + IAX_RECV_HEADROOM &&
+	     sizeof(struct iax_event) + datalen > IAX_RECV_COPY_MAX )
+	{
+		/* The payload already sits where e->data is; take over the
+		   receive slot as the event.  The header is overwritten below. */
+		e = (struct iax_event *)*slot;
+		*slot = NULL;
+	} else
+	{
+		e = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event) + datalen);
+
+		if ( !e )
+		{
+			DEBU(G "Out of memory\n");
+			return 0;
+		}
+		memcpy(e->data, mh->data, datalen);
+	}
+
+	e->etype = IAX_EVENT_VOICE;
+	e->session = session;
+	e->subclass = session->voiceformat;
+	e->datalen = datalen;
+	e->ts = ts;
+
+	return schedule_delivery(e, e->ts, 1);
+}
+
+/* Voice from a supermini trunk entry, which has no timestamp of its own */
+static struct iax_event *iax_trunk_voice_to_event(struct iax_session *session,
+		struct iax_trunk *t, unsigned int trunkts, unsigned char *data, int datalen)
+{
+	struct iax_event *e;
+
+	if ( session->voiceformat <= 0 )
+	{
+		DEBU(G "No last format received on session %d\n", session->callno);
+		return 0;
+	}
 
+	e = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event) + datalen);
 	if ( !e )
 	{
 		DEBU(G "Out of memory\n");
 		return 0;
 	}
 
+	/* Move the peer's trunk time onto this call's receive time base */
+	if ( !session->rxcore.tv_sec && !session->rxcore.tv_usec )
+		session->rxcore = iax_tvnow();
+
 	e->etype = IAX_EVENT_VOICE;
 	e->session = session;
 	e->subclass = session->voiceformat;
 	e->datalen = datalen;
-	memcpy(e->data, mh->data, datalen);
-	e->ts = (session->last_ts & 0xFFFF0000) | ntohs(mh->ts);
+	memcpy(e->data, data, datalen);
+	e->ts = tvdiff_ms(t->rxtrunktime, session->rxcore) + trunkts;
 
 	return schedule_delivery(e, e->ts, 1);
 }
 
+/* Split a meta-trunk datagram into the voice frames it carries */
+static struct iax_event *iax_trunk_to_events(unsigned char *buf, int len, struct sockaddr_in *sin)
+{
+	struct ast_iax2_meta_hdr *meta = (struct ast_iax2_meta_hdr *)buf;
+	struct ast_iax2_meta_trunk_hdr *mth = (struct ast_iax2_meta_trunk_hdr *)meta->data;
+	struct ast_iax2_meta_trunk_entry *mte;
+	struct ast_iax2_meta_trunk_mini *mtm;
+	struct iax_session *session;
+	struct iax_trunk *t;
+	unsigned char *p, *end = buf + len;
+	unsigned int trunkts;
+	int callno, datalen, hdrlen;
+
+	if ( (size_t)len < IAX_TRUNK_HDRLEN || meta->metacmd != IAX_META_TRUNK )
+	{
+		DEBU(G "Unknown meta frame from %s\n", inet_ntoa(sin->sin_addr));
+		return NULL;
+	}
+
+	trunkts = ntohl(mth->ts);
+	trunk_stats.rx_datagrams++;
+
+	for ( p = mth->data; p < end; p += hdrlen + datalen )
+	{
+		if ( meta->cmddata == IAX_META_TRUNK_MINI )
+		{
+			mtm = (struct ast_iax2_meta_trunk_mini *)p;
+			hdrlen = sizeof(struct ast_iax2_meta_trunk_mini);
+			if ( end - p < hdrlen )
+				break;
+			callno = ntohs(mtm->mini.callno);
+			datalen = ntohs(mtm->len);
+		} else
+		{
+			mte = (struct ast_iax2_meta_trunk_entry *)p;
+			hdrlen = sizeof(struct ast_iax2_meta_trunk_entry);
+			if ( end - p < hdrlen )
+				break;
+			callno = ntohs(mte->callno);
+			datalen = ntohs(mte->len);
+		}
+		if ( end - p - hdrlen < datalen )
+		{
+			DEBU(G "Truncated trunk entry from %s\n", inet_ntoa(sin->sin_addr));
+			break;
+		}
+
+		session = iax_find_session(sin, callno, 0, 0);
+		if ( !session )
+			continue;
+		/* Only a known call's voice gets the peer a trunk */
+		t = iax_trunk_ref(&session->rxtrunk, sin);
+		if ( !t )
+			break;
+		if ( !t->rxtrunktime.tv_sec && !t->rxtrunktime.tv_usec )
+		{
+			t->rxtrunktime = iax_tvnow();
+			t->rxtrunktime.tv_sec -= trunkts / 1000;
+			t->rxtrunktime.tv_usec -= (trunkts % 1000) * 1000;
+			if ( t->rxtrunktime.tv_usec < 0 )
+			{
+				t->rxtrunktime.tv_usec += 1000000;
+				t->rxtrunktime.tv_sec--;
+			}
+		}
+		session->peertrunks = 1;
+		trunk_stats.rx_frames++;
+		if ( meta->cmddata == IAX_META_TRUNK_MINI )
+			iax_miniheader_to_event(session, &mtm->mini, datalen, NULL);
+		else
+			iax_trunk_voice_to_event(session, t, trunkts, p + hdrlen, datalen);
+	}
+	return NULL;
+}
+
 void iax_destroy(struct iax_session *session)
 {
 	destroy_session(session);
 }
 
+static struct iax_event *iax_net_process_slot(unsigned char *buf, int len,
+		struct sockaddr_in *sin, unsigned char **slot);
+
+static struct iax_event *iax_net_deliver(unsigned char *buf, int len,
+		struct sockaddr_in *sin, unsigned char **slot)
+{
+	struct iax_event *event;
+
+	event = iax_net_process_slot(buf, len, sin, slot);
+	if ( event == NULL )
+	{
+		// We have received a frame. The corresponding event is queued
+		// We need to motify the entire stack of calling functions so they
+		// don't go to sleep thinking there are no more frames to process
+		// TODO: this is buttugly from a design point of view. Basically we
+		// change libiax2 behavior to accomodate iaxclient.
+		// There must be a way to do it better.
+		event = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event));
+		if ( event != NULL ) {
+			event->etype = IAX_EVENT_NULL;
+			event->session = NULL;
+		}
+	}
+	return event;
+}
+
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+static void rx_stamp_from_msg(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+	struct timespec ts;
+
+	rx_stamp_valid = 0;
+	for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+			rx_stamp.tv_sec = ts.tv_sec;
+			rx_stamp.tv_usec = ts.tv_nsec / 1000;
+			rx_stamp_valid = 1;
+		}
+	}
+}
+
+/* iax_net_read() through recvmsg(), to get at the receive timestamp */
+static struct iax_event *iax_net_read_stamped(void)
+{
+	unsigned char buf[65536];
+	union {
+		char buf[IAX_RX_CMSG_SIZE];
+		struct cmsghdr align;
+	} control;
+	struct sockaddr_in sin;
+	struct iovec iov;
+	struct msghdr msg;
+	struct iax_event *event;
+	int res;
+
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &sin;
+	msg.msg_namelen = sizeof(sin);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	res = recvmsg(netfd, &msg, 0);
+	if (res < 0) {
+		if (errno != EAGAIN) {
+			DEBU(G "Error on read: %s\n", strerror(errno));
+			IAXERROR "Read error on network socket: %s", strerror(errno));
+		}
+		return NULL;
+	}
+	rx_stamp_from_msg(&msg);
+	event = iax_net_deliver(buf, res, &sin, NULL);
+	rx_stamp_valid = 0;
+	return event;
+}
+#endif
+
+#ifdef IAX_HAVE_RECVMMSG
+/* Non-zero when datagrams from the last batch are still waiting, in which
+   case the socket must not be waited on */
+static int iax_recv_pending(void)
+{
+	return recv_next < recv_count;
+}
+
+static struct iax_event *iax_net_read_batch(void)
+{
+	struct iax_event *event;
+	int i, res;
+
+	for (;;) {
+		if (recv_next >= recv_count) {
+			for (i = 0; i < recv_batch; i++) {
+				/* Replace slots handed up as events */
+				if (!recv_slots[i]) {
+					recv_slots[i] = (unsigned char *)iax_pool_alloc(IAX_RECV_SLOT_SIZE);
+					if (!recv_slots[i]) {
+						DEBU(G "Out of memory\n");
+						return NULL;
+					}
+				}
+				recv_iov[i].iov_base = recv_slots[i] + IAX_RECV_HEADROOM;
+				recv_iov[i].iov_len = IAX_RECV_SLOT_SIZE - IAX_RECV_HEADROOM;
+				memset(&recv_msgs[i].msg_hdr, 0, sizeof(recv_msgs[i].msg_hdr));
+				recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+				recv_msgs[i].msg_hdr.msg_namelen = sizeof(recv_addrs[i]);
+				recv_msgs[i].msg_hdr.msg_iov = &recv_iov[i];
+				recv_msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+				if (rx_timestamps) {
+					recv_msgs[i].msg_hdr.msg_control = recv_cmsgs[i].buf;
+					recv_msgs[i].msg_hdr.msg_controllen = sizeof(recv_cmsgs[i].buf);
+				}
+#endif
+			}
+			recv_count = recv_next = 0;
+			res = recvmmsg(netfd, recv_msgs, recv_batch, MSG_DONTWAIT, NULL);
+			if (res < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					DEBU(G "Error on read: %s\n", strerror(errno));
+					IAXERROR "Read error on network socket: %s", strerror(errno));
+				}
+				return NULL;
+			}
+			if (res == 0)
+				return NULL;
+			recv_count = res;
+		}
+
+		i = recv_next++;
+		if (recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			DEBU(G "Dropping oversized datagram from %s\n", inet_ntoa(recv_addrs[i].sin_addr));
+			continue;
+		}
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+		if (rx_timestamps)
+			rx_stamp_from_msg(&recv_msgs[i].msg_hdr);
+#endif
+		event = iax_net_deliver(recv_slots[i] + IAX_RECV_HEADROOM,
+				recv_msgs[i].msg_len, &recv_addrs[i], &recv_slots[i]);
+		rx_stamp_valid = 0;
+		return event;
+	}
+}
+#else
+#define iax_recv_pending() 0
+#endif
+
 static struct iax_event *iax_net_read(void)
 {
 	unsigned char buf[65536];
 	int res;
 	struct sockaddr_in sin;
 	socklen_t sinlen;
-	struct iax_event *event;
+
+#ifdef IAX_HAVE_RECVMMSG
+	/* Batching bypasses the recvfrom hook, so only use it on our own socket */
+	if (recv_batch && iax_recvfrom == (iax_recvfrom_t)recvfrom)
+		return iax_net_read_batch();
+#endif
+#ifdef IAX_HAVE_RX_TIMESTAMPS
+	if (rx_timestamps && iax_recvfrom == (iax_recvfrom_t)recvfrom)
+		return iax_net_read_stamped();
+#endif
 
 	sinlen = sizeof(sin);
 	res = iax_recvfrom(netfd, (char *)buf, sizeof(buf), 0, (struct sockaddr *) &sin, &sinlen);
@@ -3305,19 +4650,7 @@ static struct iax_event *iax_net_read(void)
 #endif
 		return NULL;
 	}
-	event = iax_net_process(buf, res, &sin);
-	if ( event == NULL )
-	{
-		// We have received a frame. The corresponding event is queued
-		// We need to motify the entire stack of calling functions so they
-		// don't go to sleep thinking there are no more frames to process
-		// TODO: this is buttugly from a design point of view. Basically we
-		// change libiax2 behavior to accomodate iaxclient.
-		// There must be a way to do it better.
-		event = (struct iax_event *)malloc(sizeof(struct iax_event));
-		if ( event != NULL ) event->etype = IAX_EVENT_NULL;
-	}
-	return event;
+	return iax_net_deliver(buf, res, &sin, NULL);
 }
 
 static struct iax_session *iax_txcnt_session(struct ast_iax2_full_hdr *fh, int datalen,
@@ -3339,9 +4672,10 @@ static struct iax_session *iax_txcnt_session(struct ast_iax2_full_hdr *fh, int d
 	if (!ies.transferid) {
 		return NULL;	/* TXCNT without proper IAX_IE_TRANSFERID */
 	}
-	for( cur=sessions; cur; cur=cur->next ) {
+	cur = session_by_callno(dcallno);
+	if (cur) {
 		if ((cur->transferring) && (cur->transferid == (int) ies.transferid) &&
-		   	(cur->callno == dcallno) && (cur->transfercallno == callno)) {
+		   	(cur->transfercallno == callno)) {
 			/* We're transferring ---
 			 *  skip address/port checking which would fail while
 			 *  remote peer behind symmetric NAT, verify
@@ -3349,13 +4683,21 @@ static struct iax_session *iax_txcnt_session(struct ast_iax2_full_hdr *fh, int d
 			 */
 			cur->transfer.sin_addr.s_addr = sin->sin_addr.s_addr; /* setup for further handling */
 			cur->transfer.sin_port = sin->sin_port;
-			break;
+			return cur;
 		}
 	}
-	return cur;
+	return NULL;
 }
 
 struct iax_event *iax_net_process(unsigned char *buf, int len, struct sockaddr_in *sin)
+{
+	return iax_net_process_slot(buf, len, sin, NULL);
+}
+
+/* slot, if not NULL, is the receive slot holding buf; a mini voice frame
+   may take it over as its event, leaving *slot NULL */
+static struct iax_event *iax_net_process_slot(unsigned char *buf, int len,
+		struct sockaddr_in *sin, unsigned char **slot)
 {
 	struct ast_iax2_full_hdr *fh = (struct ast_iax2_full_hdr *)buf;
 	struct ast_iax2_mini_hdr *mh = (struct ast_iax2_mini_hdr *)buf;
@@ -3388,6 +4730,9 @@ struct iax_event *iax_net_process(unsigned char *buf, int len, struct sockaddr_i
 			IAXERROR "Short header received from %s\n", inet_ntoa(sin->sin_addr));
 			return NULL;
 		}
+		/* Meta frames other than video: trunks */
+		if ((vh->zeros == 0) && !(ntohs(vh->callno) & 0x8000))
+			return iax_trunk_to_events(buf, len, sin);
 		/* Miniature, voice frame */
 		if ((vh->zeros == 0) && (ntohs(vh->callno) & 0x8000))
 		{
@@ -3401,7 +4746,7 @@ struct iax_event *iax_net_process(unsigned char *buf, int len, struct sockaddr_i
 			session = iax_find_session(sin, ntohs(fh->scallno), 0, 0);
 			if (session)
 				return iax_miniheader_to_event(session, mh,
-						len - sizeof(struct ast_iax2_mini_hdr));
+						len - sizeof(struct ast_iax2_mini_hdr), slot);
 		}
 		DEBU(G "No session?\n");
 		return NULL;
@@ -3410,26 +4755,95 @@ struct iax_event *iax_net_process(unsigned char *buf, int len, struct sockaddr_i
 
 static struct iax_sched *iax_get_sched(struct timeval tv)
 {
-	struct iax_sched *cur, *prev=NULL;
-	cur = schedq;
+	struct iax_sched *cur;
+
 	/* Check the event schedule first. */
-	while(cur) {
-		if ((tv.tv_sec > cur->when.tv_sec) ||
-		    ((tv.tv_sec == cur->when.tv_sec) &&
-			(tv.tv_usec >= cur->when.tv_usec))) {
-				/* Take it out of the event queue */
-				if (prev) {
-					prev->next = cur->next;
-				} else {
-					schedq = cur->next;
-				}
-				return cur;
-		}
-		cur = cur->next;
+	if (!schedlen)
+		return NULL;
+	cur = schedheap[0];
+	if ((tv.tv_sec > cur->when.tv_sec) ||
+	    ((tv.tv_sec == cur->when.tv_sec) &&
+		(tv.tv_usec >= cur->when.tv_usec))) {
+			/* Take it out of the event queue */
+			return sched_remove(0);
 	}
 	return NULL;
 }
 
+/* The event for what the jitterbuffer's jb_get() gave, if any */
+static struct iax_event *jb_event(struct iax_session *session, int ret, jb_frame *frame, long now)
+{
+	struct iax_event *event = NULL;
+
+	switch(ret) {
+	case JB_OK:
+		event = (struct iax_event *)frame->data;
+		if (event->etype == IAX_EVENT_VOICE) {
+			jb_hist_add(session, JB_HIST_DELAY, now - event->rxstamp);
+			if (session->interprun) {
+				jb_hist_add(session, JB_HIST_INTERP, session->interprun);
+				session->interprun = 0;
+			}
+		}
+		event = handle_event(event);
+		break;
+	case JB_INTERP:
+		session->interprun++;
+		/* create an interpolation frame */
+		//fprintf(stderr, "Making Interpolation frame\n");
+		event = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event));
+		if (event) {
+			event->etype    = IAX_EVENT_VOICE;
+			event->subclass = session->voiceformat;
+			/* XXX: ??? applications probably ignore this anyway */
+			event->ts       = now;
+			event->session  = session;
+			event->datalen  = 0;
+			event = handle_event(event);
+		}
+		break;
+	case JB_DROP:
+		iax_event_free((struct iax_event *)frame->data);
+		break;
+	case JB_NOFRAME:
+	case JB_EMPTY:
+		/* do nothing */
+		break;
+	default:
+		/* shouldn't happen */
+		break;
+	}
+	return event;
+}
+
+struct iax_event *iax_jb_pull(struct iax_session *session, long ahead)
+{
+	struct iax_event *event = NULL;
+	struct timeval tv;
+	long now;
+	jb_frame frame;
+	int ret;
+
+	if (!session->jbpull || (!session->rxcore.tv_sec && !session->rxcore.tv_usec))
+		return NULL;
+
+	tv = iax_tvnow();
+	now = (tv.tv_sec - session->rxcore.tv_sec) * 1000 +
+	      (tv.tv_usec - session->rxcore.tv_usec) / 1000 + ahead;
+
+	while (now > session->jbe->next(session->jb)) {
+		ret = session->jbe->get(session->jb, &frame, now, get_interp_len(session->voiceformat));
+		if (ret == JB_NOFRAME || ret == JB_EMPTY)
+			break;
+		/* handle_event() may destroy the session: only go round again
+		   after a drop */
+		event = jb_event(session, ret, &frame, now);
+		if (event || ret != JB_DROP)
+			break;
+	}
+	return event;
+}
+
 struct iax_event *iax_get_event(int blocking)
 {
 	struct iax_event *event;
@@ -3450,7 +4864,7 @@ struct iax_event *iax_get_event(int blocking)
 			event = handle_event(event);
 			if (event)
 			{
-				free(cur);
+				iax_pool_free(cur);
 				return event;
 			}
 		} else if(frame)
@@ -3462,19 +4876,16 @@ struct iax_event *iax_get_event(int blocking)
 				   frame. If final, destroy the session. */
 				if (frame->final)
 					destroy_session(frame->session);
-				if (frame->data)
-					free(frame->data);
-				free(frame);
+				iax_pool_free(frame);
 			} else if (frame->retries == 0)
 			{
+				iax_rtx_forget(frame);
 				if (frame->transfer)
 				{
 					/* Send a transfer reject since we weren't able to connect */
 					iax_send_txrej(frame->session);
-					if (frame->data)
-						free(frame->data);
-					free(frame);
-					free(cur);
+					iax_pool_free(frame);
+					iax_pool_free(cur);
 					break;
 				} else
 				{
@@ -3483,20 +4894,16 @@ struct iax_event *iax_get_event(int blocking)
 					if (frame->final)
 					{
 						destroy_session(frame->session);
-						if (frame->data)
-							free(frame->data);
-						free(frame);
+						iax_pool_free(frame);
 					} else
 					{
-						event = (struct iax_event *)malloc(sizeof(struct iax_event));
+						event = (struct iax_event *)iax_pool_alloc(sizeof(struct iax_event));
 						if (event)
 						{
 							event->etype = IAX_EVENT_TIMEOUT;
 							event->session = frame->session;
-							if (frame->data)
-								free(frame->data);
-							free(frame);
-							free(cur);
+							iax_pool_free(frame);
+							iax_pool_free(cur);
 							return handle_event(event);
 						}
 					}
@@ -3506,13 +4913,17 @@ struct iax_event *iax_get_event(int blocking)
 				struct ast_iax2_full_hdr *fh;
 				/* Decrement remaining retries */
 				frame->retries--;
-				/* Multiply next retry time by 4, not above MAX_RETRY_TIME though */
-				frame->retrytime *= 4;
+				frame->retrans++;
+				/* Double the next retry time, not above MAX_RETRY_TIME though */
+				frame->retrytime *= 2;
 				/* Keep under 1000 ms if this is a transfer packet */
 				if (!frame->transfer)
 				{
 					if (frame->retrytime > MAX_RETRY_TIME)
 						frame->retrytime = MAX_RETRY_TIME;
+					/* Back off the session too until a new sample arrives */
+					if (frame->session->rto && frame->session->rto < frame->retrytime)
+						frame->session->rto = frame->retrytime;
 				} else if (frame->retrytime > 1000)
 					frame->retrytime = 1000;
 				fh = (struct ast_iax2_full_hdr *)(frame->data);
@@ -3526,69 +4937,47 @@ struct iax_event *iax_get_event(int blocking)
 		{
 		    cur->func(cur->arg);
 		}
-		free(cur);
+		iax_pool_free(cur);
 	}
 
-	/* get jitterbuffer-scheduled events */
-	for ( session = sessions; session; session = session->next )
+	/* get jitterbuffer-scheduled events, from the sessions that are due */
+	event = NULL;
+	while ( !event && playlen && !tv_before(&tv, &playheap[0]->playdue) )
 	{
 		int ret;
 		long now;
 		long next;
 		jb_frame frame;
 
+		session = playheap[0];
 		now = (tv.tv_sec - session->rxcore.tv_sec) * 1000 +
 		      (tv.tv_usec - session->rxcore.tv_usec) / 1000;
 
-		if ( now <= (next = jb_next(session->jb)) )
+		if ( now <= (next = session->jbe->next(session->jb)) )
+		{
+			play_visited(session, &tv);
 			continue;
+		}
 
 		/* interp len no longer hardcoded, now determined by get_interp_len */
-		ret = jb_get(session->jb,&frame,now,get_interp_len(session->voiceformat));
-
-		switch(ret) {
-		case JB_OK:
-			event = (struct iax_event *)frame.data;
-			event = handle_event(event);
-			if (event) {
-				return event;
-			}
-			break;
-		case JB_INTERP:
-			/* create an interpolation frame */
-			//fprintf(stderr, "Making Interpolation frame\n");
-			event = (struct iax_event *)malloc(sizeof(struct iax_event));
-			if (event) {
-				event->etype    = IAX_EVENT_VOICE;
-				event->subclass = session->voiceformat;
-				/* XXX: ??? applications probably ignore this anyway */
-				event->ts       = now;
-				event->session  = session;
-				event->datalen  = 0;
-				event = handle_event(event);
-				if(event)
-					return event;
-			}
-			break;
-		case JB_DROP:
-			iax_event_free((struct iax_event *)frame.data);
-			break;
-		case JB_NOFRAME:
-		case JB_EMPTY:
-			/* do nothing */
-			break;
-		default:
-			/* shouldn't happen */
-			break;
-		}
+		ret = session->jbe->get(session->jb,&frame,now,get_interp_len(session->voiceformat));
+		/* before handle_event(), which may destroy the session */
+		play_visited(session, &tv);
+		event = jb_event(session, ret, &frame, now);
 	}
+	play_undefer();
+	if (event)
+		return event;
 
 	/* Now look for networking events */
-	if (blocking) {
+	if (blocking && !iax_recv_pending()) {
 		/* Block until there is data if desired */
 		fd_set fds;
 		int nextEventTime;
 
+		/* Nothing queued may wait while we sleep */
+		iax_flush_tx();
+
 		FD_ZERO(&fds);
 		FD_SET(netfd, &fds);
 
@@ -3637,7 +5026,7 @@ void iax_event_free(struct iax_event *event)
 		}
 		break;
 	}
-	free(event);
+	iax_pool_free(event);
 }
 
 int iax_get_fd(void)
@@ -3665,10 +5054,19 @@ int iax_quelch_moh(struct iax_session *session, int MOH)
 	return send_command(session, AST_FRAME_IAX, IAX_COMMAND_QUELCH, 0, ied.buf, ied.pos, -1);
 }
 
+void iax_set_clock(iax_clock_t clock)
+{
+	iax_clock = clock;
+}
+
 struct timeval iax_tvnow(void)
 {
 	struct timeval tv;
 
+	if (iax_clock) {
+		iax_clock(&tv);
+		return tv;
+	}
 	gettimeofday(&tv, 0);
 #if 0
 #ifdef HAVE_GETTIMEOFDAY
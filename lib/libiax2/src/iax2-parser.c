@@ -32,6 +32,7 @@
 #include "frame.h"
 #include "iax2.h"
 #include "iax2-parser.h"
+#include "iax-pool.h"
 
 static int frames = 0;
 static int iframes = 0;
@@ -788,7 +789,7 @@ void iax_frame_wrap(struct iax_frame *fr, struct ast_frame *f)
 struct iax_frame *iax_frame_new(int direction, int datalen)
 {
 	struct iax_frame *fr;
-	fr = (struct iax_frame *)malloc((int)sizeof(struct iax_frame) + datalen);
+	fr = (struct iax_frame *)iax_pool_alloc(sizeof(struct iax_frame) + datalen);
 	if (fr) {
 		fr->direction = direction;
 		fr->retrans = -1;
@@ -813,7 +814,7 @@ void iax_frame_free(struct iax_frame *fr)
 		return;
 	}
 	fr->direction = 0;
-	free(fr);
+	iax_pool_free(fr);
 	frames--;
 }
 
@@ -73,6 +73,8 @@ struct iax_frame {
 #ifdef LIBIAX
 	struct iax_session *session;
 	struct iax_event *event;
+	/* First transmission, for RTT samples */
+	struct timeval txtime;
 #endif
 
 	/* /Our/ call number */
@@ -137,6 +137,9 @@
 #define IAX_META_TRUNK				1		/* Trunk meta-message */
 #define IAX_META_VIDEO				2		/* Video frame */
 
+#define IAX_META_TRUNK_SUPERMINI	0		/* Trunk entries carry only the trunk timestamp */
+#define IAX_META_TRUNK_MINI			1		/* Trunk entries are mini frames with their own timestamps */
+
 #define IAX_RATE_8KHZ                          (1 << 0) /* 8khz sampling (default if absent) */
 #define IAX_RATE_11KHZ                         (1 << 1) /* 11.025khz sampling */
 #define IAX_RATE_16KHZ                         (1 << 2) /* 16khz sampling */
@@ -202,6 +205,12 @@ struct ast_iax2_meta_trunk_entry {
 	unsigned short len;				/* Length of data for this callno */
 } __PACKED;
 
+/* When trunk timestamps are used, each entry is a complete mini frame */
+struct ast_iax2_meta_trunk_mini {
+	unsigned short len;				/* Length of data for this entry */
+	struct ast_iax2_mini_hdr mini;	/* this is an actual miniframe */
+} __PACKED;
+
 #define IAX_FIRMWARE_MAGIC 0x69617879
 
 struct ast_iax2_firmware_header {
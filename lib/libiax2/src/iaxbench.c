@@ -0,0 +1,298 @@
+/*
+ * iaxbench: load and regression harness for libiax2
+ *
+ * Runs concurrent calls between endpoints of the in-process network
+ * simulator (iax-netsim.h) for a fixed simulated time, then reports the
+ * CPU spent per call, jitterbuffer delay percentiles and how often the
+ * jitterbuffer had to conceal a missing frame.  No network or sound card
+ * is involved and the same options and seed give the same run.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "iax-client.h"
+#include "iax-netsim.h"
+
+#define FRAME_MS	20
+#define FRAME_BYTES	160	/* 20 ms of ulaw */
+#define SETUP_MS	2000	/* allowed for call setup before measuring */
+
+struct leg {
+	struct iax_session *session;
+	int active;
+	long next_tx;
+	unsigned long voice;
+	unsigned long concealed;
+};
+
+struct call {
+	struct leg caller;
+	struct leg callee;
+};
+
+static struct call *calls;
+static int ncalls = 10;
+static int nendpoints = 2;
+static int duration = 60;
+static int measuring = 0;
+static long now_ms = 0;
+
+static int *delays;
+static int ndelays, delaysize;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: iaxbench [options]\n"
+		"  -c calls     concurrent calls (10)\n"
+		"  -n count     endpoints, calls go from endpoint i to i + 1 (2)\n"
+		"  -t seconds   simulated call duration (60)\n"
+		"  -d ms        one way delay (20)\n"
+		"  -j ms        jitter (0)\n"
+		"  -l permille  loss (0)\n"
+		"  -r permille  reordering, by 3 frame times (0)\n"
+		"  -u permille  duplication (0)\n"
+		"  -s seed      random seed (1)\n");
+	exit(1);
+}
+
+static struct leg *find_leg(struct iax_session *session)
+{
+	struct call *c = (struct call *)iax_get_private(session);
+
+	if (!c)
+		return NULL;
+	return c->caller.session == session ? &c->caller : &c->callee;
+}
+
+static void sample_delay(int delay)
+{
+	if (ndelays == delaysize) {
+		delaysize = delaysize ? delaysize * 2 : 1024;
+		delays = (int *)realloc(delays, delaysize * sizeof(*delays));
+		if (!delays) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	delays[ndelays++] = delay;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int percentile(int p)
+{
+	if (!ndelays)
+		return 0;
+	return delays[(ndelays - 1) * p / 100];
+}
+
+static void handle_event(struct iax_event *e)
+{
+	struct leg *leg;
+	int i;
+
+	switch (e->etype) {
+	case IAX_EVENT_CONNECT:
+		/* Callers put their call index in the caller id */
+		i = e->ies.calling_number ? atoi(e->ies.calling_number) : -1;
+		if (i < 0 || i >= ncalls || calls[i].callee.session) {
+			iax_reject(e->session, "Unknown call");
+			break;
+		}
+		calls[i].callee.session = e->session;
+		calls[i].callee.active = 1;
+		calls[i].callee.next_tx = now_ms;
+		iax_set_private(e->session, &calls[i]);
+		iax_accept(e->session, AST_FORMAT_ULAW);
+		iax_answer(e->session);
+		break;
+	case IAX_EVENT_ANSWER:
+		leg = find_leg(e->session);
+		if (leg && !leg->active) {
+			leg->active = 1;
+			leg->next_tx = now_ms;
+		}
+		break;
+	case IAX_EVENT_VOICE:
+		leg = find_leg(e->session);
+		if (!leg || !measuring)
+			break;
+		if (e->datalen)
+			leg->voice++;
+		else
+			leg->concealed++;
+		break;
+	case IAX_EVENT_HANGUP:
+	case IAX_EVENT_REJECT:
+	case IAX_EVENT_TIMEOUT:
+		leg = find_leg(e->session);
+		if (leg)
+			leg->active = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+static void sample_legs(void)
+{
+	struct iax_netstat local, remote;
+	int i, rtt;
+
+	for (i = 0; i < ncalls; i++) {
+		if (calls[i].caller.active &&
+		    !iax_get_netstats(calls[i].caller.session, &rtt, &local, &remote))
+			sample_delay(local.delay);
+		if (calls[i].callee.active &&
+		    !iax_get_netstats(calls[i].callee.session, &rtt, &local, &remote))
+			sample_delay(local.delay);
+	}
+}
+
+static void send_voice(struct leg *leg, unsigned char *frame)
+{
+	while (leg->active && leg->next_tx <= now_ms) {
+		iax_send_voice(leg->session, AST_FORMAT_ULAW, frame, FRAME_BYTES,
+				FRAME_BYTES);
+		leg->next_tx += FRAME_MS;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct iax_netsim_link link;
+	struct iax_netsim_stats ns;
+	struct iax_event *e;
+	struct sockaddr_in sin;
+	unsigned char frame[FRAME_BYTES];
+	unsigned long voice = 0, concealed = 0;
+	unsigned int seed = 1;
+	clock_t cpu_start, cpu_end;
+	long end_ms;
+	double cpu_us;
+	char dest[64], cid[16];
+	int i, opt, up = 0;
+
+	memset(&link, 0, sizeof(link));
+	link.delay = 20;
+	link.reorder_delay = 3 * FRAME_MS;
+
+	while ((opt = getopt(argc, argv, "c:n:t:d:j:l:r:u:s:")) != -1) {
+		switch (opt) {
+		case 'c': ncalls = atoi(optarg); break;
+		case 'n': nendpoints = atoi(optarg); break;
+		case 't': duration = atoi(optarg); break;
+		case 'd': link.delay = atoi(optarg); break;
+		case 'j': link.jitter = atoi(optarg); break;
+		case 'l': link.loss = atoi(optarg); break;
+		case 'r': link.reorder = atoi(optarg); break;
+		case 'u': link.duplicate = atoi(optarg); break;
+		case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (ncalls < 1 || nendpoints < 1 || duration < 1)
+		usage();
+
+	if (iax_netsim_init(nendpoints, seed) < 0) {
+		fprintf(stderr, "Unable to start the network simulator\n");
+		return 1;
+	}
+	iax_netsim_set_link(-1, -1, &link);
+	iax_disable_debug();
+
+	calls = (struct call *)calloc(ncalls, sizeof(*calls));
+	if (!calls) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	memset(frame, 0xFF, sizeof(frame));
+
+	for (i = 0; i < ncalls; i++) {
+		iax_netsim_select(i % nendpoints);
+		iax_netsim_addr((i + 1) % nendpoints, &sin);
+		calls[i].caller.session = iax_session_new();
+		if (!calls[i].caller.session) {
+			fprintf(stderr, "Unable to create session\n");
+			return 1;
+		}
+		iax_set_private(calls[i].caller.session, &calls[i]);
+		snprintf(dest, sizeof(dest), "bench@%s/%d", inet_ntoa(sin.sin_addr), i);
+		snprintf(cid, sizeof(cid), "%d", i);
+		iax_call(calls[i].caller.session, cid, "iaxbench", dest, NULL, 0,
+				AST_FORMAT_ULAW, AST_FORMAT_ULAW);
+	}
+
+	end_ms = SETUP_MS + duration * 1000L;
+	cpu_start = clock();
+	for (now_ms = 0; now_ms < end_ms; now_ms++) {
+		if (!measuring && now_ms >= SETUP_MS) {
+			measuring = 1;
+			cpu_start = clock();
+		}
+		for (i = 0; i < ncalls; i++) {
+			send_voice(&calls[i].caller, frame);
+			send_voice(&calls[i].callee, frame);
+		}
+		/* voice going into a jitterbuffer gives no event, so read on
+		   until nothing more is deliverable, or the harness would
+		   fall behind the simulated link as the calls grow */
+		do {
+			while ((e = iax_get_event(0))) {
+				handle_event(e);
+				iax_event_free(e);
+			}
+		} while (iax_netsim_next_delivery() == 0);
+		if (measuring && now_ms % 1000 == 0)
+			sample_legs();
+		iax_netsim_advance(1);
+	}
+	cpu_end = clock();
+
+	for (i = 0; i < ncalls; i++) {
+		if (calls[i].caller.active && calls[i].callee.active)
+			up++;
+		voice += calls[i].caller.voice + calls[i].callee.voice;
+		concealed += calls[i].caller.concealed + calls[i].callee.concealed;
+	}
+	qsort(delays, ndelays, sizeof(*delays), cmp_int);
+	iax_netsim_get_stats(&ns);
+	cpu_us = (double)(cpu_end - cpu_start) * 1000000.0 / CLOCKS_PER_SEC;
+
+	printf("calls:        %d of %d up, %d endpoints, %d s simulated\n",
+			up, ncalls, nendpoints, duration);
+	printf("link:         delay %d ms, jitter %d ms, loss %d, reorder %d, "
+			"duplicate %d (per mille)\n", link.delay, link.jitter,
+			link.loss, link.reorder, link.duplicate);
+	printf("cpu:          %.1f us per call per simulated second\n",
+			cpu_us / ncalls / duration);
+	printf("jb delay:     p50 %d ms, p90 %d ms, p99 %d ms, max %d ms\n",
+			percentile(50), percentile(90), percentile(99),
+			ndelays ? delays[ndelays - 1] : 0);
+	printf("voice:        %lu frames played, %lu concealed (%.2f%%)\n",
+			voice, concealed,
+			voice + concealed ? 100.0 * concealed / (voice + concealed) : 0.0);
+	printf("network:      %lu sent, %lu delivered, %lu lost, %lu reordered, "
+			"%lu duplicated\n", ns.sent, ns.delivered, ns.lost,
+			ns.reordered, ns.duplicated);
+
+	iax_netsim_destroy();
+	free(delays);
+	free(calls);
+	return up == ncalls ? 0 : 2;
+}
@@ -0,0 +1,92 @@
+/*
+ * jitterbuf: interchangeable jitterbuffer implementations
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <string.h>
+
+#include "jb-engine.h"
+
+static void *default_create(void)
+{
+	return jb_new();
+}
+
+static void default_destroy(void *jb)
+{
+	jb_destroy((jitterbuf *)jb);
+}
+
+static void default_reset(void *jb)
+{
+	jb_reset((jitterbuf *)jb);
+}
+
+static enum jb_return_code default_put(void *jb, void *data, const enum jb_frame_type type, long ms, long ts, long now)
+{
+	return jb_put((jitterbuf *)jb, data, type, ms, ts, now);
+}
+
+static enum jb_return_code default_get(void *jb, jb_frame *frame, long now, long interpl)
+{
+	return jb_get((jitterbuf *)jb, frame, now, interpl);
+}
+
+static enum jb_return_code default_getall(void *jb, jb_frame *frameout)
+{
+	return jb_getall((jitterbuf *)jb, frameout);
+}
+
+static long default_next(void *jb)
+{
+	return jb_next((jitterbuf *)jb);
+}
+
+static enum jb_return_code default_getinfo(void *jb, jb_info *stats)
+{
+	return jb_getinfo((jitterbuf *)jb, stats);
+}
+
+static enum jb_return_code default_setconf(void *jb, jb_conf *conf)
+{
+	return jb_setconf((jitterbuf *)jb, conf);
+}
+
+static enum jb_return_code default_stretch(void *jb, long ms)
+{
+	return jb_stretch((jitterbuf *)jb, ms);
+}
+
+const jb_engine jb_engine_default = {
+	"jitterbuf",
+	default_create,
+	default_destroy,
+	default_reset,
+	default_put,
+	default_get,
+	default_getall,
+	default_next,
+	default_getinfo,
+	default_setconf,
+	default_stretch,
+};
+
+const jb_engine * const jb_engines[] = {
+	&jb_engine_default,
+	&jb_engine_speex,
+	NULL
+};
+
+const jb_engine *jb_engine_find(const char *name)
+{
+	int i;
+
+	if (!name)
+		return &jb_engine_default;
+	for (i = 0; jb_engines[i]; i++)
+		if (!strcmp(jb_engines[i]->name, name))
+			return jb_engines[i];
+	return NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * jitterbuf: interchangeable jitterbuffer implementations
+ *
+ * Each engine takes the same frames, configuration and statistics as
+ * jitterbuf.h and is driven the same way: jb_put() frames as they
+ * arrive, and jb_get() whenever jb_next() says something is due.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _JB_ENGINE_H_
+#define _JB_ENGINE_H_
+
+#include "jitterbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jb_engine {
+	const char *name;
+	void *			(*create)(void);
+	void			(*destroy)(void *jb);
+	/* as jb_reset(): the jitterbuffer should be empty first */
+	void			(*reset)(void *jb);
+	enum jb_return_code	(*put)(void *jb, void *data, const enum jb_frame_type type, long ms, long ts, long now);
+	enum jb_return_code	(*get)(void *jb, jb_frame *frame, long now, long interpl);
+	enum jb_return_code	(*getall)(void *jb, jb_frame *frameout);
+	long			(*next)(void *jb);
+	enum jb_return_code	(*getinfo)(void *jb, jb_info *stats);
+	enum jb_return_code	(*setconf)(void *jb, jb_conf *conf);
+	enum jb_return_code	(*stretch)(void *jb, long ms);
+} jb_engine;
+
+/* jitterbuf.c: tracks the delay distribution and plays out at its
+ * high percentile plus target_extra */
+extern const jb_engine jb_engine_default;
+/* jb-speex.c: the Speex adaptive jitter buffer's algorithm, which grows
+ * and shrinks a frame at a time from how early or late frames arrive
+ * relative to playout */
+extern const jb_engine jb_engine_speex;
+
+/* NULL terminated, the default first */
+extern const jb_engine * const jb_engines[];
+
+/* The engine called name, or NULL; a NULL name is the default */
+const jb_engine *jb_engine_find(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * jitterbuf: the Speex adaptive jitter buffer, as a jitterbuffer engine
+ *
+ * The playout algorithm is the one in libspeex/jitter.c (Jean-Marc
+ * Valin, Xiph.Org), which can't be used as it is: it decodes Speex
+ * itself and copies each packet.  Here frames of any codec are queued
+ * as they are, and jb_next() answers when its playout clock would next
+ * ask for a frame, so this can run wherever jitterbuf.c does.
+ *
+ * Each voice frame that arrives is counted in a histogram of its
+ * arrival margin, how many frame times ahead of playout it came, with
+ * JBS_LATE_BINS bins below for frames that missed it.  A short and a
+ * long term histogram decay at different rates.  When too many frames
+ * are late the buffer grows by a frame, interpolating instead of
+ * advancing; when nearly all are early it shrinks by skipping one.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jb-engine.h"
+
+#define JBS_MARGINS	12	/* histogram bins */
+#define JBS_LATE_BINS	4	/* of which for late frames */
+#define JBS_MAX_LOST	25	/* restart playout after this many lost in a row */
+#define JBS_HISTORY	64	/* transit times kept for min and jitter */
+
+typedef struct jb_speex {
+	jb_info info;
+
+	jb_frame *frames;	/* queued, in ts order, from jb_frame_alloc() */
+
+	long frame_ms;		/* length of the last voice frame, 0 until the first */
+	int playing;		/* playout clock running */
+	int resync;		/* the next start forgets the delay and histograms */
+	long expect_ts;		/* ts of the next voice frame to play */
+	long next_get;		/* receiver's time it is due */
+	long last_now;
+
+	int lost_count;
+	float loss_rate;
+	float shortterm[JBS_MARGINS];
+	float longterm[JBS_MARGINS];
+
+	long transit[JBS_HISTORY];
+	int transit_ptr;
+	int transit_count;
+} jb_speex;
+
+static void jbs_reset(void *p)
+{
+	jb_speex *jb = (jb_speex *)p;
+	jb_conf conf = jb->info.conf;
+
+	memset(jb, 0, sizeof(*jb));
+	jb->info.conf = conf;
+	jb->resync = 1;
+	jb->info.current = jb->info.target = conf.target_extra;
+	jb->info.silence_begin_ts = -1;
+}
+
+static void *jbs_create(void)
+{
+	jb_speex *jb;
+
+	if (!(jb = (jb_speex *)calloc(1, sizeof(*jb))))
+		return NULL;
+	jb->info.conf.target_extra = JB_TARGET_EXTRA;
+	jbs_reset(jb);
+	return jb;
+}
+
+static void jbs_destroy(void *p)
+{
+	jb_speex *jb = (jb_speex *)p;
+	jb_frame *f;
+
+	while ((f = jb->frames)) {
+		jb->frames = f->next;
+		jb_frame_free(f);
+	}
+	free(jb);
+}
+
+/* Take the frame at *pp off the queue, into frameout */
+static void jbs_unqueue(jb_speex *jb, jb_frame **pp, jb_frame *frameout)
+{
+	jb_frame *f = *pp;
+
+	*pp = f->next;
+	*frameout = *f;
+	frameout->next = frameout->prev = NULL;
+	jb_frame_free(f);
+	jb->info.frames_cur--;
+}
+
+/* receiver's time the frame with ts is played */
+static long jbs_playtime(jb_speex *jb, long ts)
+{
+	return ts - jb->expect_ts + jb->next_get;
+}
+
+/* voice with ts is too old to play: its slot has gone */
+static int jbs_stale(jb_speex *jb, long ts)
+{
+	return ts - jb->expect_ts <= -(jb->frame_ms / 2);
+}
+
+/* Start playout from the voice frame with ts.  After a resync it goes out
+ * target_extra from now and the histograms start over; otherwise, after
+ * silence, it keeps the delay the last talkspurt ended with. */
+static void jbs_start(jb_speex *jb, long ts, long now)
+{
+	long delay = jb->info.conf.target_extra;
+
+	if (jb->resync) {
+		if (delay < 0)
+			delay = 0;
+		jb->next_get = now + delay;
+		memset(jb->shortterm, 0, sizeof(jb->shortterm));
+		memset(jb->longterm, 0, sizeof(jb->longterm));
+	} else {
+		jb->next_get = jbs_playtime(jb, ts);
+		if (jb->next_get < now)
+			jb->next_get = now;
+	}
+	jb->expect_ts = ts;
+	jb->playing = 1;
+	jb->resync = 0;
+	jb->lost_count = 0;
+	jb->info.cnt_contig_interp = 0;
+	jb->info.silence_begin_ts = 0;
+}
+
+/* Stop playout, or carry on from the next queued voice if there is any */
+static void jbs_stop(jb_speex *jb, long now, int resync)
+{
+	jb_frame *f;
+
+	jb->resync = resync;
+	for (f = jb->frames; f; f = f->next) {
+		if (f->type == JB_TYPE_VOICE) {
+			jbs_start(jb, f->ts, now);
+			return;
+		}
+	}
+	jb->playing = 0;
+	jb->info.silence_begin_ts = jb->expect_ts;
+}
+
+static void jbs_update_info(jb_speex *jb)
+{
+	long min, max;
+	int i;
+
+	if (jb->playing)
+		jb->info.current = jb->next_get - jb->expect_ts;
+	/* no target of its own: it steers by the margin histograms */
+	jb->info.target = jb->info.current;
+	jb->info.next_voice_ts = jb->next_get;
+	jb->info.last_voice_ms = jb->frame_ms;
+	jb->info.losspct = (long)(jb->loss_rate * 100000);
+
+	if (!jb->transit_count)
+		return;
+	min = max = jb->transit[0];
+	for (i = 1; i < jb->transit_count; i++) {
+		if (jb->transit[i] < min)
+			min = jb->transit[i];
+		if (jb->transit[i] > max)
+			max = jb->transit[i];
+	}
+	jb->info.min = min;
+	jb->info.jitter = max - min;
+}
+
+static enum jb_return_code jbs_put(void *p, void *data, const enum jb_frame_type type, long ms, long ts, long now)
+{
+	jb_speex *jb = (jb_speex *)p;
+	jb_frame *f, **pp;
+	long margin;
+	int i, bin;
+
+	jb->info.frames_in++;
+	jb->last_now = now;
+
+	if (type == JB_TYPE_VOICE) {
+		if (ms <= 0)
+			ms = jb->frame_ms ? jb->frame_ms : 20;
+		if (!jb->frame_ms)
+			jb->frame_ms = ms;
+
+		jb->transit[jb->transit_ptr] = now - ts;
+		jb->transit_ptr = (jb->transit_ptr + 1) % JBS_HISTORY;
+		if (jb->transit_count < JBS_HISTORY)
+			jb->transit_count++;
+
+		if (!jb->playing)
+			jbs_start(jb, ts, now);
+
+		margin = ts - jb->expect_ts;
+		if (jb->info.conf.resync_threshold > 0 &&
+		    (margin > jb->info.conf.resync_threshold ||
+		     margin < -jb->info.conf.resync_threshold)) {
+			/* the sender's clock jumped */
+			jb->info.cnt_delay_discont++;
+			jb->resync = 1;
+			jbs_start(jb, ts, now);
+			margin = 0;
+		}
+
+		/* where it lands in the histograms, as speex_jitter_put() */
+		if (margin >= -JBS_LATE_BINS * jb->frame_ms) {
+			for (i = 0; i < JBS_MARGINS; i++) {
+				jb->shortterm[i] *= .98f;
+				jb->longterm[i] *= .995f;
+			}
+			bin = (int)((margin + JBS_LATE_BINS * jb->frame_ms) / jb->frame_ms);
+			if (bin > JBS_MARGINS - 1)
+				bin = JBS_MARGINS - 1;
+			jb->shortterm[bin] += .02f;
+			jb->longterm[bin] += .005f;
+		}
+
+		jbs_update_info(jb);
+
+		if (jbs_stale(jb, ts)) {
+			jb->info.frames_late++;
+			return JB_DROP;
+		}
+	}
+
+	if (!(f = jb_frame_alloc()))
+		return JB_DROP;
+	f->data = data;
+	f->ts = ts;
+	f->ms = ms;
+	f->type = type;
+	f->prev = NULL;
+
+	for (pp = &jb->frames; *pp && (*pp)->ts <= ts; pp = &(*pp)->next)
+		;
+	if (*pp && type == JB_TYPE_VOICE)
+		jb->info.frames_ooo++;
+	f->next = *pp;
+	*pp = f;
+	jb->info.frames_cur++;
+	return JB_OK;
+}
+
+static enum jb_return_code jbs_get(void *p, jb_frame *frameout, long now, long interpl)
+{
+	jb_speex *jb = (jb_speex *)p;
+	float late_short = 0, late_long = 0, ontime_short, ontime_long;
+	float early_short = 0, early_long = 0;
+	jb_frame *f = jb->frames, **pp;
+	long half;
+	int i, clamped;
+
+	jb->last_now = now;
+
+	if (f && f->type != JB_TYPE_VOICE &&
+	    (!jb->playing || jbs_playtime(jb, f->ts) <= now)) {
+		jbs_unqueue(jb, &jb->frames, frameout);
+		jb->info.frames_out++;
+		if (frameout->type == JB_TYPE_SILENCE)
+			jbs_stop(jb, now, 0);
+		return JB_OK;
+	}
+	if (!jb->playing)
+		return f ? JB_NOFRAME : JB_EMPTY;
+
+	if (f && f->type == JB_TYPE_VOICE && jbs_stale(jb, f->ts)) {
+		/* skipped over when shrinking */
+		jbs_unqueue(jb, &jb->frames, frameout);
+		jb->info.frames_out++;
+		jb->info.frames_dropped++;
+		return JB_DROP;
+	}
+	if (now < jb->next_get)
+		return JB_NOFRAME;
+
+	/* as speex_jitter_get() */
+	for (i = 0; i < JBS_LATE_BINS; i++) {
+		late_short += jb->shortterm[i];
+		late_long += jb->longterm[i];
+	}
+	ontime_short = jb->shortterm[JBS_LATE_BINS];
+	ontime_long = jb->longterm[JBS_LATE_BINS];
+	for (i = JBS_LATE_BINS + 1; i < JBS_MARGINS; i++) {
+		early_short += jb->shortterm[i];
+		early_long += jb->longterm[i];
+	}
+	clamped = jb->info.conf.max_jitterbuf &&
+		jb->info.current - jb->info.min >= jb->info.conf.max_jitterbuf;
+
+	if (!clamped && (late_short > .1f || late_long > .03f)) {
+		/* grow: everything arrives a bin earlier from now on */
+		jb->shortterm[JBS_MARGINS - 1] += jb->shortterm[JBS_MARGINS - 2];
+		jb->longterm[JBS_MARGINS - 1] += jb->longterm[JBS_MARGINS - 2];
+		for (i = JBS_MARGINS - 2; i >= 0; i--) {
+			jb->shortterm[i + 1] = jb->shortterm[i];
+			jb->longterm[i + 1] = jb->longterm[i];
+		}
+		jb->shortterm[0] = 0;
+		jb->longterm[0] = 0;
+		jb->next_get += interpl;
+		jb->info.last_adjustment = now;
+		jbs_update_info(jb);
+		return JB_INTERP;
+	}
+
+	if (clamped || (late_short + ontime_short < .005f &&
+			late_long + ontime_long < .01f && early_short > .8f)) {
+		/* shrink: skip a frame */
+		jb->shortterm[0] += jb->shortterm[1];
+		jb->longterm[0] += jb->longterm[1];
+		for (i = 1; i < JBS_MARGINS - 1; i++) {
+			jb->shortterm[i] = jb->shortterm[i + 1];
+			jb->longterm[i] = jb->longterm[i + 1];
+		}
+		jb->shortterm[JBS_MARGINS - 1] = 0;
+		jb->longterm[JBS_MARGINS - 1] = 0;
+		jb->expect_ts += jb->frame_ms;
+		jb->info.last_adjustment = now;
+	}
+
+	/* the frame for this slot, if it came; follow its ts if it is off
+	 * the grid */
+	half = jb->frame_ms / 2;
+	for (pp = &jb->frames; (f = *pp) && f->ts - jb->expect_ts <= half; pp = &f->next) {
+		if (f->type == JB_TYPE_VOICE && !jbs_stale(jb, f->ts)) {
+			jb->frame_ms = f->ms;
+			jb->expect_ts = f->ts + f->ms;
+			jb->next_get += f->ms;
+			jbs_unqueue(jb, pp, frameout);
+			jb->info.frames_out++;
+			jb->info.cnt_contig_interp = 0;
+			jb->lost_count = 0;
+			jb->loss_rate *= .999f;
+			jbs_update_info(jb);
+			return JB_OK;
+		}
+	}
+
+	jb->expect_ts += interpl;
+	jb->next_get += interpl;
+	jb->info.frames_lost++;
+	jb->info.cnt_contig_interp++;
+	jb->loss_rate = .999f * jb->loss_rate + .001f;
+	if (++jb->lost_count >= JBS_MAX_LOST)
+		jbs_stop(jb, now, 1);
+	else if (jb->info.conf.max_contig_interp &&
+		 jb->info.cnt_contig_interp >= jb->info.conf.max_contig_interp)
+		jbs_stop(jb, now, 0);
+	jbs_update_info(jb);
+	return JB_INTERP;
+}
+
+static enum jb_return_code jbs_getall(void *p, jb_frame *frameout)
+{
+	jb_speex *jb = (jb_speex *)p;
+
+	if (!jb->frames)
+		return JB_NOFRAME;
+	jbs_unqueue(jb, &jb->frames, frameout);
+	return JB_OK;
+}
+
+static long jbs_next(void *p)
+{
+	jb_speex *jb = (jb_speex *)p;
+	jb_frame *f = jb->frames;
+	long t;
+
+	if (f && f->type != JB_TYPE_VOICE) {
+		if (!jb->playing)
+			return jb->last_now - 1;
+		t = jbs_playtime(jb, f->ts);
+		if (t < jb->next_get)
+			return t - 1;
+	} else if (f && jb->playing && jbs_stale(jb, f->ts)) {
+		return jb->last_now - 1;
+	}
+	return jb->playing ? jb->next_get - 1 : JB_LONGMAX;
+}
+
+static enum jb_return_code jbs_getinfo(void *p, jb_info *stats)
+{
+	jb_speex *jb = (jb_speex *)p;
+
+	jbs_update_info(jb);
+	*stats = jb->info;
+	return JB_OK;
+}
+
+static enum jb_return_code jbs_setconf(void *p, jb_conf *conf)
+{
+	jb_speex *jb = (jb_speex *)p;
+
+	jb->info.conf = *conf;
+	/* -1 indicates use of the default JB_TARGET_EXTRA value */
+	if (conf->target_extra == -1)
+		jb->info.conf.target_extra = JB_TARGET_EXTRA;
+	if (!jb->playing)
+		jb->info.current = jb->info.target = jb->info.conf.target_extra;
+	return JB_OK;
+}
+
+static enum jb_return_code jbs_stretch(void *p, long ms)
+{
+	jb_speex *jb = (jb_speex *)p;
+
+	if (jb->playing) {
+		jb->next_get += ms;
+		jbs_update_info(jb);
+	}
+	return JB_OK;
+}
+
+const jb_engine jb_engine_speex = {
+	"speex",
+	jbs_create,
+	jbs_destroy,
+	jbs_reset,
+	jbs_put,
+	jbs_get,
+	jbs_getall,
+	jbs_next,
+	jbs_getinfo,
+	jbs_setconf,
+	jbs_stretch,
+};
@@ -0,0 +1,211 @@
+/*
+ * jitterbuf: replay of recorded traces, for tuning jb_conf offline
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#include <windows.h>
+#endif
+
+#include "jb-trace.h"
+
+/* how long to keep playing after the last arrival, at most */
+#define REPLAY_DRAIN_MS	60000
+
+int jb_trace_load(const char *path, jb_trace_frame **frames)
+{
+	jb_trace_frame *f = NULL, *tmp;
+	char line[256], type;
+	long ts, arrival, ms;
+	int count = 0, size = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		return -1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			continue;
+		type = 'v';
+		ms = 20;
+		if (sscanf(line, "%ld %ld %c %ld", &ts, &arrival, &type, &ms) < 2)
+			continue;
+
+		if (count == size) {
+			size = size ? size * 2 : 4096;
+			if (!(tmp = (jb_trace_frame *)realloc(f, size * sizeof(*f)))) {
+				free(f);
+				fclose(fp);
+				return -1;
+			}
+			f = tmp;
+		}
+		f[count].ts = ts;
+		f[count].arrival = arrival;
+		f[count].type = type == 'c' ? JB_TYPE_CONTROL :
+				type == 's' ? JB_TYPE_SILENCE : JB_TYPE_VOICE;
+		f[count].ms = ms;
+		count++;
+	}
+
+	fclose(fp);
+	*frames = f;
+	return count;
+}
+
+/* CPU time used by this thread, ns */
+static double replay_cpu_ns(void)
+{
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+	FILETIME created, exited, kernel, user;
+
+	if (GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+		return (((double)user.dwHighDateTime * 4294967296.0) + user.dwLowDateTime +
+			((double)kernel.dwHighDateTime * 4294967296.0) + kernel.dwLowDateTime) * 100.0;
+	return 0;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+	return clock() * (1e9 / CLOCKS_PER_SEC);
+#endif
+}
+
+static int arrival_cmp(const void *a, const void *b)
+{
+	const jb_trace_frame *x = *(const jb_trace_frame **)a;
+	const jb_trace_frame *y = *(const jb_trace_frame **)b;
+
+	if (x->arrival != y->arrival)
+		return x->arrival < y->arrival ? -1 : 1;
+	/* frames arriving together keep their trace order */
+	return x < y ? -1 : x > y;
+}
+
+static long delay_percentile(const long *hist, long n, int pct)
+{
+	long want = (n - 1) * pct / 100, seen = 0;
+	int d;
+
+	for (d = 0; d <= JB_REPLAY_MAXDELAY; d++) {
+		seen += hist[d];
+		if (seen > want)
+			return d;
+	}
+	return JB_REPLAY_MAXDELAY;
+}
+
+int jb_replay(const jb_trace_frame *frames, int count, const jb_engine *engine,
+		const jb_conf *conf, long interpl, jb_replay_stats *stats)
+{
+	const jb_trace_frame **order;
+	const jb_trace_frame *f;
+	void *jb;
+	jb_frame frame;
+	jb_info info;
+	jb_conf c = *conf;
+	long *hist;
+	long now, end, next, drops = 0, delay;
+	double start, total = 0;
+	int i, j, ret;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->frames = count;
+	if (count <= 0)
+		return 0;
+
+	order = (const jb_trace_frame **)malloc(count * sizeof(*order));
+	hist = (long *)calloc(JB_REPLAY_MAXDELAY + 1, sizeof(*hist));
+	if (!engine)
+		engine = &jb_engine_default;
+	jb = engine->create();
+	if (!order || !hist || !jb) {
+		free(order);
+		free(hist);
+		if (jb)
+			engine->destroy(jb);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		order[i] = &frames[i];
+	qsort((void *)order, count, sizeof(*order), arrival_cmp);
+	engine->setconf(jb, &c);
+
+	start = replay_cpu_ns();
+	end = order[count - 1]->arrival + REPLAY_DRAIN_MS;
+	i = 0;
+	for (now = order[0]->arrival; now < end; now++) {
+		for (; i < count && order[i]->arrival <= now; i++) {
+			f = order[i];
+			if (f->type == JB_TYPE_VOICE)
+				stats->voice++;
+			/* refused as a delay discontinuity, before any resync */
+			if (engine->put(jb, (void *)f, f->type, f->ms, f->ts, now) == JB_DROP)
+				stats->late++;
+		}
+
+		if (i == count) {
+			engine->getinfo(jb, &info);
+			if (!info.frames_cur)
+				break;
+		}
+
+		for (j = 0; j < 10; j++) {
+			next = engine->next(jb);
+			if (now <= next)
+				break;
+
+			ret = engine->get(jb, &frame, now, interpl);
+			if (ret == JB_NOFRAME || ret == JB_EMPTY)
+				break;
+
+			f = (const jb_trace_frame *)frame.data;
+			if (ret == JB_INTERP) {
+				stats->interp++;
+			} else if (ret == JB_DROP) {
+				drops++;
+			} else if (f->type == JB_TYPE_VOICE) {
+				stats->played++;
+				delay = now - f->arrival;
+				if (delay > JB_REPLAY_MAXDELAY)
+					delay = JB_REPLAY_MAXDELAY;
+				if (delay < 0)
+					delay = 0;
+				hist[delay]++;
+				total += delay;
+			}
+		}
+	}
+	stats->cpu_ns = (replay_cpu_ns() - start) / count;
+	engine->getinfo(jb, &info);
+	stats->lost = info.frames_lost;
+	/* frames handed back to drop are late, unless dropped to shrink */
+	stats->dropped = info.frames_dropped;
+	stats->late += drops - info.frames_dropped;
+
+	if (stats->played) {
+		stats->delay_mean = total / stats->played;
+		stats->delay_p50 = delay_percentile(hist, stats->played, 50);
+		stats->delay_p90 = delay_percentile(hist, stats->played, 90);
+		stats->delay_p99 = delay_percentile(hist, stats->played, 99);
+		stats->delay_max = delay_percentile(hist, stats->played, 100);
+	}
+
+	/* whatever is left belongs to the trace, not to us */
+	while (engine->getall(jb, &frame) == JB_OK)
+		;
+	engine->destroy(jb);
+	free(hist);
+	free(order);
+	return 0;
+}
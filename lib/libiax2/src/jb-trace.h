@@ -0,0 +1,70 @@
+/*
+ * jitterbuf: replay of recorded traces, for tuning jb_conf offline
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU Lesser (Library) General Public License
+ */
+
+#ifndef _JB_TRACE_H_
+#define _JB_TRACE_H_
+
+#include "jb-engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Playout delays above this many ms are counted as this many */
+#define JB_REPLAY_MAXDELAY	5000
+
+/* One received frame.  Traces are text, one frame per line: sender
+ * timestamp and arrival time in ms, then optionally the frame type (v
+ * voice, s silence, c control) and length in ms, separated by white
+ * space.  Frames are 20 ms of voice by default.  Further columns and
+ * lines starting with '#' are ignored. */
+typedef struct jb_trace_frame {
+	long ts;			/* sender's timestamp */
+	long arrival;			/* receiver's clock when it arrived */
+	enum jb_frame_type type;
+	long ms;			/* length, for voice */
+} jb_trace_frame;
+
+typedef struct jb_replay_stats {
+	long frames;		/* frames in the trace */
+	long voice;		/* voice frames in the trace */
+	long played;		/* voice frames played */
+	long late;		/* voice frames dropped for arriving too late, or
+				   too far off the delay history on arrival */
+	long dropped;		/* voice frames dropped to shrink the buffer */
+	long interp;		/* interpolated frames asked for */
+	long lost;		/* frames the jitterbuffer counted as lost */
+
+	/* playout delay of played voice: arrival to play out, ms */
+	double delay_mean;
+	long delay_p50;
+	long delay_p90;
+	long delay_p99;
+	long delay_max;
+
+	double cpu_ns;		/* CPU time per trace frame, ns */
+} jb_replay_stats;
+
+/* Reads a trace into a malloc()ed array, returning the number of frames
+ * or -1 if the file can't be read.  Lines that can't be parsed are
+ * skipped. */
+int jb_trace_load(const char *path, jb_trace_frame **frames);
+
+/* Plays frames out through a new jitterbuffer of the given engine (NULL
+ * for the default) set up with conf, with a simulated clock stepped 1 ms
+ * at a time, calling jb_get() whenever jb_next() says a frame is due as
+ * iax_get_event() does.  Missing voice is interpolated interpl ms at a
+ * time.  Returns 0, or -1 if out of memory.  Safe to run on several
+ * threads at once. */
+int jb_replay(const jb_trace_frame *frames, int count, const jb_engine *engine,
+		const jb_conf *conf, long interpl, jb_replay_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
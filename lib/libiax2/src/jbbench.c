@@ -0,0 +1,476 @@
+/*
+ * jbbench: jitterbuffer history benchmark
+ *
+ * Feeds jitter traces through the jitterbuffer history and times the
+ * drop-percentile min/max lookups against the rescanning maxbuf/minbuf
+ * code the skiplist replaced, checking both give the same answers.
+ * With -q it instead plays the traces out through jb_put()/jb_get()
+ * twice, queueing in the ring and on the list only, and checks every
+ * result is the same.
+ *
+ * A trace is text, one frame per line: sender timestamp and arrival
+ * time in ms, then optionally the frame type (v voice, s silence, c
+ * control) and length in ms, separated by white space.  Frames are
+ * voice of FRAME_MS by default.  Further columns and lines starting
+ * with '#' are ignored.  Without a trace file a jittery link is
+ * synthesized.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the history functions are static */
+#include "jitterbuf.c"
+
+#define FRAME_MS	20
+
+struct sample {
+	long ts;
+	long now;
+	enum jb_frame_type type;
+	long ms;
+};
+
+/* The rescanning history, as it was before the skiplist */
+struct legacy {
+	long history[JB_HISTORY_SZ];
+	int  hist_ptr;
+	long hist_maxbuf[JB_HISTORY_MAXBUF_SZ];
+	long hist_minbuf[JB_HISTORY_MAXBUF_SZ];
+	int  hist_maxbuf_valid;
+};
+
+static struct sample *trace;
+static int ntrace, tracesize;
+static long threshold = 1000;
+
+static void legacy_put(struct legacy *h, long delay, int resync)
+{
+	long kicked;
+
+	if (resync) {
+		h->hist_ptr = 0;
+		h->hist_maxbuf_valid = 0;
+	}
+
+	kicked = h->history[h->hist_ptr % JB_HISTORY_SZ];
+	h->history[(h->hist_ptr++) % JB_HISTORY_SZ] = delay;
+
+	if (!h->hist_maxbuf_valid)
+		return;
+	if (h->hist_ptr < JB_HISTORY_SZ ||
+	    delay < h->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1] ||
+	    delay > h->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1] ||
+	    kicked <= h->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1] ||
+	    kicked >= h->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])
+		h->hist_maxbuf_valid = 0;
+}
+
+static void legacy_calc_maxbuf(struct legacy *h)
+{
+	int i, j;
+
+	if (h->hist_ptr == 0)
+		return;
+
+	for (i = 0; i < JB_HISTORY_MAXBUF_SZ; i++) {
+		h->hist_maxbuf[i] = JB_LONGMIN;
+		h->hist_minbuf[i] = JB_LONGMAX;
+	}
+
+	i = (h->hist_ptr > JB_HISTORY_SZ) ? (h->hist_ptr - JB_HISTORY_SZ) : 0;
+	for (; i < h->hist_ptr; i++) {
+		long toins = h->history[i % JB_HISTORY_SZ];
+
+		if (toins > h->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1]) {
+			for (j = 0; j < JB_HISTORY_MAXBUF_SZ; j++) {
+				if (toins > h->hist_maxbuf[j]) {
+					memmove(h->hist_maxbuf + j + 1, h->hist_maxbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(h->hist_maxbuf[0]));
+					h->hist_maxbuf[j] = toins;
+					break;
+				}
+			}
+		}
+		if (toins < h->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1]) {
+			for (j = 0; j < JB_HISTORY_MAXBUF_SZ; j++) {
+				if (toins < h->hist_minbuf[j]) {
+					memmove(h->hist_minbuf + j + 1, h->hist_minbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(h->hist_minbuf[0]));
+					h->hist_minbuf[j] = toins;
+					break;
+				}
+			}
+		}
+	}
+	h->hist_maxbuf_valid = 1;
+}
+
+static void legacy_get(struct legacy *h, long *min, long *jitter)
+{
+	int count, index;
+
+	if (!h->hist_maxbuf_valid)
+		legacy_calc_maxbuf(h);
+
+	count = (h->hist_ptr < JB_HISTORY_SZ) ? h->hist_ptr : JB_HISTORY_SZ;
+	index = count * JB_HISTORY_DROPPCT / 100;
+	if (index > (JB_HISTORY_MAXBUF_SZ - 1))
+		index = JB_HISTORY_MAXBUF_SZ - 1;
+
+	*min = h->hist_minbuf[index];
+	*jitter = h->hist_maxbuf[index] - h->hist_minbuf[index];
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: jbbench [options] [trace ...]\n"
+		"  -n frames    synthesized frames (200000)\n"
+		"  -j ms        synthesized jitter (60)\n"
+		"  -p permille  synthesized delay spikes (10)\n"
+		"  -k permille  synthesized control and silence frames (0)\n"
+		"  -q           compare ring and list queues through jb_get()\n"
+		"  -r count     passes over each trace (5)\n"
+		"  -t ms        resync threshold, -1 never resyncs (1000)\n"
+		"  -s seed      random seed (1)\n");
+	exit(1);
+}
+
+static void add_sample(long ts, long now, enum jb_frame_type type, long ms)
+{
+	if (ntrace == tracesize) {
+		tracesize = tracesize ? tracesize * 2 : 4096;
+		trace = (struct sample *)realloc(trace, tracesize * sizeof(*trace));
+		if (!trace) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	trace[ntrace].ts = ts;
+	trace[ntrace].now = now;
+	trace[ntrace].type = type;
+	trace[ntrace].ms = ms;
+	ntrace++;
+}
+
+static int load_trace(const char *name)
+{
+	char line[256], type;
+	long ts, now, ms;
+	FILE *f;
+	int n;
+
+	if (!(f = fopen(name, "r"))) {
+		perror(name);
+		return -1;
+	}
+	ntrace = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		type = 'v';
+		ms = FRAME_MS;
+		n = sscanf(line, "%ld %ld %c %ld", &ts, &now, &type, &ms);
+		if (n < 2)
+			continue;
+		add_sample(ts, now, type == 'c' ? JB_TYPE_CONTROL :
+				type == 's' ? JB_TYPE_SILENCE : JB_TYPE_VOICE, ms);
+	}
+	fclose(f);
+	return 0;
+}
+
+static void synth_trace(int frames, int jitter, int spikes, int others,
+		unsigned int seed)
+{
+	long ts, now;
+	int i;
+
+	srand(seed);
+	ntrace = 0;
+	for (i = 0; i < frames; i++) {
+		ts = FRAME_MS * (i + 1);
+		now = ts + 40 + (jitter > 0 ? rand() % (jitter + 1) : 0);
+		if (spikes > 0 && rand() % 1000 < spikes)
+			now += 200 + rand() % 300;
+		add_sample(ts, now, JB_TYPE_VOICE, FRAME_MS);
+		if (others > 0 && rand() % 1000 < others)
+			add_sample(ts + 5, now + 1, rand() & 1 ? JB_TYPE_CONTROL :
+					JB_TYPE_SILENCE, 0);
+	}
+}
+
+static double elapsed_ns(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+/* Runs the trace through both, returns the number of disagreements */
+static long run(const char *name, int passes)
+{
+	struct timespec t0, t1;
+	struct legacy *h;
+	jitterbuf *jb;
+	long *delays;
+	signed char *resync;
+	long min, jitter, mismatches = 0;
+	double skip_ns = 0, scan_ns = 0;
+	int i, pass, added = 0, resyncs = 0;
+
+	jb = jb_new();
+	h = (struct legacy *)calloc(1, sizeof(*h));
+	delays = (long *)malloc(ntrace * sizeof(*delays));
+	resync = (signed char *)malloc(ntrace);
+	if (!jb || !h || !delays || !resync) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	/* the skiplist history decides what gets added, and resyncs;
+	 * record that so the rescanning history sees the same delays */
+	jb->info.conf.resync_threshold = threshold;
+	for (i = 0; i < ntrace; i++) {
+		int before = jb->hist_ptr;
+
+		if (trace[i].type != JB_TYPE_VOICE ||
+		    history_put(jb, trace[i].ts, trace[i].now, FRAME_MS)) {
+			delays[i] = 0;
+			resync[i] = -1;
+			continue;
+		}
+		history_get(jb);
+		resync[i] = jb->hist_ptr <= before;
+		resyncs += resync[i];
+		delays[i] = jb->history[(jb->hist_ptr - 1) % JB_HISTORY_SZ];
+		legacy_put(h, delays[i], resync[i]);
+		legacy_get(h, &min, &jitter);
+		if (min != jb->info.min || jitter != jb->info.jitter)
+			mismatches++;
+		added++;
+	}
+
+	for (pass = 0; pass < passes; pass++) {
+		jb_reset(jb);
+		jb->info.conf.resync_threshold = threshold;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < ntrace; i++) {
+			if (trace[i].type == JB_TYPE_VOICE &&
+			    !history_put(jb, trace[i].ts, trace[i].now, FRAME_MS))
+				history_get(jb);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		skip_ns += elapsed_ns(&t0, &t1);
+
+		memset(h, 0, sizeof(*h));
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < ntrace; i++) {
+			if (resync[i] < 0)
+				continue;
+			legacy_put(h, delays[i], resync[i]);
+			legacy_get(h, &min, &jitter);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		scan_ns += elapsed_ns(&t0, &t1);
+	}
+
+	printf("%s: %d frames, %d in history, %d resyncs\n", name, ntrace, added, resyncs);
+	printf("  rescan:   %8.1f ns per frame\n", added ? scan_ns / passes / added : 0.0);
+	printf("  skiplist: %8.1f ns per frame\n", added ? skip_ns / passes / added : 0.0);
+	printf("  %ld mismatches\n", mismatches);
+
+	jb_destroy(jb);
+	free(h);
+	free(delays);
+	free(resync);
+	return mismatches;
+}
+
+static int cmp_arrival(const void *a, const void *b)
+{
+	const struct sample *x = *(const struct sample **)a;
+	const struct sample *y = *(const struct sample **)b;
+
+	if (x->now != y->now)
+		return x->now < y->now ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+/* What a jitterbuffer did, one entry per jb_put(), jb_get() or jb_next() */
+struct outcome {
+	long ret;
+	void *data;
+	long ts;
+};
+
+struct playlog {
+	struct outcome *o;
+	long len, size;
+};
+
+static void log_outcome(struct playlog *log, long ret, void *data, long ts)
+{
+	if (!log)
+		return;
+	if (log->len == log->size) {
+		log->size = log->size ? log->size * 2 : 65536;
+		log->o = (struct outcome *)realloc(log->o, log->size * sizeof(*log->o));
+		if (!log->o) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	log->o[log->len].ret = ret;
+	log->o[log->len].data = data;
+	log->o[log->len].ts = ts;
+	log->len++;
+}
+
+/* Plays the trace out through a new jitterbuffer the way
+ * iax_get_event() does, logging what it did if asked to.  Returns the
+ * time taken, ns. */
+static double play(int ring_disabled, struct sample **order,
+		struct playlog *log, jb_info *info)
+{
+	struct timespec t0, t1;
+	jitterbuf *jb;
+	jb_frame frame;
+	jb_conf conf;
+	long now, end, next;
+	int i = 0, j, ret;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.resync_threshold = threshold;
+	conf.target_extra = -1;
+	if (!(jb = jb_new())) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	jb->ring_disabled = ring_disabled;
+	jb_setconf(jb, &conf);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	end = order[ntrace - 1]->now + 5000;
+	for (now = order[0]->now; now < end; now++) {
+		for (; i < ntrace && order[i]->now <= now; i++) {
+			struct sample *p = order[i];
+
+			ret = jb_put(jb, p, p->type, p->ms, p->ts, now);
+			log_outcome(log, ret, NULL, 0);
+		}
+
+		for (j = 0; j < 10; j++) {
+			next = jb_next(jb);
+			log_outcome(log, -1, NULL, next);
+			if (now <= next)
+				break;
+
+			memset(&frame, 0, sizeof(frame));
+			ret = jb_get(jb, &frame, now, FRAME_MS);
+			log_outcome(log, ret, frame.data, frame.ts);
+			if (ret == JB_NOFRAME || ret == JB_EMPTY)
+				break;
+		}
+	}
+	while ((ret = jb_getall(jb, &frame)) == JB_OK)
+		log_outcome(log, ret, frame.data, frame.ts);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	*info = jb->info;
+	jb_destroy(jb);
+	return elapsed_ns(&t0, &t1);
+}
+
+static long run_queue(const char *name, int passes)
+{
+	struct playlog ringlog, listlog;
+	struct sample **order;
+	jb_info ringinfo, listinfo;
+	double ring_ns = 0, list_ns = 0;
+	long mismatches = 0;
+	int i, pass;
+
+	order = (struct sample **)malloc(ntrace * sizeof(*order));
+	if (!order) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < ntrace; i++)
+		order[i] = &trace[i];
+	qsort(order, ntrace, sizeof(*order), cmp_arrival);
+
+	/* every jb_put(), jb_next() and jb_get() must agree */
+	memset(&ringlog, 0, sizeof(ringlog));
+	memset(&listlog, 0, sizeof(listlog));
+	play(0, order, &ringlog, &ringinfo);
+	play(1, order, &listlog, &listinfo);
+	if (ringlog.len != listlog.len)
+		mismatches++;
+	for (i = 0; i < ringlog.len && i < listlog.len; i++) {
+		if (memcmp(&ringlog.o[i], &listlog.o[i], sizeof(ringlog.o[i])))
+			mismatches++;
+	}
+	if (memcmp(&ringinfo, &listinfo, sizeof(ringinfo)))
+		mismatches++;
+
+	for (pass = 0; pass < passes; pass++) {
+		list_ns += play(1, order, NULL, &listinfo);
+		ring_ns += play(0, order, NULL, &ringinfo);
+	}
+
+	printf("%s: %d frames, %ld played, %ld interpolated, %ld late, %ld out of order\n",
+			name, ntrace, listinfo.frames_out, listinfo.frames_lost,
+			listinfo.frames_late, listinfo.frames_ooo);
+	printf("  list:     %8.1f ns per frame\n", list_ns / passes / ntrace);
+	printf("  ring:     %8.1f ns per frame\n", ring_ns / passes / ntrace);
+	printf("  %ld mismatches in %ld results\n", mismatches, listlog.len);
+
+	free(ringlog.o);
+	free(listlog.o);
+	free(order);
+	return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = 200000, jitter = 60, spikes = 10, others = 0, passes = 5;
+	int queue = 0;
+	unsigned int seed = 1;
+	long mismatches = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:j:p:k:qr:s:t:")) != -1) {
+		switch (opt) {
+		case 'n': frames = atoi(optarg); break;
+		case 'j': jitter = atoi(optarg); break;
+		case 'p': spikes = atoi(optarg); break;
+		case 'k': others = atoi(optarg); break;
+		case 'q': queue = 1; break;
+		case 'r': passes = atoi(optarg); break;
+		case 't': threshold = atol(optarg); break;
+		case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (frames < 1 || passes < 1)
+		usage();
+
+	if (optind == argc) {
+		synth_trace(frames, jitter, spikes, others, seed);
+		mismatches += (queue ? run_queue : run)("synthesized", passes);
+	}
+	for (; optind < argc; optind++) {
+		if (load_trace(argv[optind]) < 0)
+			return 1;
+		if (!ntrace)
+			continue;
+		mismatches += (queue ? run_queue : run)(argv[optind], passes);
+	}
+
+	free(trace);
+	return mismatches ? 2 : 0;
+}
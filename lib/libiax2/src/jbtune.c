@@ -0,0 +1,237 @@
+/*
+ * jbtune: replays a recorded jitter trace through the jitterbuffer
+ * engines for a grid of jb_conf settings, on all cores, and tabulates
+ * the playout delay and losses each gives.  See jb-trace.h for the trace
+ * format.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "jb-trace.h"
+
+#define MAX_VALUES	256
+
+struct grid {
+	long values[MAX_VALUES];
+	int count;
+};
+
+struct job {
+	const jb_engine *engine;
+	jb_conf conf;
+	jb_replay_stats stats;
+	int failed;
+};
+
+static jb_trace_frame *frames;
+static int nframes;
+static long interpl = 20;
+
+static struct job *jobs;
+static int njobs;
+static int next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: jbtune [options] trace\n"
+		"  -E names     engines, comma separated, or all (jitterbuf)\n"
+		"  -m list      max_jitterbuf, ms (0)\n"
+		"  -r list      resync_threshold, ms (1000)\n"
+		"  -e list      target_extra, ms (%d)\n"
+		"  -c list      max_contig_interp, frames (0)\n"
+		"  -i ms        interpolation length (20)\n"
+		"  -j threads   replays at once (one per core)\n"
+		"A list is values and from:to:step ranges separated by commas,\n"
+		"e.g. -e 20:80:10 or -r -1,500,1000.\n", JB_TARGET_EXTRA);
+	exit(1);
+}
+
+static void parse_grid(struct grid *g, const char *arg)
+{
+	char *copy, *item, *save = NULL;
+	long from, to, step;
+	int n;
+
+	g->count = 0;
+	if (!(copy = strdup(arg)))
+		usage();
+	for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		n = sscanf(item, "%ld:%ld:%ld", &from, &to, &step);
+		if (n < 1)
+			usage();
+		if (n == 1)
+			to = from;
+		if (n < 3)
+			step = 1;
+		if (step <= 0)
+			usage();
+		for (; from <= to; from += step) {
+			if (g->count == MAX_VALUES) {
+				fprintf(stderr, "Too many values in %s\n", arg);
+				exit(1);
+			}
+			g->values[g->count++] = from;
+		}
+	}
+	free(copy);
+	if (!g->count)
+		usage();
+}
+
+static int parse_engines(const jb_engine **engines, const char *arg)
+{
+	char *copy, *item, *save = NULL;
+	int count = 0, i;
+
+	if (!strcmp(arg, "all")) {
+		for (i = 0; jb_engines[i]; i++)
+			engines[count++] = jb_engines[i];
+		return count;
+	}
+	if (!(copy = strdup(arg)))
+		usage();
+	for (item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+		if (count == MAX_VALUES)
+			usage();
+		if (!(engines[count++] = jb_engine_find(item))) {
+			fprintf(stderr, "Unknown engine %s\n", item);
+			exit(1);
+		}
+	}
+	free(copy);
+	if (!count)
+		usage();
+	return count;
+}
+
+static void *worker(void *arg)
+{
+	struct job *job;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		job = next_job < njobs ? &jobs[next_job++] : NULL;
+		pthread_mutex_unlock(&job_lock);
+		if (!job)
+			break;
+		job->failed = jb_replay(frames, nframes, job->engine, &job->conf,
+				interpl, &job->stats) < 0;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct grid maxjb, resync, extra, contig;
+	const jb_engine *engines[MAX_VALUES];
+	pthread_t *threads;
+	jb_replay_stats *s;
+	int nengines, nthreads, i, a, b, c, d, e, opt;
+
+	nengines = parse_engines(engines, "jitterbuf");
+	parse_grid(&maxjb, "0");
+	parse_grid(&resync, "1000");
+	parse_grid(&contig, "0");
+	{
+		char buf[32];
+
+		snprintf(buf, sizeof(buf), "%d", JB_TARGET_EXTRA);
+		parse_grid(&extra, buf);
+	}
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "E:m:r:e:c:i:j:")) != -1) {
+		switch (opt) {
+		case 'E': nengines = parse_engines(engines, optarg); break;
+		case 'm': parse_grid(&maxjb, optarg); break;
+		case 'r': parse_grid(&resync, optarg); break;
+		case 'e': parse_grid(&extra, optarg); break;
+		case 'c': parse_grid(&contig, optarg); break;
+		case 'i': interpl = atol(optarg); break;
+		case 'j': nthreads = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if (optind != argc - 1 || interpl <= 0)
+		usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if ((nframes = jb_trace_load(argv[optind], &frames)) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (!nframes) {
+		fprintf(stderr, "%s: no frames\n", argv[optind]);
+		return 1;
+	}
+
+	njobs = nengines * maxjb.count * resync.count * extra.count * contig.count;
+	jobs = (struct job *)calloc(njobs, sizeof(*jobs));
+	threads = (pthread_t *)calloc(nthreads, sizeof(*threads));
+	if (!jobs || !threads) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	i = 0;
+	for (e = 0; e < nengines; e++)
+		for (a = 0; a < maxjb.count; a++)
+			for (b = 0; b < resync.count; b++)
+				for (c = 0; c < extra.count; c++)
+					for (d = 0; d < contig.count; d++, i++) {
+						jobs[i].engine = engines[e];
+						jobs[i].conf.max_jitterbuf = maxjb.values[a];
+						jobs[i].conf.resync_threshold = resync.values[b];
+						jobs[i].conf.target_extra = extra.values[c];
+						jobs[i].conf.max_contig_interp = contig.values[d];
+					}
+
+	if (nthreads > njobs)
+		nthreads = njobs;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL)) {
+			fprintf(stderr, "Unable to start thread\n");
+			return 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("# %s: %d frames, %d settings, %d threads\n",
+			argv[optind], nframes, njobs, nthreads);
+	printf("# %-9s %6s %6s %6s %6s | %7s %6s %6s %6s %6s %6s | %7s %5s %5s %5s %5s | %7s\n",
+			"engine", "maxjb", "resync", "extra", "contig",
+			"played", "late", "drop", "interp", "lost", "late%",
+			"mean", "p50", "p90", "p99", "max", "ns/fr");
+	for (i = 0; i < njobs; i++) {
+		s = &jobs[i].stats;
+		if (jobs[i].failed) {
+			printf("  %-9s %6ld %6ld %6ld %6ld | out of memory\n",
+					jobs[i].engine->name, jobs[i].conf.max_jitterbuf, jobs[i].conf.resync_threshold,
+					jobs[i].conf.target_extra, jobs[i].conf.max_contig_interp);
+			continue;
+		}
+		printf("  %-9s %6ld %6ld %6ld %6ld | %7ld %6ld %6ld %6ld %6ld %6.2f | %7.1f %5ld %5ld %5ld %5ld | %7.0f\n",
+				jobs[i].engine->name, jobs[i].conf.max_jitterbuf, jobs[i].conf.resync_threshold,
+				jobs[i].conf.target_extra, jobs[i].conf.max_contig_interp,
+				s->played, s->late, s->dropped, s->interp, s->lost,
+				s->voice ? 100.0 * s->late / s->voice : 0.0,
+				s->delay_mean, s->delay_p50, s->delay_p90, s->delay_p99,
+				s->delay_max, s->cpu_ns);
+	}
+
+	free(threads);
+	free(jobs);
+	free(frames);
+	return 0;
+}
@@ -20,9 +20,9 @@
 
 #include "jitterbuf.h"
 
-/* define these here, just for ancient compiler systems */
-#define JB_LONGMAX 2147483647L
-#define JB_LONGMIN (-JB_LONGMAX - 1L)
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#include <windows.h>
+#endif
 
 /* MS VC can't do __VA_ARGS__ */
 #if (defined(WIN32)  ||  defined(_WIN32_WCE))  &&  defined(_MSC_VER)
@@ -59,6 +59,148 @@ void jb_setoutput(jb_output_function_t err, jb_output_function_t warn, jb_output
 	dbgf = dbg;
 }
 
+/* The pool is a lock free stack of frame indexes.  Its head holds the
+ * top index + 1 (0 when empty) in the low half and a count of changes in
+ * the high half, so a pop that raced with a pop and push of the same
+ * frame fails its compare and swap instead of linking a frame in use.
+ * Chunks are never freed, so a racing pop may read a frame's next
+ * safely. */
+#if defined(_MSC_VER)
+typedef unsigned __int64 jb_pool_word;
+#else
+typedef unsigned long long jb_pool_word;
+#endif
+
+#if defined(WIN32)  ||  defined(_WIN32_WCE)
+#define pool_cas(p, o, n)	(InterlockedCompareExchange64((volatile LONGLONG *)(p), (LONGLONG)(n), (LONGLONG)(o)) == (LONGLONG)(o))
+#define pool_load(p)		((jb_pool_word)InterlockedCompareExchange64((volatile LONGLONG *)(p), 0, 0))
+#define pool_cas_long(p, o, n)	(InterlockedCompareExchange((volatile LONG *)(p), (n), (o)) == (o))
+#define pool_add(p, v)		InterlockedExchangeAdd((volatile LONG *)(p), (v))
+#define pool_cas_ptr(p, o, n)	(InterlockedCompareExchangePointer((PVOID volatile *)(p), (n), (o)) == (o))
+#else
+#define pool_cas(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+#define pool_load(p)		__sync_val_compare_and_swap((p), 0, 0)
+#define pool_cas_long(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+#define pool_add(p, v)		__sync_fetch_and_add((p), (v))
+#define pool_cas_ptr(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+typedef struct jb_pool_node {
+	jb_frame frame;		/* what is handed out; first */
+	long index;		/* in the pool, -1 if from malloc() */
+	volatile long next;	/* while free, index + 1 of the next, or 0 */
+} jb_pool_node;
+
+static jb_pool_node * volatile pool_chunks[JB_POOL_MAX_CHUNKS];
+static volatile jb_pool_word pool_head;
+static volatile long pool_cap = JB_POOL_DEFAULT_CAP;
+static volatile long pool_carved;
+static volatile long pool_inuse, pool_highwater, pool_hits, pool_misses, pool_overflows;
+
+#define pool_node(i)	(&pool_chunks[(i) / JB_POOL_CHUNK][(i) % JB_POOL_CHUNK])
+
+static jb_pool_node *pool_pop(void)
+{
+	jb_pool_word old, top;
+	jb_pool_node *node;
+
+	for (;;) {
+		old = pool_load(&pool_head);
+		if (!(top = old & 0xffffffffUL))
+			return NULL;
+		node = pool_node(top - 1);
+		if (pool_cas(&pool_head, old, ((old >> 32) + 1) << 32 | (jb_pool_word)node->next))
+			return node;
+	}
+}
+
+static void pool_push(jb_pool_node *node)
+{
+	jb_pool_word old;
+
+	do {
+		old = pool_load(&pool_head);
+		node->next = (long)(old & 0xffffffffUL);
+	} while (!pool_cas(&pool_head, old, ((old >> 32) + 1) << 32 | (jb_pool_word)(node->index + 1)));
+}
+
+/* a frame never pooled before, or NULL past the cap */
+static jb_pool_node *pool_carve(void)
+{
+	jb_pool_node *chunk;
+	long i;
+
+	do {
+		i = pool_carved;
+		if (i >= pool_cap)
+			return NULL;
+	} while (!pool_cas_long(&pool_carved, i, i + 1));
+
+	if (!pool_chunks[i / JB_POOL_CHUNK]) {
+		if (!(chunk = (jb_pool_node *)calloc(JB_POOL_CHUNK, sizeof(*chunk))))
+			return NULL;
+		if (!pool_cas_ptr(&pool_chunks[i / JB_POOL_CHUNK], NULL, chunk))
+			free(chunk);
+	}
+	pool_node(i)->index = i;
+	return pool_node(i);
+}
+
+jb_frame *jb_frame_alloc(void)
+{
+	jb_pool_node *node;
+	long inuse, high;
+
+	if ((node = pool_pop())) {
+		pool_add(&pool_hits, 1);
+	} else if ((node = pool_carve())) {
+		pool_add(&pool_misses, 1);
+	} else if ((node = (jb_pool_node *)malloc(sizeof(*node)))) {
+		node->index = -1;
+		pool_add(&pool_overflows, 1);
+	} else {
+		return NULL;
+	}
+
+	inuse = pool_add(&pool_inuse, 1) + 1;
+	while ((high = pool_highwater) < inuse && !pool_cas_long(&pool_highwater, high, inuse))
+		;
+	return &node->frame;
+}
+
+void jb_frame_free(jb_frame *frame)
+{
+	jb_pool_node *node = (jb_pool_node *)frame;
+
+	if (!frame)
+		return;
+	pool_add(&pool_inuse, -1);
+	if (node->index < 0)
+		free(node);
+	else
+		pool_push(node);
+}
+
+void jb_pool_setcap(long frames)
+{
+	if (frames < 0)
+		frames = 0;
+	if (frames > (long)JB_POOL_CHUNK * JB_POOL_MAX_CHUNKS)
+		frames = (long)JB_POOL_CHUNK * JB_POOL_MAX_CHUNKS;
+	pool_cap = frames;
+}
+
+void jb_pool_getstats(jb_pool_stats *stats)
+{
+	stats->cap = pool_cap;
+	stats->pooled = pool_carved < pool_cap ? pool_carved : pool_cap;
+	stats->inuse = pool_inuse;
+	stats->highwater = pool_highwater;
+	stats->hits = pool_hits;
+	stats->misses = pool_misses;
+	stats->overflows = pool_overflows;
+}
+
 static void increment_losspct(jitterbuf *jb)
 {
 	jb->info.losspct = (100000 + 499 * jb->info.losspct)/500;
@@ -73,8 +215,10 @@ void jb_reset(jitterbuf *jb)
 {
 	/* only save settings */
 	jb_conf s = jb->info.conf;
+	int ring_disabled = jb->ring_disabled;
 	memset(jb, 0, sizeof(*jb));
 	jb->info.conf = s;
+	jb->ring_disabled = ring_disabled;
 
 	/* initialize length, using the configured value */
 	jb->info.current = jb->info.target = jb->info.conf.target_extra;
@@ -89,6 +233,7 @@ jitterbuf * jb_new()
 		return NULL;
 
 	jb->info.conf.target_extra = JB_TARGET_EXTRA;
+	jb->ring_disabled = 0;
 
 	jb_reset(jb);
 
@@ -98,17 +243,8 @@ jitterbuf * jb_new()
 
 void jb_destroy(jitterbuf *jb)
 {
-	jb_frame *frame;
 	jb_dbg2("jb_destroy(%x)\n", jb);
 
-	/* free all the frames on the "free list" */
-	frame = jb->free;
-	while (frame != NULL) {
-		jb_frame *next = frame->next;
-		free(frame);
-		frame = next;
-	}
-
 	/* free ourselves! */
 	free(jb);
 }
@@ -122,6 +258,109 @@ static int longcmp(const void *a, const void *b)
 }
 #endif
 
+/* skiplist over the history; node n holds history[n - 1] */
+static int hist_before(jitterbuf *jb, int node, long delay, int seq)
+{
+	long d = jb->history[node - 1];
+
+	if (d != delay)
+		return d < delay;
+	return jb->hist_nodes[node].seq - seq < 0;
+}
+
+static int hist_random_level(jitterbuf *jb)
+{
+	unsigned int r;
+	int level = 1;
+
+	jb->hist_rand = jb->hist_rand * 1103515245 + 12345;
+	r = jb->hist_rand >> 16;
+	/* each level holds a quarter of the nodes of the one below */
+	while (level < JB_HIST_LEVELS && !(r & 3)) {
+		level++;
+		r >>= 2;
+	}
+	return level;
+}
+
+static void hist_insert(jitterbuf *jb, int slot)
+{
+	jb_hist_node *nodes = jb->hist_nodes;
+	int update[JB_HIST_LEVELS], rank[JB_HIST_LEVELS];
+	long delay = jb->history[slot];
+	int seq = jb->hist_ptr;
+	int n = slot + 1;
+	int x = 0, r = 0;
+	int i, level;
+
+	for (i = JB_HIST_LEVELS - 1; i >= 0; i--) {
+		while (nodes[x].next[i] && hist_before(jb, nodes[x].next[i], delay, seq)) {
+			r += nodes[x].width[i];
+			x = nodes[x].next[i];
+		}
+		update[i] = x;
+		rank[i] = r;
+	}
+
+	/* the new node is at rank r + 1 */
+	level = hist_random_level(jb);
+	nodes[n].seq = seq;
+	nodes[n].level = (unsigned char)level;
+	for (i = 0; i < level; i++) {
+		jb_hist_node *p = &nodes[update[i]];
+
+		nodes[n].next[i] = p->next[i];
+		nodes[n].width[i] = p->next[i] ? p->width[i] - (r - rank[i]) : 0;
+		p->next[i] = n;
+		p->width[i] = r + 1 - rank[i];
+	}
+	for (; i < JB_HIST_LEVELS; i++) {
+		if (nodes[update[i]].next[i])
+			nodes[update[i]].width[i]++;
+	}
+	jb->hist_count++;
+}
+
+static void hist_remove(jitterbuf *jb, int slot)
+{
+	jb_hist_node *nodes = jb->hist_nodes;
+	long delay = jb->history[slot];
+	int n = slot + 1;
+	int seq = nodes[n].seq;
+	int x = 0;
+	int i;
+
+	for (i = JB_HIST_LEVELS - 1; i >= 0; i--) {
+		while (nodes[x].next[i] && hist_before(jb, nodes[x].next[i], delay, seq))
+			x = nodes[x].next[i];
+
+		if (i < nodes[n].level) {
+			nodes[x].next[i] = nodes[n].next[i];
+			nodes[x].width[i] = nodes[n].next[i] ? nodes[x].width[i] + nodes[n].width[i] - 1 : 0;
+		} else if (nodes[x].next[i]) {
+			nodes[x].width[i]--;
+		}
+	}
+	jb->hist_count--;
+}
+
+/* the k'th lowest delay in history, from 0 */
+static long hist_select(jitterbuf *jb, int k)
+{
+	jb_hist_node *nodes = jb->hist_nodes;
+	int x = 0;
+	int i;
+
+	k++;
+	for (i = JB_HIST_LEVELS - 1; i >= 0; i--) {
+		while (nodes[x].next[i] && nodes[x].width[i] <= k) {
+			k -= nodes[x].width[i];
+			x = nodes[x].next[i];
+		}
+	}
+	return jb->history[x - 1];
+}
+
 /* simple history manipulation */
 /* maybe later we can make the history buckets variable size, or something? */
 /* drop parameter determines whether we will drop outliers to minimize
@@ -130,7 +369,7 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 {
 	long delay = now - (ts - jb->info.resync_offset);
 	long threshold = 2 * jb->info.jitter + jb->info.conf.resync_threshold;
-	long kicked;
+	int slot;
 
 	/* don't add special/negative times to history */
 	if (ts <= 0)
@@ -144,7 +383,8 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 				/* resync the jitterbuffer */
 				jb->info.cnt_delay_discont = 0;
 				jb->hist_ptr = 0;
-				jb->hist_maxbuf_valid = 0;
+				jb->hist_count = 0;
+				memset(&jb->hist_nodes[0], 0, sizeof(jb->hist_nodes[0]));
 
 				jb_warn("Resyncing the jb. last_delay %ld, this delay %ld, threshold %ld, new offset %ld\n", jb->info.last_delay, delay, threshold, ts - now);
 				jb->info.resync_offset = ts - now;
@@ -158,126 +398,17 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 		}
 	}
 
-	kicked = jb->history[jb->hist_ptr % JB_HISTORY_SZ];
-
-	jb->history[(jb->hist_ptr++) % JB_HISTORY_SZ] = delay;
-
-	/* optimization; the max/min buffers don't need to be recalculated,
-	 * if this packet's entry doesn't change them. This happens if this
-	 * packet is not involved, _and_ any packet that got kicked out of
-	 * the history is also not involved. We do a number of comparisons,
-	 * but it's probably still worthwhile, because it will usually
-	 * succeed, and should be a lot faster than going through all 500
-	 * packets in history */
-	if (!jb->hist_maxbuf_valid)
-		return 0;
-
-	/* don't do this until we've filled history
-	 * (reduces some edge cases below) */
-	if (jb->hist_ptr < JB_HISTORY_SZ)
-		goto invalidate;
-
-	/* if the new delay would go into min */
-	if (delay < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
-
-	/* or max.. */
-	if (delay > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
+	slot = jb->hist_ptr % JB_HISTORY_SZ;
 
-	/* or the kicked delay would be in min */
-	if (kicked <= jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
+	/* kick out the oldest delay once history is full */
+	if (jb->hist_ptr >= JB_HISTORY_SZ)
+		hist_remove(jb, slot);
 
-	if (kicked >= jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
+	jb->history[slot] = delay;
+	hist_insert(jb, slot);
+	jb->hist_ptr++;
 
-	/* if we got here, we don't need to invalidate, 'cause this delay didn't
-	 * affect things */
 	return 0;
-	/* end optimization */
-
-
-invalidate:
-	jb->hist_maxbuf_valid = 0;
-	return 0;
-}
-
-static void history_calc_maxbuf(jitterbuf *jb)
-{
-	int i,j;
-
-	if (jb->hist_ptr == 0)
-		return;
-
-
-	/* initialize maxbuf/minbuf to the latest value */
-	for (i=0;i<JB_HISTORY_MAXBUF_SZ;i++) {
-		/*
-		 * jb->hist_maxbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
-		 * jb->hist_minbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
-		 */
-		jb->hist_maxbuf[i] = JB_LONGMIN;
-		jb->hist_minbuf[i] = JB_LONGMAX;
-	}
-
-	/* use insertion sort to populate maxbuf */
-	/* we want it to be the top "n" values, in order */
-
-	/* start at the beginning, or JB_HISTORY_SZ frames ago */
-	i = (jb->hist_ptr > JB_HISTORY_SZ) ? (jb->hist_ptr - JB_HISTORY_SZ) : 0;
-
-	for (;i<jb->hist_ptr;i++) {
-		long toins = jb->history[i % JB_HISTORY_SZ];
-
-		/* if the maxbuf should get this */
-		if (toins > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins > jb->hist_maxbuf[j]) {
-					/* move over */
-					memmove(jb->hist_maxbuf + j + 1, jb->hist_maxbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_maxbuf[0]));
-					/* insert */
-					jb->hist_maxbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
-
-		/* if the minbuf should get this */
-		if (toins < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins < jb->hist_minbuf[j]) {
-					/* move over */
-					memmove(jb->hist_minbuf + j + 1, jb->hist_minbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_minbuf[0]));
-					/* insert */
-					jb->hist_minbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
-
-		if (0) {
-			int k;
-			fprintf(stderr, "toins = %ld\n", toins);
-			fprintf(stderr, "maxbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++)
-				fprintf(stderr, "%ld ", jb->hist_maxbuf[k]);
-			fprintf(stderr, "\nminbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++)
-				fprintf(stderr, "%ld ", jb->hist_minbuf[k]);
-			fprintf(stderr, "\n");
-		}
-	}
-
-	jb->hist_maxbuf_valid = 1;
 }
 
 static void history_get(jitterbuf *jb)
@@ -286,11 +417,8 @@ static void history_get(jitterbuf *jb)
 	int index;
 	int count;
 
-	if (!jb->hist_maxbuf_valid)
-		history_calc_maxbuf(jb);
-
 	/* count is how many items in history we're examining */
-	count = (jb->hist_ptr < JB_HISTORY_SZ) ? jb->hist_ptr : JB_HISTORY_SZ;
+	count = jb->hist_count;
 
 	/* index is the "n"ths highest/lowest that we'll look for */
 	index = count * JB_HISTORY_DROPPCT / 100;
@@ -300,14 +428,14 @@ static void history_get(jitterbuf *jb)
 		index = JB_HISTORY_MAXBUF_SZ - 1;
 
 
-	if (index < 0) {
+	if (count == 0) {
 		jb->info.min = 0;
 		jb->info.jitter = 0;
 		return;
 	}
 
-	max = jb->hist_maxbuf[index];
-	min = jb->hist_minbuf[index];
+	max = hist_select(jb, count - 1 - index);
+	min = hist_select(jb, index);
 
 	jitter = max - min;
 
@@ -315,14 +443,156 @@ static void history_get(jitterbuf *jb)
 	 * values we get by throwing away the outliers */
 	/*
 	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", index, min, max, jitter);
-	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, jb->hist_minbuf[0], jb->hist_maxbuf[0], jb->hist_maxbuf[0]-jb->hist_minbuf[0]);
+	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, hist_select(jb, 0), hist_select(jb, count - 1), hist_select(jb, count - 1) - hist_select(jb, 0));
 	*/
 
 	jb->info.min = min;
 	jb->info.jitter = jitter;
 }
 
-/* returns 1 if frame was inserted into head of queue, 0 otherwise */
+#define RING_SLOT(key)	((unsigned long)(key) & (JB_RING_SZ - 1))
+
+/* returns 1 if frame was put into head of the ring, 0 if elsewhere in
+ * it, -1 if it doesn't fit the ring */
+static int ring_put(jitterbuf *jb, void *data, const enum jb_frame_type type, long ms, long ts)
+{
+	jb_frame *frame;
+	long key;
+	int head = 0;
+
+	if (type != JB_TYPE_VOICE || ms <= 0)
+		return -1;
+
+	if (!jb->ring_count) {
+		/* empty ring, start a new grid at this frame */
+		jb->ring_base = ts;
+		jb->ring_ms = ms;
+		jb->ring_lo = jb->ring_hi = key = 0;
+		head = 1;
+	} else {
+		if (ms != jb->ring_ms || (ts - jb->ring_base) % ms)
+			return -1;
+		key = (ts - jb->ring_base) / ms;
+
+		if (key < jb->ring_lo) {
+			if (jb->ring_hi - key >= JB_RING_SZ)
+				return -1;
+			/* frame is out of order */
+			jb->info.frames_ooo++;
+			jb->ring_lo = key;
+			head = 1;
+		} else if (key > jb->ring_hi) {
+			if (key - jb->ring_lo >= JB_RING_SZ)
+				return -1;
+			jb->ring_hi = key;
+		} else {
+			/* duplicates queue in arrival order, on the list */
+			if (jb->ring_used[RING_SLOT(key)])
+				return -1;
+			/* frame is out of order */
+			if (key < jb->ring_hi)
+				jb->info.frames_ooo++;
+		}
+	}
+
+	frame = &jb->ring[RING_SLOT(key)];
+	frame->data = data;
+	frame->ts = ts;
+	frame->ms = ms;
+	frame->type = type;
+	jb->ring_used[RING_SLOT(key)] = 1;
+	jb->ring_count++;
+	jb->info.frames_cur++;
+
+	return head;
+}
+
+/* move the ring's frames onto the (empty) list, in order; returns -1,
+ * with the ring left as it was, if there are no nodes for them */
+static int ring_to_list(jitterbuf *jb)
+{
+	jb_frame *frame, *nodes = NULL;
+	long key;
+	int i;
+
+	/* every node first, so running out loses no frame */
+	for (i = 0; i < jb->ring_count; i++) {
+		if (!(frame = jb_frame_alloc())) {
+			jb_err("cannot allocate frame\n");
+			while ((frame = nodes)) {
+				nodes = frame->next;
+				jb_frame_free(frame);
+			}
+			return -1;
+		}
+		frame->next = nodes;
+		nodes = frame;
+	}
+
+	for (key = jb->ring_lo; jb->ring_count; key++) {
+		if (!jb->ring_used[RING_SLOT(key)])
+			continue;
+		jb->ring_used[RING_SLOT(key)] = 0;
+		jb->ring_count--;
+
+		frame = nodes;
+		nodes = frame->next;
+		*frame = jb->ring[RING_SLOT(key)];
+
+		if (!jb->frames) {
+			jb->frames = frame;
+			frame->next = frame;
+			frame->prev = frame;
+		} else {
+			frame->next = jb->frames;
+			frame->prev = jb->frames->prev;
+			frame->next->prev = frame;
+			frame->prev->next = frame;
+		}
+	}
+	return 0;
+}
+
+/* move the list's frames into the (empty) ring, if they all fit */
+static void list_to_ring(jitterbuf *jb)
+{
+	jb_frame *head = jb->frames;
+	jb_frame *p = head, *next;
+	long key, last = -1;
+
+	if (head->type != JB_TYPE_VOICE || head->ms <= 0)
+		return;
+
+	do {
+		if (p->type != JB_TYPE_VOICE || p->ms != head->ms ||
+		    (p->ts - head->ts) % head->ms)
+			return;
+		key = (p->ts - head->ts) / head->ms;
+		if (key <= last || key >= JB_RING_SZ)
+			return;
+		last = key;
+		p = p->next;
+	} while (p != head);
+
+	jb->ring_base = head->ts;
+	jb->ring_ms = head->ms;
+	jb->ring_lo = 0;
+	jb->ring_hi = last;
+
+	head->prev->next = NULL;
+	for (p = head; p; p = next) {
+		key = (p->ts - jb->ring_base) / jb->ring_ms;
+		jb->ring[RING_SLOT(key)] = *p;
+		jb->ring_used[RING_SLOT(key)] = 1;
+		jb->ring_count++;
+		next = p->next;
+		jb_frame_free(p);
+	}
+	jb->frames = NULL;
+}
+
+/* returns 1 if frame was inserted into head of queue, 0 otherwise, -1
+ * if it could not be queued at all */
 static int queue_put(jitterbuf *jb, void *data, const enum jb_frame_type type, long ms, long ts)
 {
 	jb_frame *frame;
@@ -330,11 +600,18 @@ static int queue_put(jitterbuf *jb, void *data, const enum jb_frame_type type, l
 	int head = 0;
 	long resync_ts = ts - jb->info.resync_offset;
 
-	if ((frame = jb->free)) {
-		jb->free = frame->next;
-	} else if (!(frame = (jb_frame *)malloc(sizeof(*frame)))) {
+	/* fixed ptime voice goes in the ring while the list is unused */
+	if (!jb->frames && !jb->ring_disabled) {
+		if ((head = ring_put(jb, data, type, ms, resync_ts)) >= 0)
+			return head;
+		head = 0;
+		if (ring_to_list(jb) < 0)
+			return -1;
+	}
+
+	if (!(frame = jb_frame_alloc())) {
 		jb_err("cannot allocate frame\n");
-		return 0;
+		return -1;
 	}
 
 	jb->info.frames_cur++;
@@ -384,9 +661,16 @@ static int queue_put(jitterbuf *jb, void *data, const enum jb_frame_type type, l
 	return head;
 }
 
+static int queue_empty(jitterbuf *jb)
+{
+	return !jb->frames && !jb->ring_count;
+}
+
 static long queue_next(jitterbuf *jb)
 {
-	if (jb->frames)
+	if (jb->ring_count)
+		return jb->ring[RING_SLOT(jb->ring_lo)].ts;
+	else if (jb->frames)
 		return jb->frames->ts;
 	else
 		return -1;
@@ -394,7 +678,9 @@ static long queue_next(jitterbuf *jb)
 
 static long queue_last(jitterbuf *jb)
 {
-	if (jb->frames)
+	if (jb->ring_count)
+		return jb->ring[RING_SLOT(jb->ring_hi)].ts;
+	else if (jb->frames)
 		return jb->frames->prev->ts;
 	else
 		return -1;
@@ -403,6 +689,28 @@ static long queue_last(jitterbuf *jb)
 static jb_frame *_queue_get(jitterbuf *jb, long ts, int all)
 {
 	jb_frame *frame;
+
+	if (jb->ring_count) {
+		frame = &jb->ring[RING_SLOT(jb->ring_lo)];
+
+		if (all || ts >= frame->ts) {
+			jb->ring_used[RING_SLOT(jb->ring_lo)] = 0;
+			jb->info.frames_cur--;
+
+			/* skip the gaps of lost frames to the new head */
+			if (--jb->ring_count) {
+				while (!jb->ring_used[RING_SLOT(jb->ring_lo)])
+					jb->ring_lo++;
+			}
+
+			/* the slot stays intact until the next put, but caller
+			 * must copy data */
+			return frame;
+		}
+
+		return NULL;
+	}
+
 	frame = jb->frames;
 
 	if (!frame)
@@ -421,14 +729,23 @@ static jb_frame *_queue_get(jitterbuf *jb, long ts, int all)
 			jb->frames = frame->next;
 
 
-		/* insert onto "free" single-linked list */
-		frame->next = jb->free;
-		jb->free = frame;
+		/* back to the pool, where another jitterbuffer may take it
+		 * at once */
+		jb->out = *frame;
+		jb_frame_free(frame);
+		frame = &jb->out;
 
 		jb->info.frames_cur--;
 
-		/* we return the frame pointer, even though it's on free list,
-		 * but caller must copy data */
+		/* with the frame that sent the queue to the list gone, the
+		 * rest may fit the ring again */
+		if (jb->frames && !jb->ring_disabled &&
+		    (frame->type != JB_TYPE_VOICE ||
+		     frame->ms != jb->frames->ms ||
+		     frame->ts == jb->frames->ts))
+			list_to_ring(jb);
+
+		/* valid until the next get, caller must copy data */
 		return frame;
 	}
 
@@ -527,12 +844,16 @@ enum jb_return_code jb_put(jitterbuf *jb, void *data, const enum jb_frame_type t
 			return JB_DROP;
 	}
 
-	/* if put into head of queue, caller needs to reschedule */
-	if (queue_put(jb,data,type,ms,ts)) {
+	/* if put into head of queue, caller needs to reschedule; if not
+	 * queued at all, the frame is still the caller's to free */
+	switch (queue_put(jb,data,type,ms,ts)) {
+	case -1:
+		return JB_DROP;
+	case 0:
+		return JB_OK;
+	default:
 		return JB_SCHED;
 	}
-
-	return JB_OK;
 }
 
 
@@ -758,7 +1079,7 @@ static enum jb_return_code _jb_get(jitterbuf *jb, jb_frame *frameout, long now,
 long jb_next(jitterbuf *jb)
 {
 	if (jb->info.silence_begin_ts) {
-		if (jb->frames) {
+		if (!queue_empty(jb)) {
 			long next = queue_next(jb);
 			history_get(jb);
 			/* shrink during silence */
@@ -830,4 +1151,15 @@ enum jb_return_code jb_setconf(jitterbuf *jb, jb_conf *conf)
 	return JB_OK;
 }
 
+enum jb_return_code jb_stretch(jitterbuf *jb, long ms)
+{
+	jb->info.current += ms;
+
+	/* in silence, the next frame is timed from current when it arrives */
+	if (!jb->info.silence_begin_ts)
+		jb->info.next_voice_ts += ms;
+
+	return JB_OK;
+}
+
 
@@ -28,13 +28,19 @@ extern "C" {
 #define JB_HISTORY_DROPPCT	3
 	/* the maximum droppct we can handle (say it was configurable). */
 #define JB_HISTORY_DROPPCT_MAX	4
-	/* the size of the buffer we use to keep the top and botton timestamps for dropping */
+	/* the most timestamps we drop from either end of the history */
 #define JB_HISTORY_MAXBUF_SZ	JB_HISTORY_SZ * JB_HISTORY_DROPPCT_MAX / 100
+	/* slots in the ring used to queue fixed ptime voice; a power of two */
+#define JB_RING_SZ		128
 	/* amount of additional jitterbuffer adjustment  */
 #define JB_TARGET_EXTRA 40
 	/* ms between growing and shrinking; may not be honored if jitterbuffer runs out of space */
 #define JB_ADJUST_DELAY 40
 
+/* define these here, just for ancient compiler systems */
+#define JB_LONGMAX 2147483647L
+#define JB_LONGMIN (-JB_LONGMAX - 1L)
+
 enum jb_return_code {
 	/* return codes */
 	JB_OK,            /* 0 */
@@ -95,18 +101,44 @@ typedef struct jb_frame {
 	struct jb_frame *next, *prev;
 } jb_frame;
 
+/* The history is kept sorted in an indexable skiplist threaded through
+ * its slots, so the n'th highest/lowest delay is found in O(log n).
+ * Links are node numbers, 0 ends a list; widths count the nodes a link
+ * skips over, and are 0 on links that end a list. */
+#define JB_HIST_LEVELS		6
+
+typedef struct jb_hist_node {
+	int seq;			/* hist_ptr when added, orders equal delays */
+	unsigned char level;		/* links in use */
+	short next[JB_HIST_LEVELS];
+	short width[JB_HIST_LEVELS];
+} jb_hist_node;
+
 typedef struct jitterbuf {
 	jb_info info;
 
 	/* history */
 	long history[JB_HISTORY_SZ];		/* history */
 	int  hist_ptr;				/* points to index in history for next entry */
-	long hist_maxbuf[JB_HISTORY_MAXBUF_SZ];	/* a sorted buffer of the max delays (highest first) */
-	long hist_minbuf[JB_HISTORY_MAXBUF_SZ];	/* a sorted buffer of the min delays (lowest first) */
-	int  hist_maxbuf_valid;			/* are the "maxbuf"/minbuf valid? */
-
-	jb_frame *frames;		/* queued frames */
-	jb_frame *free;			/* free frames (avoid malloc?) */
+	int  hist_count;			/* entries in history, and in the skiplist */
+	jb_hist_node hist_nodes[JB_HISTORY_SZ + 1];	/* [0] is the head, history[i] is node i + 1 */
+	unsigned int hist_rand;			/* picks skiplist node levels */
+
+	jb_frame *frames;		/* queued frames, from jb_frame_alloc() */
+	jb_frame out;			/* the last frame taken off the list */
+
+	/* While every queued frame is voice of the same length, on that
+	 * length's grid, frames are kept in a ring instead of the list:
+	 * frame ts goes in slot ((ts - ring_base) / ring_ms) % JB_RING_SZ.
+	 * Only one of the ring and the list holds frames at any time. */
+	jb_frame ring[JB_RING_SZ];
+	unsigned char ring_used[JB_RING_SZ];
+	int  ring_count;		/* frames in the ring */
+	long ring_base;			/* ts of slot 0 */
+	long ring_ms;			/* length of ring frames */
+	long ring_lo;			/* (ts - ring_base) / ring_ms of the first frame */
+	long ring_hi;			/* and of the last */
+	int  ring_disabled;		/* queue every frame on the list; kept by jb_reset() */
 } jitterbuf;
 
 
@@ -141,7 +173,7 @@ enum jb_return_code jb_get(jitterbuf *jb, jb_frame *frame, long now, long interp
 /* unconditionally get frames from jitterbuf until empty */
 enum jb_return_code jb_getall(jitterbuf *jb, jb_frame *frameout);
 
-/* when is the next frame due out, in receiver's time (0=EMPTY)
+/* when is the next frame due out, in receiver's time (JB_LONGMAX=nothing due)
  * This value may change as frames are added (esp non-audio frames) */
 long			jb_next(jitterbuf *jb);
 
@@ -151,6 +183,39 @@ enum jb_return_code jb_getinfo(jitterbuf *jb, jb_info *stats);
 /* set jitterbuf conf */
 enum jb_return_code jb_setconf(jitterbuf *jb, jb_conf *conf);
 
+/* move the playout delay by ms (negative shrinks it), without dropping or
+ * interpolating frames; for callers which time-scale the audio they play
+ * out by the same amount */
+enum jb_return_code jb_stretch(jitterbuf *jb, long ms);
+
+/* Frames for every jitterbuffer come from one library-wide pool, so a
+ * call reuses what earlier calls freed instead of each keeping its own.
+ * It is lock free: jitterbuffers may run on different threads.  Frames
+ * are carved from chunks, JB_POOL_CHUNK at a time, and kept for reuse up
+ * to the cap; past it they come from malloc() and go back to it, so the
+ * pool never holds more than the cap however many calls come and go. */
+#define JB_POOL_CHUNK		256
+#define JB_POOL_MAX_CHUNKS	1024
+#define JB_POOL_DEFAULT_CAP	16384
+
+typedef struct jb_pool_stats {
+	long cap;		/* most frames pooled */
+	long pooled;		/* frames carved into the pool so far */
+	long inuse;		/* frames allocated now, pooled or not */
+	long highwater;		/* most frames allocated at once */
+	long hits;		/* allocations that reused a pooled frame */
+	long misses;		/* allocations that carved a new one */
+	long overflows;		/* allocations past the cap, from malloc() */
+} jb_pool_stats;
+
+jb_frame *		jb_frame_alloc(void);
+void			jb_frame_free(jb_frame *frame);
+
+/* most frames to pool, up to JB_POOL_CHUNK * JB_POOL_MAX_CHUNKS; frames
+ * already pooled stay pooled if it is lowered below them */
+void			jb_pool_setcap(long frames);
+void			jb_pool_getstats(jb_pool_stats *stats);
+
 typedef			void (*jb_output_function_t)(const char *fmt, ...);
 extern void jb_setoutput(jb_output_function_t err, jb_output_function_t warn, jb_output_function_t dbg);
 
@@ -0,0 +1,282 @@
+/*
+ * schedbench: libiax2 scheduler benchmark
+ *
+ * Keeps a number of timers pending and fires them one after another,
+ * each fired timer scheduling a replacement and some pending ones being
+ * cancelled along the way, as pings and retransmissions are.  The same
+ * run goes through the scheduler heap and through the sorted list it
+ * replaced, timing both and checking the timers fire in the same order.
+ * Time is simulated, so nothing waits.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License
+ */
+
+/* the scheduler is static; first, as it picks the features the system
+ * headers provide */
+#include "iax.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DELAY_MS	2000
+
+/* The sorted list, as it was before the heap */
+struct legacy_sched {
+	struct timeval when;
+	void *arg;
+	struct legacy_sched *next;
+};
+
+static struct legacy_sched *legacyq;
+
+static struct timeval vnow;
+
+static void sim_clock(struct timeval *tv)
+{
+	*tv = vnow;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: schedbench [options]\n"
+		"  -n timers    timers fired per run (100000)\n"
+		"  -p pending   timers kept pending, repeatable (100, 1000, 10000)\n"
+		"  -c permille  fired timers that also cancel a pending one (100)\n"
+		"  -s seed      random seed (1)\n");
+	exit(1);
+}
+
+/* vnow plus ms, carried as iax_sched_add() does */
+static struct timeval after(int ms)
+{
+	struct timeval tv = vnow;
+
+	tv.tv_sec += ms / 1000;
+	tv.tv_usec += (ms % 1000) * 1000;
+	if (tv.tv_usec > 1000000) {
+		tv.tv_usec -= 1000000;
+		tv.tv_sec++;
+	}
+	return tv;
+}
+
+static void legacy_add(void *arg, int ms)
+{
+	struct legacy_sched *sched, *cur, *prev = NULL;
+
+	sched = (struct legacy_sched *)malloc(sizeof(*sched));
+	if (!sched) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	sched->when = after(ms);
+	sched->arg = arg;
+	cur = legacyq;
+	while (cur && ((cur->when.tv_sec < sched->when.tv_sec) ||
+		       ((cur->when.tv_usec <= sched->when.tv_usec) &&
+			(cur->when.tv_sec == sched->when.tv_sec)))) {
+		prev = cur;
+		cur = cur->next;
+	}
+	sched->next = cur;
+	if (prev)
+		prev->next = sched;
+	else
+		legacyq = sched;
+}
+
+static void legacy_del(void *arg)
+{
+	struct legacy_sched *cur, *prev = NULL;
+
+	for (cur = legacyq; cur; prev = cur, cur = cur->next) {
+		if (cur->arg == arg) {
+			if (prev)
+				prev->next = cur->next;
+			else
+				legacyq = cur->next;
+			free(cur);
+			return;
+		}
+	}
+}
+
+static void *legacy_fire(void)
+{
+	struct legacy_sched *cur = legacyq;
+	void *arg;
+
+	if (!cur)
+		return NULL;
+	legacyq = cur->next;
+	vnow = cur->when;
+	arg = cur->arg;
+	free(cur);
+	return arg;
+}
+
+static void *heap_fire(void)
+{
+	struct iax_sched *cur;
+	void *arg;
+
+	if (!schedlen)
+		return NULL;
+	vnow = schedheap[0]->when;
+	cur = iax_get_sched(vnow);
+	arg = cur->arg;
+	iax_pool_free(cur);
+	return arg;
+}
+
+static void nop(void *arg)
+{
+	(void)arg;
+}
+
+/* Fires timers timers, keeping pending of them pending, through the list
+ * or the heap; the ids fired go to order.  Returns the seconds taken. */
+static double run(int use_heap, int timers, int pending, int cancel,
+		unsigned int seed, long *order, long *cancelled)
+{
+	struct iax_sched **handle;
+	long *slots, *slotof;
+	long ids = 2 * (long)timers + pending, next_id = 0, id;
+	double start;
+	int i, slot;
+
+	handle = (struct iax_sched **)calloc(ids, sizeof(*handle));
+	slots = (long *)malloc(pending * sizeof(*slots));
+	slotof = (long *)malloc(ids * sizeof(*slotof));
+	if (!handle || !slots || !slotof) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	srand(seed);
+	vnow.tv_sec = 1000;
+	vnow.tv_usec = 0;
+	*cancelled = 0;
+	start = now();
+
+	/* a new timer in slot */
+#define ADD() do { \
+		id = next_id++; \
+		slots[slot] = id; \
+		slotof[id] = slot; \
+		if (use_heap) \
+			handle[id] = iax_sched_add(NULL, NULL, nop, (void *)id, \
+					rand() % MAX_DELAY_MS); \
+		else \
+			legacy_add((void *)id, rand() % MAX_DELAY_MS); \
+	} while (0)
+
+	for (slot = 0; slot < pending; slot++)
+		ADD();
+
+	for (i = 0; i < timers; i++) {
+		id = (long)(use_heap ? heap_fire() : legacy_fire());
+		order[i] = id;
+		slot = slotof[id];
+		ADD();
+
+		if (rand() % 1000 < cancel) {
+			slot = rand() % pending;
+			id = slots[slot];
+			if (use_heap)
+				iax_sched_del(handle[id]);
+			else
+				legacy_del((void *)id);
+			ADD();
+			(*cancelled)++;
+		}
+	}
+#undef ADD
+
+	start = now() - start;
+
+	while (use_heap ? heap_fire() : legacy_fire())
+		;
+	free(slotof);
+	free(slots);
+	free(handle);
+	return start;
+}
+
+int main(int argc, char *argv[])
+{
+	int timers = 100000, cancel = 100;
+	int pending[16], npending = 0;
+	unsigned int seed = 1;
+	long *want, *got, cancelled, bad, mismatches = 0;
+	double tl, th;
+	int i, j, opt;
+
+	while ((opt = getopt(argc, argv, "n:p:c:s:")) != -1) {
+		switch (opt) {
+		case 'n': timers = atoi(optarg); break;
+		case 'p':
+			if (npending == 16)
+				usage();
+			pending[npending++] = atoi(optarg);
+			break;
+		case 'c': cancel = atoi(optarg); break;
+		case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (optind != argc || timers < 1 || cancel < 0 || cancel > 1000)
+		usage();
+	if (!npending) {
+		pending[npending++] = 100;
+		pending[npending++] = 1000;
+		pending[npending++] = 10000;
+	}
+	for (i = 0; i < npending; i++)
+		if (pending[i] < 1)
+			usage();
+
+	want = (long *)malloc(timers * sizeof(*want));
+	got = (long *)malloc(timers * sizeof(*got));
+	if (!want || !got) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	iax_set_clock(sim_clock);
+
+	printf("# %d timers fired per run, ns per timer\n", timers);
+	printf("# %8s %10s %10s %10s  %s\n", "pending", "cancelled",
+			"list", "heap", "order");
+	for (i = 0; i < npending; i++) {
+		memset(want, 0, timers * sizeof(*want));
+		memset(got, 0, timers * sizeof(*got));
+		tl = run(0, timers, pending[i], cancel, seed, want, &cancelled);
+		th = run(1, timers, pending[i], cancel, seed, got, &cancelled);
+		for (bad = 0, j = 0; j < timers; j++)
+			bad += want[j] != got[j];
+		mismatches += bad;
+		printf("  %8d %10ld %10.1f %10.1f  ", pending[i], cancelled,
+				tl * 1e9 / timers, th * 1e9 / timers);
+		if (bad)
+			printf("%ld mismatches\n", bad);
+		else
+			printf("same\n");
+	}
+
+	free(got);
+	free(want);
+	return mismatches ? 2 : 0;
+}
@@ -45,6 +45,100 @@ void os_init(void)
 {
 }
 
+#ifdef IAXC_PROC_WAIT
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static int proc_epfd = -1;
+static int proc_wakefd = -1;
+static int proc_timerfd = -1;
+
+void iaxci_proc_wait_destroy(void)
+{
+	if ( proc_epfd >= 0 )
+		close(proc_epfd);
+	if ( proc_wakefd >= 0 )
+		close(proc_wakefd);
+	if ( proc_timerfd >= 0 )
+		close(proc_timerfd);
+	proc_epfd = proc_wakefd = proc_timerfd = -1;
+}
+
+int iaxci_proc_wait_init(int fd)
+{
+	struct epoll_event ev;
+
+	if ( fd < 0 )
+		return -1;
+
+	proc_epfd = epoll_create1(EPOLL_CLOEXEC);
+	proc_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	/* iax_tvnow() is gettimeofday(), so deadlines are CLOCK_REALTIME */
+	proc_timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if ( proc_epfd < 0 || proc_wakefd < 0 || proc_timerfd < 0 )
+		goto fail;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if ( epoll_ctl(proc_epfd, EPOLL_CTL_ADD, fd, &ev) )
+		goto fail;
+	ev.data.fd = proc_wakefd;
+	if ( epoll_ctl(proc_epfd, EPOLL_CTL_ADD, proc_wakefd, &ev) )
+		goto fail;
+	ev.data.fd = proc_timerfd;
+	if ( epoll_ctl(proc_epfd, EPOLL_CTL_ADD, proc_timerfd, &ev) )
+		goto fail;
+	return 0;
+
+fail:
+	iaxci_proc_wait_destroy();
+	return -1;
+}
+
+int iaxci_proc_wait(const struct timeval *deadline)
+{
+	struct epoll_event ev[3];
+	struct itimerspec its;
+	uint64_t count;
+	int i, n;
+
+	/* an all-zero it_value disarms the timer */
+	memset(&its, 0, sizeof(its));
+	if ( deadline )
+	{
+		its.it_value.tv_sec = deadline->tv_sec;
+		its.it_value.tv_nsec = deadline->tv_usec * 1000L;
+		if ( !its.it_value.tv_sec && !its.it_value.tv_nsec )
+			its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(proc_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	n = epoll_wait(proc_epfd, ev, 3, -1);
+	if ( n < 0 )
+		return errno == EINTR ? 0 : -1;
+
+	/* the socket is drained by service_network(); reset the others */
+	for ( i = 0; i < n; i++ )
+		if ( ev[i].data.fd == proc_wakefd || ev[i].data.fd == proc_timerfd )
+			if ( read(ev[i].data.fd, &count, sizeof(count)) < 0 )
+				continue;
+	return n;
+}
+
+void iaxci_proc_wake(void)
+{
+	uint64_t one = 1;
+
+	if ( proc_wakefd >= 0 )
+		if ( write(proc_wakefd, &one, sizeof(one)) < 0 )
+			return; /* counter saturated: a wakeup is pending anyway */
+}
+#endif
+
 void iaxc_millisleep(long ms)
 {
 	struct timespec req;